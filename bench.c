@@ -0,0 +1,676 @@
+/*
+ * bench.c - Headless typing benchmark for xhispertoold
+ *
+ * Starts its own daemon, grabs the daemon's virtual keyboard so nothing
+ * reaches the desktop, and reads every key back from /dev/input/eventN.
+ * Each transcript of the built-in corpus is typed once per timing profile
+ * and decoded back to text, which must match exactly: a missing, extra or
+ * reordered key (or one left held down) fails the run.
+ *
+ * With --trace the daemon writes to its trace output instead, through a
+ * FIFO, so the same checks run without /dev/uinput (containers, CI).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <libgen.h>
+#include <limits.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <linux/input.h>
+#include "keymaps.h"
+#include "xhisper_protocol.h"
+#include "xhisper_stats.h"
+#include "xhisper_trace.h"
+
+// Daemon output (per-command emission and jitter lines) goes here
+#define DAEMON_LOG "/tmp/xhisper_bench.log"
+
+// Longest a transcript may take before the daemon is considered stuck
+#define TYPE_TIMEOUT_MS 30000
+
+// udev may still be applying permissions when the daemon reports ready
+#define DEVICE_WAIT_MS 2000
+
+// Corpus: short dictations, '\b' stands for one backspace
+struct corpus {
+    const char *name;
+    const char *const *texts;
+};
+
+static const char *const corpus_ascii[] = {
+    "the quick brown fox jumps over the lazy dog",
+    "so i think we should move the meeting to thursday afternoon if that works for everyone",
+    "remind me to pick up milk eggs and bread on the way home tonight",
+    "okay let me check the logs again and see what happened after the last deploy",
+    "line one\nline two\tindented",
+    NULL,
+};
+
+static const char *const corpus_mixed[] = {
+    "Hello World, This Is A Test Of Mixed Case Typing.",
+    "Meet me at the Starbucks on Fifth Avenue at 10 AM on Monday.",
+    "The NASA JPL team said the Mars Rover is OK after the CPU reset.",
+    "Please email John McAllister and Sarah O'Brien about the Q3 OKRs.",
+    "iPhone, macOS, GitHub and PostgreSQL are all CamelCase Names.",
+    NULL,
+};
+
+static const char *const corpus_symbols[] = {
+    "int main(int argc, char *argv[]) { return argc > 1 ? 0 : -1; }",
+    "git commit -m \"fix: handle EAGAIN\" && git push origin HEAD~1",
+    "mail jane.doe+tag@example.com or see https://example.org/a?b=c&d=e#f",
+    "$HOME/.config/*.rc | grep -v '^#' > /tmp/out_[1-9].txt; echo 100% `date`",
+    "!@#$%^&*()_+-=[]{}\\|;:'\",.<>/?`~",
+    NULL,
+};
+
+static const char *const corpus_backspace[] = {
+    "teh\b\bhe quick brwon\b\b\bown fox",
+    "i think we shoudl\b\b\b\bould go\b\b\b\b\b\bleave now",
+    "hello world\b\b\b\b\b\b\b\b\b\b\bgoodbye",
+    "abc\bd\be\bf\bg\bh\b end",
+    "wrong sentence entirely\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\bright one",
+    NULL,
+};
+
+static const struct corpus corpora[] = {
+    {"ascii", corpus_ascii},
+    {"mixed-case", corpus_mixed},
+    {"symbols", corpus_symbols},
+    {"backspace", corpus_backspace},
+};
+
+#define NUM_CORPORA (sizeof(corpora) / sizeof(corpora[0]))
+
+// One profile x corpus row of the report
+struct run {
+    size_t texts;
+    size_t chars;
+    unsigned long events;
+    double busy_s;          // first request sent until the sync was acked
+    double *first_ms;       // request sent until the first key press
+    size_t n_first;
+    double *gap_ms;         // key press to the next key press
+    size_t n_gap, cap_gap;
+    size_t failed;
+};
+
+// Read-back state for one transcript
+struct decoder {
+    char out[MAX_MSG];
+    size_t len;
+    char dead;                          // pending dead key, typed by space
+    unsigned char down[KEY_CNT];
+    int held;
+    int dropped;                        // SYN_DROPPED: the kernel lost events
+    unsigned long events;
+    int64_t sent_ns;
+    int64_t last_key_ns;
+};
+
+static int fd_seq = -1;
+static int fd_event = -1;
+static pid_t daemon_pid = 0;
+static int event_clock = 1;  // events carry CLOCK_MONOTONIC stamps, else stamp on read
+static int trace_mode = 0;   // --trace: fd_event is a FIFO of trace records
+static char trace_dir[] = "/tmp/xhisper_bench.XXXXXX";
+static char trace_path[sizeof(trace_dir) + 8];
+static uint32_t next_id = 1;
+
+// Reverse of the layout's ASCII table, [keycode][shift | altgr << 1]
+static char key_chars[KEY_CNT][4];
+static char dead_chars[KEY_CNT][4];
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void stop_daemon(void) {
+    if (daemon_pid > 0) kill(daemon_pid, SIGTERM);
+}
+
+static void on_signal(int sig) {
+    stop_daemon();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void build_decoder(const struct keymap *k) {
+    memset(key_chars, 0, sizeof(key_chars));
+    memset(dead_chars, 0, sizeof(dead_chars));
+    for (int c = 1; c < 128; c++) {
+        int32_t kdef = k->ascii[c];
+        if (kdef == -1) continue;
+        int level = (kdef & FLAG_UPPERCASE ? 1 : 0) | (kdef & FLAG_ALTGR ? 2 : 0);
+        if (kdef & FLAG_DEAD) dead_chars[kdef & 0xffff][level] = c;
+        else key_chars[kdef & 0xffff][level] = c;
+    }
+}
+
+static int is_modifier(uint16_t code) {
+    return code == KEY_LEFTSHIFT || code == KEY_RIGHTSHIFT || code == KEY_RIGHTALT ||
+           code == KEY_LEFTALT || code == KEY_LEFTCTRL || code == KEY_RIGHTCTRL ||
+           code == KEY_LEFTMETA;
+}
+
+// Character a key press produces with the modifiers held; '\x01' for
+// anything the daemon should never send while typing text
+static void decode_press(struct decoder *d, uint16_t code) {
+    if (code == KEY_BACKSPACE) {
+        if (d->len < sizeof(d->out) - 1) d->out[d->len++] = '\b';
+        return;
+    }
+    if (d->down[KEY_LEFTCTRL] || d->down[KEY_RIGHTCTRL] || d->down[KEY_LEFTALT] ||
+        d->down[KEY_LEFTMETA]) {
+        if (d->len < sizeof(d->out) - 1) d->out[d->len++] = '\x01';
+        return;
+    }
+
+    int level = (d->down[KEY_LEFTSHIFT] || d->down[KEY_RIGHTSHIFT]) | d->down[KEY_RIGHTALT] << 1;
+    char c = key_chars[code][level];
+    if (d->dead && code == KEY_SPACE && level == 0) {
+        c = d->dead;
+        d->dead = 0;
+    } else if (dead_chars[code][level]) {
+        d->dead = dead_chars[code][level];
+        return;
+    }
+    if (d->len < sizeof(d->out) - 1) d->out[d->len++] = c ? c : '\x01';
+}
+
+static void gap_add(struct run *r, double ms) {
+    if (r->n_gap == r->cap_gap) {
+        size_t cap = r->cap_gap ? r->cap_gap * 2 : 1024;
+        double *grown = realloc(r->gap_ms, cap * sizeof(double));
+        if (!grown) return;
+        r->gap_ms = grown;
+        r->cap_gap = cap;
+    }
+    r->gap_ms[r->n_gap++] = ms;
+}
+
+static void decode_event(struct decoder *d, struct run *r, uint16_t type, uint16_t code,
+                         int32_t value, int64_t t) {
+    d->events++;
+    if (type == EV_SYN && code == SYN_DROPPED) d->dropped = 1;
+    if (type != EV_KEY || code >= KEY_CNT) return;
+
+    if (value == 0) {
+        if (d->down[code]) d->held--;
+        d->down[code] = 0;
+        return;
+    }
+    if (!d->down[code]) d->held++;
+    d->down[code] = 1;
+    if (is_modifier(code)) return;
+
+    if (d->last_key_ns) gap_add(r, (t - d->last_key_ns) / 1e6);
+    else r->first_ms[r->n_first++] = (t - d->sent_ns) / 1e6;
+    d->last_key_ns = t;
+
+    decode_press(d, code);
+}
+
+// Read whatever the device (or trace FIFO) has; 0 when drained, -1 on error
+static int read_events(struct decoder *d, struct run *r) {
+    static char buf[64 * sizeof(struct input_event)];
+    static size_t have = 0;
+    static int header = 1;  // trace: header not read yet
+    size_t rec = trace_mode ? sizeof(struct trace_event) : sizeof(struct input_event);
+
+    while (1) {
+        ssize_t n = read(fd_event, buf + have, sizeof(buf) - have);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n < 0) {
+            perror("failed to read events");
+            return -1;
+        }
+        if (n == 0) return 0;
+        have += n;
+
+        size_t off = 0;
+        if (trace_mode && header) {
+            if (have < sizeof(struct trace_header)) continue;
+            if (memcmp(buf, TRACE_MAGIC, sizeof(((struct trace_header *)0)->magic)) != 0) {
+                fprintf(stderr, "xhisper_bench: the daemon did not write a trace\n");
+                return -1;
+            }
+            off = sizeof(struct trace_header);
+            header = 0;
+        }
+        for (; have - off >= rec; off += rec) {
+            if (trace_mode) {
+                struct trace_event te;
+                memcpy(&te, buf + off, rec);
+                decode_event(d, r, te.type, te.code, te.value, te.t_ns);
+            } else {
+                struct input_event ev;
+                memcpy(&ev, buf + off, rec);
+                decode_event(d, r, ev.type, ev.code, ev.value,
+                             event_clock ? (int64_t)ev.input_event_sec * 1000000000 +
+                                           ev.input_event_usec * 1000 : now_ns());
+            }
+        }
+        memmove(buf, buf + off, have - off);
+        have -= off;
+    }
+}
+
+// Send one request (command byte + payload); returns its id, 0 on failure
+static uint32_t send_frame(char cmd, const char *payload, size_t len) {
+    struct frame_header hdr = {
+        .version = PROTO_VERSION,
+        .cmd = cmd,
+        .id = next_id++,
+    };
+    struct iovec iov[2] = {
+        {.iov_base = &hdr, .iov_len = sizeof(hdr)},
+        {.iov_base = (void *)payload, .iov_len = len},
+    };
+    struct msghdr mh = {.msg_iov = iov, .msg_iovlen = 2};
+
+    if (sendmsg(fd_seq, &mh, MSG_NOSIGNAL) != (ssize_t)(sizeof(hdr) + len)) {
+        perror("failed to send request");
+        return 0;
+    }
+    return hdr.id;
+}
+
+// Next ack; its status, or -1 if the daemon went away
+static int recv_ack(uint32_t *id) {
+    char buf[sizeof(struct frame_header) + MAX_MSG];
+    struct frame_header hdr;
+
+    ssize_t n;
+    do {
+        n = recv(fd_seq, buf, sizeof(buf), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n < (ssize_t)sizeof(hdr)) {
+        fprintf(stderr, "xhisper_bench: connection to xhispertoold lost\n");
+        return -1;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    *id = hdr.id;
+    return hdr.status;
+}
+
+// A request that types nothing (profile, layout): send it and wait
+static int request(char cmd, const char *payload) {
+    uint32_t id, sent = send_frame(cmd, payload, strlen(payload));
+    if (!sent) return -1;
+
+    int status;
+    while ((status = recv_ack(&id)) >= 0 && id != sent);
+    return status;
+}
+
+// Print text with control characters escaped, for mismatch reports
+static void print_escaped(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '\b') fputs("\\b", stderr);
+        else if (s[i] == '\n') fputs("\\n", stderr);
+        else if (s[i] == '\t') fputs("\\t", stderr);
+        else if ((unsigned char)s[i] < 0x20) fprintf(stderr, "\\x%02x", s[i]);
+        else fputc(s[i], stderr);
+    }
+}
+
+// Type one transcript as 's' and 'b' requests plus a sync, reading the keys
+// back until the sync is acked; 0 if they decode to exactly the text
+static int type_text(const char *text, struct run *r) {
+    static struct decoder d;
+    memset(&d, 0, sizeof(d));
+
+    d.sent_ns = now_ns();
+    int failed = 0;
+    for (const char *p = text; *p && !failed;) {
+        size_t n = strspn(p, "\b");
+        if (n > 0) {
+            char count[24];
+            snprintf(count, sizeof(count), "%zu", n);
+            failed = !send_frame('b', count, strlen(count));
+        } else {
+            n = strcspn(p, "\b");
+            failed = !send_frame('s', p, n);
+        }
+        p += n;
+    }
+    uint32_t sync = failed ? 0 : send_frame('W', "", 0);
+    if (!sync) return -1;
+
+    int synced = 0;
+    while (!synced) {
+        struct pollfd pfds[2] = {
+            {.fd = fd_event, .events = POLLIN},
+            {.fd = fd_seq, .events = POLLIN},
+        };
+        int ready = poll(pfds, 2, TYPE_TIMEOUT_MS);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) {
+            fprintf(stderr, "xhisper_bench: no progress for %d ms\n", TYPE_TIMEOUT_MS);
+            return -1;
+        }
+        if (pfds[0].revents && read_events(&d, r) < 0) return -1;
+        if (pfds[1].revents) {
+            uint32_t id;
+            int status = recv_ack(&id);
+            if (status < 0) return -1;
+            if (status != XH_OK) failed = 1;
+            synced = id == sync;
+        }
+    }
+
+    // Everything written before the ack is already in the device's buffer
+    if (read_events(&d, r) < 0) return -1;
+    r->busy_s += (now_ns() - d.sent_ns) / 1e9;
+    r->events += d.events;
+    r->chars += strlen(text);
+    r->texts++;
+
+    if (failed || d.dropped || d.held || d.len != strlen(text) || memcmp(d.out, text, d.len) != 0) {
+        size_t at = 0;
+        while (at < d.len && text[at] == d.out[at]) at++;
+        fprintf(stderr, "xhisper_bench: mismatch at %zu%s%s%s\n  expected: ", at,
+                failed ? ", request failed" : "", d.dropped ? ", events dropped" : "",
+                d.held ? ", keys left held" : "");
+        print_escaped(text, strlen(text));
+        fputs("\n  got:      ", stderr);
+        print_escaped(d.out, d.len);
+        fputc('\n', stderr);
+        r->failed++;
+    }
+    return 0;
+}
+
+// Event node of the most recently created "xhisper" input device
+static int find_device(char *path, size_t size) {
+    DIR *dir = opendir("/sys/class/input");
+    if (!dir) return -1;
+
+    int best = -1;
+    struct dirent *de;
+    while ((de = readdir(dir))) {
+        int num;
+        if (sscanf(de->d_name, "event%d", &num) != 1 || num <= best) continue;
+
+        char name_path[PATH_MAX], name[256] = "";
+        snprintf(name_path, sizeof(name_path), "/sys/class/input/%s/device/name", de->d_name);
+        FILE *f = fopen(name_path, "r");
+        if (!f) continue;
+        if (fgets(name, sizeof(name), f) && strcmp(name, "xhisper\n") == 0) best = num;
+        fclose(f);
+    }
+    closedir(dir);
+
+    if (best < 0) return -1;
+    snprintf(path, size, "/dev/input/event%d", best);
+    return 0;
+}
+
+static int open_device(const char *device) {
+    char path[64];
+    if (!device) {
+        if (find_device(path, sizeof(path)) < 0) {
+            fprintf(stderr, "xhisper_bench: no xhisper input device in /sys/class/input "
+                    "(use --device=/dev/input/eventN)\n");
+            return -1;
+        }
+        device = path;
+    }
+
+    int64_t start = now_ns();
+    while ((fd_event = open(device, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0 &&
+           (errno == EACCES || errno == ENOENT) && now_ns() - start < DEVICE_WAIT_MS * 1000000LL) {
+        usleep(10000);
+    }
+    if (fd_event < 0) {
+        fprintf(stderr, "failed to open %s: %s\n", device, strerror(errno));
+        if (errno == EACCES) fprintf(stderr, "Make sure you're in the 'input' group\n");
+        return -1;
+    }
+
+    // Exclusive: the compositor stops seeing the typing for as long as we
+    // hold the device open
+    int clock = CLOCK_MONOTONIC;
+    if (ioctl(fd_event, EVIOCGRAB, 1) < 0) {
+        if (errno != ENOTTY && errno != EINVAL) {
+            fprintf(stderr, "failed to grab %s: %s\n", device, strerror(errno));
+            return -1;
+        }
+        // Not an evdev node: stamp events when they are read
+        event_clock = 0;
+    } else if (ioctl(fd_event, EVIOCSCLOCKID, &clock) < 0) {
+        event_clock = 0;
+    }
+    printf("Reading %s%s\n", device, event_clock ? " (grabbed)" : "");
+    return 0;
+}
+
+static void remove_trace(void) {
+    unlink(trace_path);
+    rmdir(trace_dir);
+}
+
+// The daemon opens the FIFO for writing at startup, which only succeeds
+// once it has a reader
+static int open_trace(void) {
+    if (!mkdtemp(trace_dir)) {
+        perror("failed to create trace directory");
+        return -1;
+    }
+    snprintf(trace_path, sizeof(trace_path), "%s/trace", trace_dir);
+    atexit(remove_trace);
+    if (mkfifo(trace_path, 0600) < 0 ||
+        (fd_event = open(trace_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "failed to create %s: %s\n", trace_path, strerror(errno));
+        return -1;
+    }
+    printf("Reading the daemon's trace output (no uinput)\n");
+    return 0;
+}
+
+static int connect_daemon(void) {
+    fd_seq = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path + 1, SEQ_SOCKET_NAME, sizeof(addr.sun_path) - 2);
+    if (fd_seq >= 0 && connect(fd_seq, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd_seq);
+        fd_seq = -1;
+    }
+    return fd_seq;
+}
+
+// Our own daemon via `xhispertool start`, so a running one (with the user's
+// profile and layout, typing into their session) is never touched
+static int start_daemon(const char *layout) {
+    if (connect_daemon() >= 0) {
+        fprintf(stderr, "xhisper_bench: xhispertoold is already running; stop it first "
+                "(pkill -x xhispertoold)\n");
+        return -1;
+    }
+
+    char exe[PATH_MAX - 32], tool[PATH_MAX], layout_arg[64], output_arg[sizeof(trace_path) + 16];
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    exe[n > 0 ? n : 0] = '\0';
+    snprintf(tool, sizeof(tool), "%s/xhispertool", dirname(exe));
+    snprintf(layout_arg, sizeof(layout_arg), "--layout=%s", layout);
+    snprintf(output_arg, sizeof(output_arg), "--output=trace:%s", trace_path);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("failed to fork");
+        return -1;
+    }
+    if (pid == 0) {
+        int log = open(DAEMON_LOG, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (log >= 0) {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+        }
+        execl(tool, "xhispertool", "start", layout_arg, trace_mode ? output_arg : (char *)NULL,
+              (char *)NULL);
+        fprintf(stderr, "failed to run %s: %s\n", tool, strerror(errno));
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || connect_daemon() < 0) {
+        fprintf(stderr, "xhisper_bench: xhispertoold failed to start, see %s\n", DAEMON_LOG);
+        return -1;
+    }
+
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd_seq, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) daemon_pid = cred.pid;
+    atexit(stop_daemon);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    return 0;
+}
+
+// Whether name is in a comma-separated list
+static int in_list(const char *list, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = list; *p; p += strcspn(p, ",")) {
+        if (*p == ',') p++;
+        if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0')) return 1;
+    }
+    return 0;
+}
+
+static void report(const char *profile, const char *corpus, struct run *r) {
+    double first[3], gap[3];
+    percentiles(r->first_ms, r->n_first, first);
+    percentiles(r->gap_ms, r->n_gap, gap);
+
+    printf("%-6s %-11s %5zu %6zu %8.1f %9.1f  %6.2f %6.2f %6.2f  %6.2f %6.2f %6.2f  %s\n",
+           profile, corpus, r->texts, r->chars, r->busy_s > 0 ? r->chars / r->busy_s : 0,
+           r->busy_s > 0 ? r->events / r->busy_s : 0, first[0], first[1], first[2],
+           gap[0], gap[1], gap[2], r->failed ? "FAIL" : "ok");
+    fflush(stdout);
+}
+
+static void show_usage(void) {
+    fprintf(stderr,
+        "Usage: xhisper_bench [--profile=<name>,...] [--corpus=<name>,...] [--layout=<name>]\n"
+        "                     [--repeat=<n>] [--device=/dev/input/eventN | --trace]\n"
+        "\n"
+        "Types the corpus (ascii, mixed-case, symbols, backspace) through a fresh\n"
+        "xhispertoold once per timing profile (default safe,fast,burst), reads the keys\n"
+        "back from its input device and checks they decode to the same text. Reports\n"
+        "chars/s, events/s, and p50/p95/p99 of the time from request to first key and\n"
+        "between key presses. Exits 1 if any transcript came back wrong. --trace reads\n"
+        "the daemon's trace output instead, without /dev/uinput.\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *profiles = "safe,fast,burst";
+    const char *corpus_names = NULL;
+    const char *layout_name = "us";
+    const char *device = NULL;
+    int repeat = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profiles = argv[i] + 10;
+        } else if (strncmp(argv[i], "--corpus=", 9) == 0) {
+            corpus_names = argv[i] + 9;
+        } else if (strncmp(argv[i], "--layout=", 9) == 0) {
+            layout_name = argv[i] + 9;
+        } else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+            repeat = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--device=", 9) == 0) {
+            device = argv[i] + 9;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace_mode = 1;
+        } else {
+            show_usage();
+            return 1;
+        }
+    }
+    if (repeat < 1) {
+        fprintf(stderr, "Error: --repeat must be a positive number\n");
+        return 1;
+    }
+
+    const struct keymap *layout = NULL;
+    for (size_t i = 0; i < NUM_KEYMAPS; i++) {
+        if (strcmp(keymaps[i].name, layout_name) == 0) layout = &keymaps[i];
+    }
+    if (!layout) {
+        fprintf(stderr, "Error: Unknown keyboard layout '%s'\n", layout_name);
+        return 1;
+    }
+    build_decoder(layout);
+
+    if ((trace_mode && open_trace() < 0) || start_daemon(layout_name) < 0 ||
+        (!trace_mode && open_device(device) < 0)) {
+        return 1;
+    }
+
+    printf("%-6s %-11s %5s %6s %8s %9s  %-20s  %-20s\n", "", "", "", "", "", "",
+           "first key ms", "key gap ms");
+    printf("%-6s %-11s %5s %6s %8s %9s  %6s %6s %6s  %6s %6s %6s\n", "profile", "corpus",
+           "texts", "chars", "chars/s", "events/s", "p50", "p95", "p99", "p50", "p95", "p99");
+
+    size_t failed = 0;
+    for (const char *p = profiles; *p; p += strcspn(p, ",")) {
+        if (*p == ',') p++;
+        char profile[32];
+        snprintf(profile, sizeof(profile), "%.*s", (int)strcspn(p, ","), p);
+        if (!*profile) continue;
+
+        int status = request('P', profile);
+        if (status != XH_OK) {
+            fprintf(stderr, "Error: %s timing profile '%s'\n",
+                    status < 0 ? "failed to select" : "unknown", profile);
+            return 1;
+        }
+
+        for (size_t c = 0; c < NUM_CORPORA; c++) {
+            if (corpus_names && !in_list(corpus_names, corpora[c].name)) continue;
+
+            size_t texts = 0;
+            while (corpora[c].texts[texts]) texts++;
+            struct run r = {.first_ms = calloc(texts * repeat, sizeof(double))};
+            if (!r.first_ms) {
+                perror("failed to allocate buffer");
+                return 1;
+            }
+
+            for (int n = 0; n < repeat; n++) {
+                for (size_t t = 0; t < texts; t++) {
+                    if (type_text(corpora[c].texts[t], &r) < 0) return 1;
+                }
+            }
+            report(profile, corpora[c].name, &r);
+            failed += r.failed;
+            free(r.first_ms);
+            free(r.gap_ms);
+        }
+    }
+
+    if (failed) {
+        fprintf(stderr, "xhisper_bench: %zu transcripts came back wrong\n", failed);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""
+Generate keymaps.h for xhispertool from keymaps/*.map layout definitions.
+
+Each .map file describes one XKB layout, one physical key per line:
+
+    KEY_NAME  base  shift  altgr  altgr+shift
+
+Every level is a single character, U+XXXX, "none" or "dead:<char>" for a
+dead key that produces <char> when followed by space. Missing trailing
+levels are "none". The first comment line, up to " - ", is the layout's
+description.
+
+For each layout this emits a 128-entry ASCII table (same encoding as the
+original ascii2keycode_map) and a table of the non-ASCII characters with a
+direct key, sorted by code point for bsearch(). A character reachable on
+several levels gets the one needing the fewest modifiers.
+"""
+
+import sys
+from pathlib import Path
+
+LEVEL_FLAGS = ["", "FLAG_UPPERCASE", "FLAG_ALTGR", "FLAG_ALTGR|FLAG_UPPERCASE"]
+
+# Always typable regardless of layout
+COMMON = {" ": "KEY_SPACE", "\t": "KEY_TAB", "\n": "KEY_ENTER"}
+
+
+def parse_char(token, path, lineno):
+    dead = token.startswith("dead:")
+    if dead:
+        token = token[5:]
+    if token.startswith("U+") and len(token) > 2:
+        return chr(int(token[2:], 16)), dead
+    if len(token) != 1:
+        sys.exit(f"{path}:{lineno}: expected one character, got '{token}'")
+    return token, dead
+
+
+def parse_map(path):
+    description = None
+    keys = []
+    for lineno, line in enumerate(path.read_text(encoding="utf-8").splitlines(), 1):
+        stripped = line.strip()
+        if not stripped:
+            continue
+        if stripped.startswith("#"):
+            if description is None:
+                description = stripped.lstrip("# ").split(" - ")[0]
+            continue
+
+        fields = stripped.split()
+        if not fields[0].startswith("KEY_") or len(fields) > 5:
+            sys.exit(f"{path}:{lineno}: expected KEY_NAME and up to four levels")
+        levels = [
+            None if tok == "none" else parse_char(tok, path, lineno)
+            for tok in fields[1:]
+        ]
+        keys.append((fields[0], levels))
+
+    return description or path.stem, keys
+
+
+def build_layout(path):
+    description, keys = parse_map(path)
+    mapping = {}
+
+    # Fewest modifiers first: every key's base level, then shift, ...
+    for level, flags in enumerate(LEVEL_FLAGS):
+        for keycode, levels in keys:
+            if level >= len(levels) or levels[level] is None:
+                continue
+            char, dead = levels[level]
+            kdef = keycode + ("|" + flags if flags else "")
+            if dead:
+                kdef += "|FLAG_DEAD"
+            # A dead key only wins over nothing
+            current = mapping.get(char)
+            if current is None or (current[1] and not dead):
+                mapping[char] = (kdef, dead)
+
+    for char, keycode in COMMON.items():
+        mapping.setdefault(char, (keycode, False))
+
+    missing = [chr(c) for c in range(0x20, 0x7F) if chr(c) not in mapping]
+    if missing:
+        sys.exit(f"{path}: no key for ASCII {''.join(missing)!r}")
+
+    return description, {c: k for c, (k, _) in mapping.items()}
+
+
+def c_comment(char):
+    if char == "\t":
+        return "tab"
+    if char == "\n":
+        return "enter"
+    if char == "\\":
+        return "'\\\\'"
+    return f"'{char}'"
+
+
+def emit_layout(name, description, mapping, out):
+    out.append(f"// {description}")
+    out.append(f"static const int32_t keymap_{name}_ascii[128] = {{")
+    for code in range(128):
+        char = chr(code)
+        kdef = mapping.get(char, "-1")
+        comment = f"  // 0x{code:02x} {c_comment(char)}" if char in mapping else ""
+        out.append(f"\t{kdef},{comment}")
+    out.append("};")
+    out.append("")
+
+    extra = sorted((ord(c), k, c) for c, k in mapping.items() if ord(c) >= 128)
+    out.append(f"static const struct keymap_entry keymap_{name}_extra[] = {{")
+    for cp, kdef, char in extra:
+        out.append(f"\t{{0x{cp:04x}, {kdef}}},  // {char}")
+    if not extra:
+        out.append("\t{0, -1},  // no direct non-ASCII keys")
+    out.append("};")
+    out.append("")
+    return len(extra)
+
+
+def main():
+    paths = sorted(Path(p) for p in sys.argv[1:])
+    # US first: it is the default layout
+    paths.sort(key=lambda p: p.stem != "us")
+    if not paths:
+        sys.exit("usage: gen_keymaps.py keymaps/*.map > keymaps.h")
+
+    out = [
+        "/*",
+        " * keymaps.h - generated by gen_keymaps.py from the keymaps directory, do not edit",
+        " */",
+        "",
+        "#ifndef KEYMAPS_H",
+        "#define KEYMAPS_H",
+        "",
+        "#include <stddef.h>",
+        "#include <stdint.h>",
+        "#include <linux/input-event-codes.h>",
+        "",
+        "// Key definitions: KEY_* in the low 16 bits plus modifier flags",
+        "#define FLAG_UPPERCASE 0x80000000  // hold shift",
+        "#define FLAG_ALTGR     0x40000000  // hold AltGr (right alt)",
+        "#define FLAG_DEAD      0x20000000  // dead key, follow with space",
+        "",
+        "struct keymap_entry {",
+        "    uint32_t cp;",
+        "    int32_t kdef;",
+        "};",
+        "",
+        "struct keymap {",
+        "    const char *name;",
+        "    const char *description;",
+        "    const int32_t *ascii;              // -1 where the layout has no key",
+        "    const struct keymap_entry *extra;  // non-ASCII, sorted by cp",
+        "    size_t n_extra;",
+        "};",
+        "",
+    ]
+
+    table = []
+    for path in paths:
+        description, mapping = build_layout(path)
+        n_extra = emit_layout(path.stem, description, mapping, out)
+        table.append(
+            f'\t{{"{path.stem}", "{description}", keymap_{path.stem}_ascii, '
+            f"keymap_{path.stem}_extra, {n_extra}}},"
+        )
+
+    out.append("static const struct keymap keymaps[] = {")
+    out.extend(table)
+    out.append("};")
+    out.append("")
+    out.append("#define NUM_KEYMAPS (sizeof(keymaps) / sizeof(keymaps[0]))")
+    out.append("")
+    out.append("#endif")
+    print("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()
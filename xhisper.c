@@ -0,0 +1,2642 @@
+/*
+ * xhisper - Whisper for Linux
+ * Dictation controller: the first call stays resident on @xhisper_control
+ * with the parsed xhisperrc and its connections to xhispertoold and the
+ * transcription server; every call (the first one included) just sends it
+ * a toggle. Record, stop, silence check, transcription, post-processing
+ * and typing run as one epoll loop.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <stddef.h>
+
+#include "keymaps.h"
+#include "xhisper_json.h"
+#include "xhisper_protocol.h"
+#include "xhisper_stats.h"
+
+#define LOGFILE "/tmp/xhisper.log"
+#define RECORDING "/tmp/xhisper.wav"
+#define DAEMON_LOG "/tmp/xhispertoold.log"
+#define TRANSCRIBE_LOG "/tmp/xhisper_transcribe.log"
+
+// One JSON line of stage timings per dictation, for comparing models and
+// configs over time
+#define SPANS_LOG "/tmp/xhisper_spans.jsonl"
+
+// Delay before "(recording...)" is typed, so the hotkey's modifiers are up
+#define PLACEHOLDER_DELAY_MS 200
+
+// How long "(no sound detected)" stays on screen
+#define NOTICE_MS 400
+
+// Connections kept open by "subscribe" for state change events
+#define MAX_SUBSCRIBERS 8
+
+// Waits for a freshly started daemon or server to accept connections; the
+// daemon itself may wait up to a second for udev to announce its device
+#define DAEMON_START_MS 2000
+#define SERVER_START_MS 5000
+
+// Post-processing LLM server (Ollama's HTTP API) when neither
+// post-process-url nor $OLLAMA_HOST says otherwise, and how long it keeps
+// the model loaded after each request
+#define LLM_DEFAULT_HOST "127.0.0.1:11434"
+#define LLM_KEEP_ALIVE "30m"
+#define LLM_ADDRS_MAX 4
+
+// Settings from xhisperrc (see default_xhisperrc)
+struct config {
+    char model_name[32];
+    char model_device[16];
+    char model_language[16];
+    char transcription_prompt[1024];
+    double silence_threshold;
+    double silence_percentage;
+    double non_ascii_initial_delay;
+    double non_ascii_default_delay;
+    char typing_profile[32];
+    char unicode_method[32];
+    char keyboard_layout[32];
+    int live_transcription;
+    int trim_silence;
+    char post_process_model[128];
+    double post_process_timeout;
+    char post_process_mode[16];
+    char post_process_url[256];
+    int post_process_cache;     // results kept, 0: no cache
+    char hotkey[256];           // comma-separated chords for xhispertoold
+    char hotkey_device[256];
+};
+
+enum state {
+    ST_IDLE,
+    ST_RECORDING,
+    ST_ANALYZING,   // waiting for the recorder's silence verdict
+    ST_TRANSCRIBING,
+    ST_FORMATTING,
+    ST_TYPING,      // text handed to xhispertoold, not all typed yet
+    ST_NOTICE,      // "(no sound detected)" on screen
+};
+
+static const char *state_names[] = {
+    [ST_IDLE] = "idle",
+    [ST_RECORDING] = "recording",
+    [ST_ANALYZING] = "analyzing",
+    [ST_TRANSCRIBING] = "transcribing",
+    [ST_FORMATTING] = "formatting",
+    [ST_TYPING] = "typing",
+    [ST_NOTICE] = "no-sound",
+};
+
+// Stages of a dictation, timed from the stop toggle on (milliseconds)
+enum span {
+    SPAN_STOP,          // stopping the recorder and getting its audio
+    SPAN_SILENCE,       // the recorder's silence check and trim
+    SPAN_LOAD,          // model load in the server, 0 when resident
+    SPAN_DECODE,
+    SPAN_POST_PROCESS,
+    SPAN_TYPING,        // last text sent until xhispertoold has typed it
+    SPAN_TOTAL,         // stop toggle until typed
+    NUM_SPANS,
+};
+
+static const char *span_names[] = {
+    [SPAN_STOP] = "stop",
+    [SPAN_SILENCE] = "silence",
+    [SPAN_LOAD] = "load",
+    [SPAN_DECODE] = "decode",
+    [SPAN_POST_PROCESS] = "post_process",
+    [SPAN_TYPING] = "typing",
+    [SPAN_TOTAL] = "total",
+};
+
+// What the timerfd is counting down to
+enum timer_action {
+    TIMER_NONE,
+    TIMER_PLACEHOLDER,
+    TIMER_NOTICE,
+    TIMER_POST_PROCESS,
+};
+
+// One dictation, from the toggle that starts it to the text on screen
+struct session {
+    char mode[16];
+    char wrap;              // xhispertoold key command pressed around pastes, or 0
+    int live;
+    int placeholder;        // "(recording...)" has been typed
+    int segments;           // segments typed so far (streamed, no post-processing)
+    int fallback;           // live failed, decoding the saved WAV instead
+    pid_t recorder;         // xhispertool record, or the live transcriber
+    pid_t capture;          // pw-record feeding the live transcriber
+    int fd_reply;           // transcription server connection
+    struct buf line;        // partial reply line
+    struct buf text;        // transcription so far
+    struct buf shown;       // segments as typed, replacements applied
+    struct buf formatted;    // LLM answer so far
+    struct buf held;         // streamed, not typed yet (trailing whitespace)
+    int streamed;            // part of the answer is on screen
+    long typed;              // characters of it, or of the segments typed
+    double first_token_ms;
+    char post_mode[16];
+    struct timespec started;
+    struct timespec stopped;    // stop toggle, zero before it
+    double spans[NUM_SPANS];    // ms
+    unsigned timed;             // bit per span that ran
+    double audio_s;
+    const char *outcome;        // "typed", "no-sound" or "error"; NULL is typed
+};
+
+// A finished dictation waiting for its text to be typed
+struct span_record {
+    int active;
+    double spans[NUM_SPANS];
+    unsigned timed;
+    double audio_s;
+    const char *outcome;
+    char mode[16];
+    int live;
+    struct timespec stopped;
+    struct timespec typing;
+};
+
+static struct config cfg;
+static struct timespec cfg_mtime;
+static off_t cfg_size = -1;
+static char cfg_path[PATH_MAX];
+
+static char tool_path[PATH_MAX];
+static char daemon_path[PATH_MAX];
+static char script_path[PATH_MAX];
+static const char *clip_tool;     // "wl-copy" or "xclip", NULL without either
+static const struct keymap *layout = &keymaps[0];
+
+static enum state state = ST_IDLE;
+static struct session s = {.fd_reply = -1};
+static enum timer_action timer_action = TIMER_NONE;
+
+static int fd_epoll = -1;
+static int fd_timer = -1;
+static int fd_tool = -1;    // seqpacket connection to xhispertoold
+static uint32_t next_id = 1;
+static uint32_t typing_id;  // 'W' ack that ends ST_TYPING
+static int subscribers[MAX_SUBSCRIBERS];
+
+static struct span_record pending;
+static struct window span_windows[NUM_SPANS];
+static unsigned long dictations;
+
+
+static int64_t ts_ns(const struct timespec *ts) {
+    return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static double elapsed_s(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ts_ns(&now) - ts_ns(start)) / 1e9;
+}
+
+static void sleep_s(double seconds) {
+    struct timespec ts = {
+        .tv_sec = (time_t)seconds,
+        .tv_nsec = (long)((seconds - (time_t)seconds) * 1e9),
+    };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+// Same entry format as xhisper.sh's logging_end_and_write_to_logfile
+static void log_result(const char *title, const char *result, const struct timespec *start) {
+    FILE *f = fopen(LOGFILE, "a");
+    if (!f) return;
+    fprintf(f, "=== %s ===\nResult: [%s]\nTime: %.3fs\n", title, result, elapsed_s(start));
+    fclose(f);
+}
+
+// State change events
+
+static void unsubscribe(int slot) {
+    epoll_ctl(fd_epoll, EPOLL_CTL_DEL, subscribers[slot], NULL);
+    close(subscribers[slot]);
+    subscribers[slot] = -1;
+}
+
+// Push an event to every subscriber; one that doesn't keep up is dropped
+static void publish(const char *event) {
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+        if (subscribers[i] >= 0 &&
+            send(subscribers[i], event, strlen(event), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            unsubscribe(i);
+        }
+    }
+}
+
+static void set_state(enum state next) {
+    if (next == state) return;
+    state = next;
+    publish(state_names[state]);
+}
+
+// "error <what>"; the state that follows is published as usual
+static void publish_error(const char *what) {
+    s.outcome = "error";
+    char event[128];
+    snprintf(event, sizeof(event), "error %s", what);
+    publish(event);
+}
+
+// Post-processing cache: formatted results of earlier dictations, keyed by
+// model, mode and normalized transcript, in a memory-mapped file so they
+// outlive the controller. Slots are fixed-size; a lookup scans the index of
+// hashes up front and touches only the slot that matches. When the cache is
+// full, the least recently used slot is reused.
+
+#define CACHE_MAGIC "XHCACHE1"
+#define CACHE_SLOT_SIZE 1024
+#define CACHE_MAX_SLOTS 100000
+
+struct cache_header {
+    char magic[8];
+    uint32_t slots;
+    uint32_t entries;
+    uint64_t clock;         // bumped on every use, for LRU
+    uint64_t hits;
+    uint64_t misses;
+};
+
+struct cache_index {
+    uint64_t hash;          // 0: empty
+    uint64_t used;          // clock at last use
+};
+
+struct cache_slot {
+    uint16_t key_len;
+    uint16_t value_len;
+    char data[CACHE_SLOT_SIZE - 4];     // key, then value
+};
+
+static struct {
+    struct cache_header *header;
+    struct cache_index *index;
+    struct cache_slot *slot;
+    size_t size;
+} cache;
+
+static void cache_close(void) {
+    if (cache.header) munmap(cache.header, cache.size);
+    cache.header = NULL;
+}
+
+// Map the cache for post-process-cache slots; a file made for another size
+// starts over
+static int cache_open(void) {
+    uint32_t slots = cfg.post_process_cache < 0 ? 0 :
+                     cfg.post_process_cache > CACHE_MAX_SLOTS ? CACHE_MAX_SLOTS : cfg.post_process_cache;
+    if (cache.header && cache.header->slots == slots) return 0;
+    cache_close();
+    if (!slots) return -1;
+
+    char path[PATH_MAX];
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    if (cache_home && *cache_home) {
+        snprintf(path, sizeof(path), "%s", cache_home);
+    } else {
+        snprintf(path, sizeof(path), "%s/.cache", getenv("HOME") ? getenv("HOME") : "");
+    }
+    mkdir(path, 0700);
+    snprintf(path + strlen(path), sizeof(path) - strlen(path), "/xhisper");
+    mkdir(path, 0700);
+    snprintf(path + strlen(path), sizeof(path) - strlen(path), "/post_process.cache");
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "xhisper: failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    size_t size = sizeof(struct cache_header) + slots * (sizeof(struct cache_index) + sizeof(struct cache_slot));
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (st.st_size == (off_t)size || (ftruncate(fd, 0) == 0 && ftruncate(fd, size) == 0))) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "xhisper: failed to map %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    cache.header = map;
+    cache.index = (struct cache_index *)(cache.header + 1);
+    cache.slot = (struct cache_slot *)(cache.index + slots);
+    cache.size = size;
+    if (memcmp(cache.header->magic, CACHE_MAGIC, 8) != 0 || cache.header->slots != slots) {
+        memset(map, 0, size);
+        memcpy(cache.header->magic, CACHE_MAGIC, 8);
+        cache.header->slots = slots;
+    }
+    return 0;
+}
+
+// "<model>\n<mode>\n<text>", the text lowercased, with whitespace collapsed
+// and without trailing punctuation, so "Git status." and "git status" are
+// the same dictation
+static void cache_key(struct buf *key) {
+    buf_str(key, cfg.post_process_model);
+    buf_str(key, "\n");
+    buf_str(key, s.post_mode);
+    buf_str(key, "\n");
+
+    size_t start = key->len;
+    int space = 0;
+    for (const char *p = buf_cstr(&s.text); *p; p++) {
+        if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+            space = key->len > start;
+            continue;
+        }
+        if (space) buf_append(key, " ", 1);
+        space = 0;
+        char c = *p >= 'A' && *p <= 'Z' ? *p - 'A' + 'a' : *p;
+        buf_append(key, &c, 1);
+    }
+    while (key->len > start && strchr(".,!?;:", key->data[key->len - 1])) key->data[--key->len] = '\0';
+}
+
+static uint64_t cache_hash(const struct buf *key) {
+    uint64_t h = 14695981039346656037ULL;   // FNV-1a
+    for (size_t i = 0; i < key->len; i++) {
+        h = (h ^ (unsigned char)key->data[i]) * 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+static int cache_find(const struct buf *key, uint64_t hash) {
+    for (uint32_t i = 0; i < cache.header->slots; i++) {
+        if (cache.index[i].hash == hash && cache.slot[i].key_len == key->len &&
+            memcmp(cache.slot[i].data, key->data, key->len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// The cached result for this dictation, counted as a hit or a miss
+static int cache_lookup(struct buf *out) {
+    if (cache_open() < 0) return -1;
+
+    struct buf key = {0};
+    cache_key(&key);
+    int i = cache_find(&key, cache_hash(&key));
+    buf_free(&key);
+    if (i < 0) {
+        cache.header->misses++;
+        return -1;
+    }
+    cache.header->hits++;
+    cache.index[i].used = ++cache.header->clock;
+    buf_append(out, cache.slot[i].data + cache.slot[i].key_len, cache.slot[i].value_len);
+    return 0;
+}
+
+static void cache_store(const char *value) {
+    if (!*value || cache_open() < 0) return;
+
+    struct buf key = {0};
+    cache_key(&key);
+    size_t value_len = strlen(value);
+    if (key.len + value_len > sizeof(cache.slot[0].data)) {
+        buf_free(&key);
+        return;
+    }
+
+    // The same key, else an empty slot, else the least recently used
+    uint64_t hash = cache_hash(&key);
+    int i = cache_find(&key, hash);
+    for (uint32_t j = 0; i < 0 && j < cache.header->slots; j++) {
+        if (!cache.index[j].hash) i = j;
+    }
+    if (i < 0) {
+        i = 0;
+        for (uint32_t j = 1; j < cache.header->slots; j++) {
+            if (cache.index[j].used < cache.index[i].used) i = j;
+        }
+    }
+    if (!cache.index[i].hash) cache.header->entries++;
+
+    struct cache_slot *slot = &cache.slot[i];
+    slot->key_len = key.len;
+    slot->value_len = value_len;
+    memcpy(slot->data, key.data, key.len);
+    memcpy(slot->data + key.len, value, value_len);
+    cache.index[i].hash = hash;
+    cache.index[i].used = ++cache.header->clock;
+    buf_free(&key);
+}
+
+// Stage timings
+
+static void set_span(enum span span, double ms) {
+    s.spans[span] = ms;
+    s.timed |= 1u << span;
+}
+
+// Add the pending dictation to the windows and SPANS_LOG; typed says
+// whether its typing finished (a new dictation may cut it short)
+static void spans_done(int typed) {
+    if (!pending.active) return;
+    pending.active = 0;
+
+    if (typed) {
+        pending.spans[SPAN_TYPING] = elapsed_s(&pending.typing) * 1000;
+        pending.spans[SPAN_TOTAL] = elapsed_s(&pending.stopped) * 1000;
+        pending.timed |= 1u << SPAN_TYPING | 1u << SPAN_TOTAL;
+    }
+    dictations++;
+
+    // Config values and the mode are the user's strings: escaped
+    static const char *const keys[] = {"model", "device", "post_process_model", "mode", "profile"};
+    const char *values[] = {cfg.model_name, cfg.model_device, cfg.post_process_model, pending.mode,
+                            cfg.typing_profile};
+    struct buf line = {0};
+    char num[128];
+    snprintf(num, sizeof(num), "{\"time\": %ld", (long)time(NULL));
+    buf_str(&line, num);
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        buf_str(&line, ", \"");
+        buf_str(&line, keys[i]);
+        buf_str(&line, "\": ");
+        json_string(&line, values[i]);
+    }
+    snprintf(num, sizeof(num), ", \"live\": %s, \"outcome\": \"%s\", \"audio_s\": %.2f, \"spans_ms\": {",
+             pending.live ? "true" : "false", pending.outcome ? pending.outcome : "typed", pending.audio_s);
+    buf_str(&line, num);
+    const char *sep = "";
+    for (int i = 0; i < NUM_SPANS; i++) {
+        if (!(pending.timed & (1u << i))) continue;
+        window_add(&span_windows[i], pending.spans[i]);
+        snprintf(num, sizeof(num), "%s\"%s\": %.1f", sep, span_names[i], pending.spans[i]);
+        buf_str(&line, num);
+        sep = ", ";
+    }
+    buf_str(&line, "}}\n");
+
+    FILE *f = fopen(SPANS_LOG, "a");
+    if (f) {
+        fwrite(line.data, 1, line.len, f);
+        fclose(f);
+    }
+    buf_free(&line);
+}
+
+// "stats": rolling p50/p95/p99 per stage, as text or JSON
+static void format_stats(struct buf *out, int json) {
+    char line[160];
+    snprintf(line, sizeof(line), json ? "{\"dictations\": %lu, \"spans_ms\": {" :
+                                        "%lu dictations, last %d (ms)\n", dictations, STATS_WINDOW);
+    buf_str(out, line);
+    const char *sep = "";
+    for (int i = 0; i < NUM_SPANS; i++) {
+        double p[3];
+        if (!span_windows[i].n) continue;
+        window_percentiles(&span_windows[i], p);
+        snprintf(line, sizeof(line),
+                 json ? "%s\"%s\": {\"count\": %zu, \"p50\": %.1f, \"p95\": %.1f, \"p99\": %.1f}"
+                      : "%s%-13s n %4zu  p50 %9.1f  p95 %9.1f  p99 %9.1f\n",
+                 json ? sep : "", span_names[i], span_windows[i].n, p[0], p[1], p[2]);
+        buf_str(out, line);
+        sep = ", ";
+    }
+    if (json) buf_str(out, "}");
+
+    if (cfg.post_process_model[0] && cache_open() == 0) {
+        const struct cache_header *h = cache.header;
+        snprintf(line, sizeof(line),
+                 json ? ", \"post_process_cache\": {\"hits\": %lu, \"misses\": %lu, \"entries\": %u, \"slots\": %u}"
+                      : "post-process cache: %lu hits, %lu misses, %u of %u entries\n",
+                 (unsigned long)h->hits, (unsigned long)h->misses, h->entries, h->slots);
+        buf_str(out, line);
+    }
+    if (json) buf_str(out, "}");
+}
+
+// Configuration
+
+static void config_defaults(struct config *c) {
+    *c = (struct config){
+        .model_name = "base",
+        .model_device = "auto",
+        .silence_threshold = -50,
+        .silence_percentage = 95,
+        .non_ascii_initial_delay = 0.1,
+        .non_ascii_default_delay = 0.025,
+        .typing_profile = "safe",
+        .unicode_method = "clipboard",
+        .keyboard_layout = "us",
+        .live_transcription = 0,
+        .trim_silence = 1,
+        .post_process_timeout = 10,
+        .post_process_mode = "auto",
+        .post_process_cache = 1000,
+    };
+}
+
+static char *trim(char *str) {
+    while (*str == ' ' || *str == '\t') str++;
+    size_t len = strlen(str);
+    while (len > 0 && strchr(" \t\r\n", str[len - 1])) str[--len] = '\0';
+    return str;
+}
+
+#define SET_STR(field) snprintf(c->field, sizeof(c->field), "%s", value)
+
+// "key : value" lines, # comments; values may be quoted
+static void config_parse(struct config *c, FILE *f) {
+    char line[2048];
+
+    while (fgets(line, sizeof(line), f)) {
+        char *key = trim(line);
+        if (*key == '#' || *key == '\0') continue;
+        char *colon = strchr(key, ':');
+        if (!colon) continue;
+        *colon = '\0';
+        key = trim(key);
+        char *value = trim(colon + 1);
+        size_t len = strlen(value);
+        if (len > 0 && value[len - 1] == '"') value[--len] = '\0';
+        if (*value == '"') value++;
+
+        if (strcmp(key, "model-name") == 0) SET_STR(model_name);
+        else if (strcmp(key, "model-device") == 0) SET_STR(model_device);
+        else if (strcmp(key, "model-language") == 0) SET_STR(model_language);
+        else if (strcmp(key, "transcription-prompt") == 0) SET_STR(transcription_prompt);
+        else if (strcmp(key, "silence-threshold") == 0) c->silence_threshold = atof(value);
+        else if (strcmp(key, "silence-percentage") == 0) c->silence_percentage = atof(value);
+        else if (strcmp(key, "non-ascii-initial-delay") == 0) c->non_ascii_initial_delay = atof(value);
+        else if (strcmp(key, "non-ascii-default-delay") == 0) c->non_ascii_default_delay = atof(value);
+        else if (strcmp(key, "typing-profile") == 0) SET_STR(typing_profile);
+        else if (strcmp(key, "unicode-method") == 0) SET_STR(unicode_method);
+        else if (strcmp(key, "keyboard-layout") == 0) SET_STR(keyboard_layout);
+        else if (strcmp(key, "live-transcription") == 0) c->live_transcription = strcmp(value, "on") == 0;
+        else if (strcmp(key, "trim-silence") == 0) c->trim_silence = strcmp(value, "on") == 0;
+        else if (strcmp(key, "post-process-model") == 0) SET_STR(post_process_model);
+        else if (strcmp(key, "post-process-timeout") == 0) c->post_process_timeout = atof(value);
+        else if (strcmp(key, "post-process-mode") == 0) SET_STR(post_process_mode);
+        else if (strcmp(key, "post-process-url") == 0) SET_STR(post_process_url);
+        else if (strcmp(key, "post-process-cache") == 0) c->post_process_cache = atoi(value);
+        else if (strcmp(key, "hotkey") == 0) SET_STR(hotkey);
+        else if (strcmp(key, "hotkey-device") == 0) SET_STR(hotkey_device);
+    }
+}
+
+// Find an executable in $PATH
+static int find_in_path(const char *name, char *out, size_t size) {
+    const char *path = getenv("PATH");
+    if (!path) path = "/usr/local/bin:/usr/bin:/bin";
+
+    while (*path) {
+        size_t len = strcspn(path, ":");
+        snprintf(out, size, "%.*s/%s", (int)len, path, name);
+        if (len > 0 && access(out, X_OK) == 0) return 0;
+        path += len + (path[len] == ':');
+    }
+    return -1;
+}
+
+static int tool_send(char cmd, const char *payload, size_t len);
+
+// Reparse xhisperrc if it changed since the last toggle; returns 1 if it did
+static int config_reload(void) {
+    struct stat st;
+    int exists = stat(cfg_path, &st) == 0;
+
+    if (cfg_size >= 0 && exists && st.st_size == cfg_size &&
+        st.st_mtim.tv_sec == cfg_mtime.tv_sec && st.st_mtim.tv_nsec == cfg_mtime.tv_nsec) {
+        return 0;
+    }
+    if (cfg_size == -2 && !exists) return 0;
+
+    config_defaults(&cfg);
+    FILE *f = exists ? fopen(cfg_path, "r") : NULL;
+    if (f) {
+        config_parse(&cfg, f);
+        fclose(f);
+        cfg_mtime = st.st_mtim;
+        cfg_size = st.st_size;
+    } else {
+        cfg_size = -2;  // defaults until the file appears
+    }
+
+    layout = &keymaps[0];
+    for (size_t i = 0; i < NUM_KEYMAPS; i++) {
+        if (strcmp(keymaps[i].name, cfg.keyboard_layout) == 0) layout = &keymaps[i];
+    }
+    if (strcmp(layout->name, cfg.keyboard_layout) != 0) {
+        fprintf(stderr, "xhisper: unknown keyboard layout '%s', using us\n", cfg.keyboard_layout);
+    }
+
+    char found[PATH_MAX];
+    clip_tool = NULL;
+    if (find_in_path("wl-copy", found, sizeof(found)) == 0) {
+        clip_tool = "wl-copy";
+    } else if (find_in_path("xclip", found, sizeof(found)) == 0) {
+        clip_tool = "xclip";
+    } else if (strcmp(cfg.unicode_method, "clipboard") == 0) {
+        fprintf(stderr, "xhisper: no clipboard tool found, install wl-clipboard or xclip\n");
+    }
+
+    fprintf(stderr, "xhisper: loaded %s\n", cfg_path);
+    return 1;
+}
+
+// Transcript matching: one Aho-Corasick automaton over the lowercased text
+// finds auto mode's command indicators and the spoken forms from the
+// replacements file in a single pass. Command indicators match with the
+// case they had as regexes; replacements match whole words in any case.
+
+// Words that make auto mode treat the text as a command: a first word...
+static const char *const command_starts[] = {
+    "sudo", "apt", "git", "npm", "pip", "systemctl", "docker", "cd", "ls", "mkdir", "rm", "cp", "mv",
+    "grep", "find", "cat", "tail", "head", "ssh", "curl", "wget", "make", "cargo", "python", "node",
+    "code", "vim", "nano", "man", "chmod", "chown", "ln", "tar", "zip", "unzip", "mount", "umount",
+    "ps", "kill", "top", "htop", "df", "du", "free", "uname", "export", "alias", "source", "exit",
+    "pseudo",
+};
+
+// ...or a subcommand after it
+static const char *const command_words[] = {
+    "install", "update", "upgrade", "remove", "purge", "status", "start", "stop", "restart",
+    "enable", "disable", "clone", "pull", "push", "commit", "add", "log", "diff", "checkout",
+    "branch", "merge", "rebase", "init",
+};
+
+#define MATCHER_MAX_NODES 65535
+
+enum pattern_kind {
+    PAT_START,      // "<word> " at the start of the text
+    PAT_WORD,       // " <word>" before a space or the end of the text
+    PAT_REPLACE,
+};
+
+struct pattern {
+    enum pattern_kind kind;
+    int anchored;           // replacement only at the start of the text
+    char *from;             // lowercase
+    size_t len;
+    char *to;
+};
+
+// A state of the automaton; next is complete, so scanning a byte is one
+// lookup
+struct ac_node {
+    uint16_t next[256];
+    int out;                // pattern ending here, -1: none
+    int link;               // longest proper suffix state with an output, 0: none
+};
+
+static struct {
+    struct ac_node *node;
+    size_t nodes;
+    struct pattern *pat;
+    size_t pats;
+    char path[PATH_MAX];
+    struct timespec mtime;  // of the replacements file as loaded
+    off_t size;             // -1: never loaded, -2: no file
+} matcher = {.size = -1};
+
+static char lower(char c) {
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static int is_word_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static void matcher_add(enum pattern_kind kind, const char *from, size_t len, const char *to, int anchored) {
+    // Room for the worst case: one new state per byte
+    if (!len || matcher.nodes + len > MATCHER_MAX_NODES) {
+        if (len) fprintf(stderr, "xhisper: too many replacements, ignoring \"%.*s\"\n", (int)len, from);
+        return;
+    }
+    matcher.node = realloc(matcher.node, (matcher.nodes + len) * sizeof(struct ac_node));
+    matcher.pat = realloc(matcher.pat, (matcher.pats + 1) * sizeof(struct pattern));
+
+    size_t v = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = lower(from[i]);
+        if (!matcher.node[v].next[c]) {
+            memset(&matcher.node[matcher.nodes], 0, sizeof(struct ac_node));
+            matcher.node[matcher.nodes].out = -1;
+            matcher.node[v].next[c] = matcher.nodes++;
+        }
+        v = matcher.node[v].next[c];
+    }
+
+    struct pattern *p = &matcher.pat[matcher.pats];
+    *p = (struct pattern){.kind = kind, .anchored = anchored, .from = strndup(from, len), .len = len,
+                          .to = to ? strdup(to) : NULL};
+    for (size_t i = 0; i < len; i++) p->from[i] = lower(p->from[i]);
+    // A later line for the same words wins
+    matcher.node[v].out = matcher.pats++;
+}
+
+// Failure links, folded into next so the automaton never backtracks
+static void matcher_build(void) {
+    size_t *queue = malloc(matcher.nodes * sizeof(size_t));
+    int *fail = calloc(matcher.nodes, sizeof(int));
+    size_t head = 0, tail = 0;
+
+    for (int c = 0; c < 256; c++) {
+        if (matcher.node[0].next[c]) queue[tail++] = matcher.node[0].next[c];
+    }
+    while (head < tail) {
+        size_t v = queue[head++];
+        for (int c = 0; c < 256; c++) {
+            size_t u = matcher.node[v].next[c];
+            if (!u) {
+                matcher.node[v].next[c] = matcher.node[fail[v]].next[c];
+                continue;
+            }
+            fail[u] = matcher.node[fail[v]].next[c];
+            matcher.node[u].link = matcher.node[fail[u]].out >= 0 ? fail[u] : matcher.node[fail[u]].link;
+            queue[tail++] = u;
+        }
+    }
+    free(queue);
+    free(fail);
+}
+
+static void matcher_free(void) {
+    for (size_t i = 0; i < matcher.pats; i++) {
+        free(matcher.pat[i].from);
+        free(matcher.pat[i].to);
+    }
+    free(matcher.pat);
+    free(matcher.node);
+    matcher.pat = NULL;
+    matcher.node = NULL;
+    matcher.pats = matcher.nodes = 0;
+}
+
+// "<spoken> : <typed>" per line of the replacements file next to xhisperrc;
+// a leading ^ matches only at the start of the text. Rebuilt when the file
+// changes.
+static void replacements_reload(void) {
+    struct stat st;
+    int exists = stat(matcher.path, &st) == 0;
+    if (matcher.size >= 0 && exists && st.st_size == matcher.size &&
+        st.st_mtim.tv_sec == matcher.mtime.tv_sec && st.st_mtim.tv_nsec == matcher.mtime.tv_nsec) {
+        return;
+    }
+    if (matcher.size == -2 && !exists) return;
+
+    matcher_free();
+    matcher.node = calloc(1, sizeof(struct ac_node));
+    matcher.node[0].out = -1;
+    matcher.nodes = 1;
+    char word[32];
+    for (size_t i = 0; i < sizeof(command_starts) / sizeof(command_starts[0]); i++) {
+        int len = snprintf(word, sizeof(word), "%s ", command_starts[i]);
+        matcher_add(PAT_START, word, len, NULL, 0);
+    }
+    for (size_t i = 0; i < sizeof(command_words) / sizeof(command_words[0]); i++) {
+        int len = snprintf(word, sizeof(word), " %s", command_words[i]);
+        matcher_add(PAT_WORD, word, len, NULL, 0);
+    }
+
+    size_t loaded = 0;
+    FILE *f = exists ? fopen(matcher.path, "r") : NULL;
+    if (f) {
+        char line[1024];
+        while (fgets(line, sizeof(line), f)) {
+            line[strcspn(line, "\r\n")] = '\0';
+            char *colon = strchr(line, ':');
+            if (line[0] == '#' || !colon) continue;
+            *colon = '\0';
+            char *from = trim(line), *to = trim(colon + 1);
+            size_t len = strlen(to);
+            if (len > 1 && to[0] == '"' && to[len - 1] == '"') {
+                to[len - 1] = '\0';
+                to++;
+            }
+            int anchored = *from == '^';
+            if (anchored) from = trim(from + 1);
+            if (!*from) continue;
+            matcher_add(PAT_REPLACE, from, strlen(from), to, anchored);
+            loaded++;
+        }
+        fclose(f);
+        matcher.mtime = st.st_mtim;
+        matcher.size = st.st_size;
+        fprintf(stderr, "xhisper: loaded %zu replacements from %s\n", loaded, matcher.path);
+    } else {
+        matcher.size = -2;  // built-in patterns until the file appears
+    }
+    matcher_build();
+}
+
+// Rewrite text with the replacements, leftmost-longest; *command says
+// whether auto mode should treat it as a command (judged on the text as
+// dictated), *whole whether one replacement covered all of it, in which
+// case out holds just that replacement
+static void scan_transcript(const char *text, struct buf *out, int *command, int *whole) {
+    size_t len = strlen(text);
+    int *best = calloc(len + 1, sizeof(int));   // longest replacement starting here, +1
+    size_t v = 0;
+
+    *command = 0;
+    for (size_t i = 0; i < len; i++) {
+        v = matcher.node[v].next[(unsigned char)lower(text[i])];
+        for (size_t u = matcher.node[v].out >= 0 ? v : (size_t)matcher.node[v].link; u;
+             u = matcher.node[u].link) {
+            int id = matcher.node[u].out;
+            const struct pattern *p = &matcher.pat[id];
+            size_t start = i + 1 - p->len, end = i + 1;
+
+            if (p->kind == PAT_START) {
+                *command |= start == 0 && memcmp(text, p->from, p->len) == 0;
+            } else if (p->kind == PAT_WORD) {
+                *command |= memcmp(text + start, p->from, p->len) == 0 && (text[end] == ' ' || !text[end]);
+            } else if ((start == 0 || !is_word_char(text[start - 1])) && !is_word_char(text[end]) &&
+                       (!p->anchored || start == strspn(text, " ")) &&
+                       (!best[start] || matcher.pat[best[start] - 1].len < p->len)) {
+                best[start] = id + 1;
+            }
+        }
+    }
+
+    // One replacement for all of it, give or take closing punctuation
+    size_t lead = strspn(text, " "), tail = len;
+    while (tail > lead && strchr(" .,!?", text[tail - 1])) tail--;
+    *whole = best[lead] && lead + matcher.pat[best[lead] - 1].len == tail;
+    if (*whole) {
+        buf_str(out, matcher.pat[best[lead] - 1].to);
+    } else {
+        for (size_t i = 0; i < len;) {
+            if (best[i]) {
+                const struct pattern *p = &matcher.pat[best[i] - 1];
+                buf_str(out, p->to);
+                i += p->len;
+                // A dropped word takes a space with it
+                if (!*p->to && text[i] == ' ') i++;
+                else if (!*p->to && out->len && out->data[out->len - 1] == ' ') out->data[--out->len] = '\0';
+            } else {
+                buf_append(out, &text[i++], 1);
+            }
+        }
+    }
+    buf_append(out, "", 0);
+    free(best);
+}
+
+// Child processes
+
+static pid_t spawn(const char *const argv[], int fd_in, int fd_out, const char *errlog) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("failed to fork");
+        return -1;
+    }
+    if (pid > 0) return pid;
+
+    // The controller blocks SIGCHLD for its signalfd; don't pass that on
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    signal(SIGPIPE, SIG_DFL);
+    setsid();
+
+    int null = open("/dev/null", O_RDWR);
+    int err = errlog ? open(errlog, O_WRONLY | O_CREAT | O_APPEND, 0644) : -1;
+    dup2(fd_in >= 0 ? fd_in : null, STDIN_FILENO);
+    dup2(fd_out >= 0 ? fd_out : null, STDOUT_FILENO);
+    dup2(err >= 0 ? err : null, STDERR_FILENO);
+
+    execvp(argv[0], (char *const *)argv);
+    fprintf(stderr, "xhisper: failed to run %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+}
+
+// Run a short helper to completion, feeding it input and/or capturing its
+// output; returns its exit status, -1 if it could not run
+static int run_helper(const char *const argv[], const char *input, size_t len, struct buf *out) {
+    int in[2] = {-1, -1}, outp[2] = {-1, -1};
+    if ((input && pipe2(in, O_CLOEXEC) < 0) || (out && pipe2(outp, O_CLOEXEC) < 0)) {
+        perror("failed to create pipe");
+        return -1;
+    }
+
+    pid_t pid = spawn(argv, in[0], outp[1], NULL);
+    if (in[0] >= 0) close(in[0]);
+    if (outp[1] >= 0) close(outp[1]);
+
+    if (input) {
+        if (pid > 0 && write(in[1], input, len) != (ssize_t)len) {
+            fprintf(stderr, "xhisper: short write to %s\n", argv[0]);
+        }
+        close(in[1]);
+    }
+    if (out) {
+        char chunk[4096];
+        ssize_t n;
+        while ((n = read(outp[0], chunk, sizeof(chunk))) > 0 || (n < 0 && errno == EINTR)) {
+            if (n > 0) buf_append(out, chunk, n);
+        }
+        close(outp[0]);
+    }
+
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Connect to an abstract socket; padded names fill sun_path like bind_socket
+static int connect_abstract(const char *name, int type, int padded) {
+    int fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path + 1, name, sizeof(addr.sun_path) - 2);
+    socklen_t len = padded ? sizeof(addr)
+                           : offsetof(struct sockaddr_un, sun_path) + 1 + strlen(name);
+    if (connect(fd, (struct sockaddr *)&addr, len) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Retry a connection while the process behind it starts
+static int connect_wait(const char *name, int type, int padded, int wait_ms) {
+    for (int waited = 0;; waited += 10) {
+        int fd = connect_abstract(name, type, padded);
+        if (fd >= 0 || waited >= wait_ms) return fd;
+        sleep_s(0.01);
+    }
+}
+
+// Typing via xhispertoold
+
+// Read the daemon's --notify-fd until READY=1; 0 if it exited or timed out.
+// Its STATUS= line (startup timings) goes to status.
+static int wait_ready(int fd, int wait_ms, char *status, size_t size) {
+    char msg[256];
+    size_t len = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    *status = '\0';
+    while (len < sizeof(msg) - 1) {
+        int remaining = wait_ms - (int)(elapsed_s(&start) * 1000);
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (remaining <= 0 || poll(&pfd, 1, remaining) <= 0) return 0;
+        ssize_t n = read(fd, msg + len, sizeof(msg) - 1 - len);
+        if (n <= 0) return 0;
+        len += n;
+        msg[len] = '\0';
+        if (strstr(msg, "READY=1\n")) {
+            const char *line = strstr(msg, "STATUS=");
+            if (line) snprintf(status, size, "%.*s", (int)strcspn(line + 7, "\n"), line + 7);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int tool_connect(void) {
+    fd_tool = connect_abstract(SEQ_SOCKET_NAME, SOCK_SEQPACKET, 1);
+    if (fd_tool < 0) {
+        char profile[64], unicode[64], kbd[64];
+        snprintf(profile, sizeof(profile), "--profile=%s", cfg.typing_profile);
+        snprintf(unicode, sizeof(unicode), "--unicode=%s", cfg.unicode_method);
+        snprintf(kbd, sizeof(kbd), "--layout=%s", cfg.keyboard_layout);
+        const char *argv[4 + 12 + 2] = {daemon_path, profile, unicode, kbd};
+        int argc = 4;
+
+        // One --hotkey= / --hotkey-device= per comma-separated entry
+        char hotkeys[sizeof(cfg.hotkey)], devices[sizeof(cfg.hotkey_device)];
+        char args[12][sizeof(cfg.hotkey) + 16];
+        int nargs = 0;
+        snprintf(hotkeys, sizeof(hotkeys), "%s", cfg.hotkey);
+        snprintf(devices, sizeof(devices), "%s", cfg.hotkey_device);
+        struct { char *list; const char *flag; } opts[] = {
+            {hotkeys, "--hotkey="}, {devices, "--hotkey-device="},
+        };
+        for (size_t i = 0; i < 2; i++) {
+            char *save = NULL;
+            for (char *tok = strtok_r(opts[i].list, ",", &save); tok && nargs < 12;
+                 tok = strtok_r(NULL, ",", &save)) {
+                tok = trim(tok);
+                if (*tok == '\0') continue;
+                snprintf(args[nargs], sizeof(args[nargs]), "%s%s", opts[i].flag, tok);
+                argv[argc++] = args[nargs++];
+            }
+        }
+
+        // It reports on a pipe once it can type; spawn() passes on fds
+        // without FD_CLOEXEC
+        int notify[2];
+        if (pipe2(notify, O_CLOEXEC) < 0) {
+            perror("failed to create pipe");
+            return -1;
+        }
+        int fd_ready = fcntl(notify[1], F_DUPFD, 3);
+        close(notify[1]);
+        char notify_arg[32], status[128] = "";
+        snprintf(notify_arg, sizeof(notify_arg), "--notify-fd=%d", fd_ready);
+        argv[argc++] = notify_arg;
+        argv[argc] = NULL;
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pid_t pid = fd_ready >= 0 ? spawn(argv, -1, -1, DAEMON_LOG) : -1;
+        if (fd_ready >= 0) close(fd_ready);
+        int ready = pid > 0 && wait_ready(notify[0], DAEMON_START_MS, status, sizeof(status));
+        close(notify[0]);
+
+        // Ours may have lost the socket to a concurrent start; either is fine
+        fd_tool = connect_abstract(SEQ_SOCKET_NAME, SOCK_SEQPACKET, 1);
+        if (fd_tool < 0) {
+            fprintf(stderr, "xhisper: failed to start xhispertoold, see %s\n", DAEMON_LOG);
+            return -1;
+        }
+        if (ready) fprintf(stderr, "xhisper: started xhispertoold in %.1f ms (%s)\n", elapsed_s(&start) * 1000, status);
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd_tool};
+    epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_tool, &ev);
+
+    // The daemon may predate a config change
+    tool_send('P', cfg.typing_profile, strlen(cfg.typing_profile));
+    tool_send('U', cfg.unicode_method, strlen(cfg.unicode_method));
+    tool_send('K', layout->name, strlen(layout->name));
+    return 0;
+}
+
+static void tool_disconnect(void) {
+    if (fd_tool < 0) return;
+    epoll_ctl(fd_epoll, EPOLL_CTL_DEL, fd_tool, NULL);
+    close(fd_tool);
+    fd_tool = -1;
+}
+
+// Send one framed command; acks are drained by the event loop. Returns its
+// id, 0 on failure.
+static uint32_t tool_frame(char cmd, const char *payload, size_t len) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (fd_tool < 0 && tool_connect() < 0) return 0;
+
+        struct frame_header hdr = {
+            .version = PROTO_VERSION,
+            .cmd = cmd,
+            .id = next_id++,
+        };
+        struct iovec iov[2] = {
+            {.iov_base = &hdr, .iov_len = sizeof(hdr)},
+            {.iov_base = (void *)payload, .iov_len = len},
+        };
+        struct msghdr mh = {.msg_iov = iov, .msg_iovlen = 2};
+        if (sendmsg(fd_tool, &mh, MSG_NOSIGNAL) >= 0) return hdr.id;
+
+        // Daemon restarted since the last toggle: reconnect once
+        tool_disconnect();
+    }
+    fprintf(stderr, "xhisper: lost connection to xhispertoold\n");
+    return 0;
+}
+
+static int tool_send(char cmd, const char *payload, size_t len) {
+    return tool_frame(cmd, payload, len) ? 0 : -1;
+}
+
+// Log failed commands from the acks that have arrived; returns the status
+// of the ack for `id` once it is seen, -1 before
+static int tool_acks(uint32_t id, int flags) {
+    char buf[sizeof(struct frame_header) + 256];
+    struct frame_header hdr;
+
+    while (fd_tool >= 0) {
+        ssize_t n = recv(fd_tool, buf, sizeof(buf) - 1, flags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return -1;
+        if (n < (ssize_t)sizeof(hdr)) {
+            tool_disconnect();
+            return XH_EIO;
+        }
+        memcpy(&hdr, buf, sizeof(hdr));
+        buf[n] = '\0';
+        if (hdr.status != XH_OK && hdr.status != XH_EABORTED) {
+            fprintf(stderr, "xhisper: request %u failed: %s\n", (unsigned)hdr.id, buf + sizeof(hdr));
+        }
+        if (typing_id && hdr.id == typing_id) {
+            typing_id = 0;
+            spans_done(1);
+            if (state == ST_TYPING) set_state(ST_IDLE);
+        }
+        if (id && hdr.id == id) return hdr.status;
+    }
+    return XH_EIO;
+}
+
+// Wait until everything sent so far has been typed
+static void tool_sync(void) {
+    uint32_t id = tool_frame('W', NULL, 0);
+    if (id) tool_acks(id, 0);
+}
+
+// Text as 's' commands, never splitting a UTF-8 sequence
+static void tool_string(const char *str, size_t len) {
+    while (len > 0) {
+        size_t chunk = len;
+        if (chunk > MAX_MSG - 1) {
+            chunk = MAX_MSG - 1;
+            while (chunk > 0 && ((unsigned char)str[chunk] & 0xc0) == 0x80) chunk--;
+            if (chunk == 0) chunk = MAX_MSG - 1;
+        }
+        if (tool_send('s', str, chunk) < 0) return;
+        str += chunk;
+        len -= chunk;
+    }
+}
+
+static void delete_chars(int count) {
+    char digits[16];
+    tool_send('b', digits, snprintf(digits, sizeof(digits), "%d", count));
+}
+
+static void press_wrap_key(void) {
+    if (s.wrap) tool_send(s.wrap, NULL, 0);
+}
+
+static int cmp_cp(const void *key, const void *entry) {
+    uint32_t cp = *(const uint32_t *)key;
+    uint32_t other = ((const struct keymap_entry *)entry)->cp;
+    return cp < other ? -1 : cp > other;
+}
+
+static int layout_types(uint32_t cp) {
+    return bsearch(&cp, layout->extra, layout->n_extra, sizeof(layout->extra[0]), cmp_cp) != NULL;
+}
+
+static size_t utf8_char(const unsigned char *p, size_t len, uint32_t *cp) {
+    size_t need = *p >= 0xf0 ? 4 : *p >= 0xe0 ? 3 : *p >= 0xc0 ? 2 : 1;
+    if (need > len) need = len;
+    *cp = need == 1 ? *p : *p & (0x3f >> (need - 1));
+    for (size_t i = 1; i < need; i++) *cp = (*cp << 6) | (p[i] & 0x3f);
+    return need;
+}
+
+// Characters, as backspaces count them
+static long utf8_count(const char *text, size_t len) {
+    long n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (((unsigned char)text[i] & 0xC0) != 0x80) n++;
+    }
+    return n;
+}
+
+struct clipboard {
+    struct buf saved;
+    char type[128];         // the type saved is restored as
+    int had;
+    int pasted;
+};
+
+// Command line of the clipboard tool to copy ('c') or paste ('p') the given
+// type (NULL: the tool's default), or to list the types offered ('t')
+static void clip_command(const char *argv[8], char op, const char *type) {
+    int n = 0;
+    if (strcmp(clip_tool, "wl-copy") == 0) {
+        argv[n++] = op == 'c' ? "wl-copy" : "wl-paste";
+        if (op == 'p') argv[n++] = "--no-newline";
+        if (op == 't') argv[n++] = "--list-types";
+    } else {
+        argv[n++] = "xclip";
+        if (op != 'c') argv[n++] = "-o";
+        argv[n++] = "-selection";
+        argv[n++] = "clipboard";
+        if (op == 't') type = "TARGETS";
+    }
+    if (type) {
+        argv[n++] = strcmp(clip_tool, "wl-copy") == 0 ? "--type" : "-t";
+        argv[n++] = type;
+    }
+    argv[n] = NULL;
+}
+
+// Save the clipboard's bytes and type: text when text is offered, so the
+// restore pastes anywhere, else the first type offered (an image, say)
+static int clipboard_save(struct clipboard *c) {
+    static const char *const text_types[] = {
+        "UTF8_STRING", "text/plain;charset=utf-8", "text/plain", "STRING",
+    };
+    static const char *const meta_types[] = {"TARGETS", "TIMESTAMP", "MULTIPLE", "SAVE_TARGETS"};
+    const size_t n_text = sizeof(text_types) / sizeof(text_types[0]);
+    const char *argv[8];
+    struct buf types = {0};
+
+    clip_command(argv, 't', NULL);
+    if (run_helper(argv, NULL, 0, &types) != 0 || !types.len) {
+        buf_free(&types);
+        return 0;
+    }
+    size_t best = n_text + 1;
+    for (char *line = strtok(types.data, "\n"); line; line = strtok(NULL, "\n")) {
+        line = trim(line);
+        size_t rank = n_text;
+        for (size_t i = 0; i < sizeof(meta_types) / sizeof(meta_types[0]); i++) {
+            if (strcmp(line, meta_types[i]) == 0) rank = n_text + 1;
+        }
+        for (size_t i = 0; i < n_text; i++) {
+            if (strcmp(line, text_types[i]) == 0) rank = i;
+        }
+        if (rank < best && strlen(line) < sizeof(c->type)) {
+            best = rank;
+            strcpy(c->type, line);
+        }
+    }
+    buf_free(&types);
+    if (best > n_text) return 0;
+
+    clip_command(argv, 'p', c->type);
+    return run_helper(argv, NULL, 0, &c->saved) == 0;
+}
+
+// Paste one run of characters via the clipboard
+static void paste_run(struct clipboard *c, const char *run, size_t len) {
+    if (!clip_tool) return;
+
+    // Save the user's clipboard before the first paste
+    if (!c->pasted) c->had = clipboard_save(c);
+
+    const char *argv[8];
+    clip_command(argv, 'c', NULL);
+    run_helper(argv, run, len, NULL);
+    tool_send('p', NULL, 0);
+    tool_sync();
+    // On first paste (more error-prone), sleep longer
+    sleep_s(c->pasted ? cfg.non_ascii_default_delay : cfg.non_ascii_initial_delay);
+    c->pasted = 1;
+}
+
+// Type text at the cursor: ASCII and characters the layout has a key for
+// are typed, other non-ASCII runs go through the clipboard
+static void type_text(const char *text) {
+    size_t len = strlen(text);
+
+    // The daemon types Unicode itself, no clipboard needed
+    if (strcmp(cfg.unicode_method, "clipboard") != 0) {
+        tool_string(text, len);
+        return;
+    }
+
+    struct clipboard clip = {0};
+    size_t run = 0, i = 0;
+    int direct = 1;
+    while (i < len) {
+        uint32_t cp;
+        size_t n = utf8_char((const unsigned char *)text + i, len - i, &cp);
+        int typed = cp < 128 || layout_types(cp);
+        if (typed != direct && i > run) {
+            if (direct) tool_string(text + run, i - run);
+            else paste_run(&clip, text + run, i - run);
+            run = i;
+        }
+        direct = typed;
+        i += n;
+    }
+    if (i > run) {
+        if (direct) tool_string(text + run, i - run);
+        else paste_run(&clip, text + run, i - run);
+    }
+
+    if (clip.had) {
+        const char *argv[8];
+        clip_command(argv, 'c', clip.type);
+        run_helper(argv, clip.saved.data, clip.saved.len, NULL);
+    }
+    buf_free(&clip.saved);
+}
+
+// Type text between presses of the session's wrap key
+static void paste(const char *text) {
+    press_wrap_key();
+    type_text(text);
+    press_wrap_key();
+}
+
+// Transcription server
+
+static int server_connect(int wait_ms) {
+    int fd = connect_abstract(TRANSCRIBE_SOCKET_NAME, SOCK_STREAM, 0);
+    if (fd >= 0 || wait_ms == 0) return fd;
+
+    const char *argv[] = {"python3", script_path, "--server", "--model", cfg.model_name,
+                          "--device", cfg.model_device, NULL};
+    if (spawn(argv, -1, -1, TRANSCRIBE_LOG) < 0) return -1;
+    return connect_wait(TRANSCRIBE_SOCKET_NAME, SOCK_STREAM, 0, wait_ms);
+}
+
+static void model_fields(struct buf *req) {
+    buf_str(req, "\"model\": ");
+    json_string(req, cfg.model_name);
+    buf_str(req, ", \"device\": ");
+    json_string(req, cfg.model_device);
+    buf_str(req, ", \"language\": ");
+    json_string(req, cfg.model_language);
+    buf_str(req, ", \"prompt\": ");
+    json_string(req, cfg.transcription_prompt);
+}
+
+// Send a request line, with an fd attached if fd_pass >= 0; the reply is
+// read by the event loop
+static int server_request(const struct buf *req, int fd_pass) {
+    int fd = server_connect(SERVER_START_MS);
+    if (fd < 0) {
+        fprintf(stderr, "xhisper: transcription server is not running, see %s\n", TRANSCRIBE_LOG);
+        return -1;
+    }
+
+    struct iovec iov = {.iov_base = req->data, .iov_len = req->len};
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1};
+    if (fd_pass >= 0) {
+        mh.msg_control = control.buf;
+        mh.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd_pass, sizeof(int));
+    }
+    if (sendmsg(fd, &mh, MSG_NOSIGNAL) != (ssize_t)req->len) {
+        perror("failed to send transcription request");
+        close(fd);
+        return -1;
+    }
+
+    s.fd_reply = fd;
+    buf_free(&s.line);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+    epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd, &ev);
+    return 0;
+}
+
+static void server_close(void) {
+    if (s.fd_reply < 0) return;
+    epoll_ctl(fd_epoll, EPOLL_CTL_DEL, s.fd_reply, NULL);
+    close(s.fd_reply);
+    s.fd_reply = -1;
+}
+
+// Load a changed model while the user speaks; the reply is not needed
+static void server_preload(void) {
+    int fd = server_connect(0);
+    if (fd < 0) {
+        // Starting it loads the configured model anyway
+        const char *argv[] = {"python3", script_path, "--server", "--model", cfg.model_name,
+                              "--device", cfg.model_device, NULL};
+        spawn(argv, -1, -1, TRANSCRIBE_LOG);
+        return;
+    }
+
+    struct buf req = {0};
+    buf_str(&req, "{\"model\": ");
+    json_string(&req, cfg.model_name);
+    buf_str(&req, ", \"device\": ");
+    json_string(&req, cfg.model_device);
+    buf_str(&req, "}\n");
+    send(fd, req.data, req.len, MSG_NOSIGNAL);
+    buf_free(&req);
+    close(fd);
+}
+
+// State machine
+
+static void set_timer(enum timer_action action, int ms) {
+    struct itimerspec its = {
+        .it_value = {.tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000},
+    };
+    timer_action = ms > 0 ? action : TIMER_NONE;
+    timerfd_settime(fd_timer, 0, &its, NULL);
+}
+
+static void finish(void) {
+    // Stopped dictations are timed until their text is typed
+    spans_done(0);
+    if (s.stopped.tv_sec || s.stopped.tv_nsec) {
+        pending = (struct span_record){
+            .active = 1,
+            .timed = s.timed,
+            .audio_s = s.audio_s,
+            .outcome = s.outcome,
+            .live = s.live,
+            .stopped = s.stopped,
+        };
+        memcpy(pending.spans, s.spans, sizeof(s.spans));
+        snprintf(pending.mode, sizeof(pending.mode), "%s",
+                 s.post_mode[0] ? s.post_mode : s.mode[0] ? s.mode : cfg.post_process_mode);
+        clock_gettime(CLOCK_MONOTONIC, &pending.typing);
+    }
+
+    server_close();
+    buf_free(&s.line);
+    buf_free(&s.text);
+    buf_free(&s.shown);
+    buf_free(&s.formatted);
+    buf_free(&s.held);
+    unlink(RECORDING);
+    s = (struct session){.fd_reply = -1};
+    set_timer(TIMER_NONE, 0);
+
+    // Idle once the daemon has typed everything
+    typing_id = fd_tool >= 0 ? tool_frame('W', NULL, 0) : 0;
+    if (!typing_id) spans_done(1);
+    set_state(typing_id ? ST_TYPING : ST_IDLE);
+}
+
+static void show_no_sound(void) {
+    s.outcome = "no-sound";
+    paste("(no sound detected)");
+    tool_sync();  // Wait until it is actually on screen
+    set_state(ST_NOTICE);
+    set_timer(TIMER_NOTICE, NOTICE_MS);  // Time to read it
+}
+
+static void start_recording(void) {
+    clock_gettime(CLOCK_MONOTONIC, &s.started);
+    s.live = cfg.live_transcription;
+    set_state(ST_RECORDING);
+
+    if (s.live) {
+        // Phrases are transcribed as soon as a pause ends them
+        char threshold[32];
+        snprintf(threshold, sizeof(threshold), "%g", cfg.silence_threshold);
+        const char *argv[24] = {"python3", script_path, "--live", "--save", RECORDING,
+                                "--model", cfg.model_name, "--device", cfg.model_device,
+                                "--vad-threshold", threshold, "--silence-threshold", threshold};
+        int argc = 13;
+        if (cfg.model_language[0]) {
+            argv[argc++] = "--language";
+            argv[argc++] = cfg.model_language;
+        }
+        if (cfg.transcription_prompt[0]) {
+            argv[argc++] = "--prompt";
+            argv[argc++] = cfg.transcription_prompt;
+        }
+
+        // The live client needs the server; make sure it is on its way
+        server_preload();
+
+        int p[2];
+        if (pipe2(p, O_CLOEXEC) < 0) {
+            perror("failed to create pipe");
+            finish();
+            return;
+        }
+        const char *capture[] = {"pw-record", "--channels=1", "--rate=16000", "--format=s16", "-", NULL};
+        s.capture = spawn(capture, -1, p[1], NULL);
+        s.recorder = spawn(argv, p[0], -1, TRANSCRIBE_LOG);
+        close(p[0]);
+        close(p[1]);
+    } else {
+        server_preload();
+        // Captured in memory until the next toggle stops it
+        const char *argv[] = {tool_path, "record", NULL};
+        s.recorder = spawn(argv, -1, -1, LOGFILE);
+    }
+
+    if (s.recorder < 0) {
+        publish_error("recorder failed to start");
+        finish();
+        return;
+    }
+    set_timer(TIMER_PLACEHOLDER, PLACEHOLDER_DELAY_MS);
+}
+
+// Ask xhispertool record for the recording: its levels and a sealed memfd
+static int stop_recorder(char *levels, size_t size, int *memfd) {
+    int fd = connect_abstract(RECORD_SOCKET_NAME, SOCK_SEQPACKET, 1);
+    if (fd < 0) {
+        fprintf(stderr, "xhisper: no recording is running\n");
+        return -1;
+    }
+
+    char msg[128];
+    int len = snprintf(msg, sizeof(msg), "stop threshold=%g percentage=%g trim=%d",
+                       cfg.silence_threshold, cfg.silence_percentage, cfg.trim_silence);
+    struct timeval timeout = {.tv_sec = 10};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = {.iov_base = levels, .iov_len = size - 1};
+    struct msghdr mh = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    ssize_t n = -1;
+    if (send(fd, msg, len, MSG_NOSIGNAL) == len) n = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+    close(fd);
+
+    struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&mh) : NULL;
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS) {
+        fprintf(stderr, "xhisper: recorder sent no audio\n");
+        return -1;
+    }
+    memcpy(memfd, CMSG_DATA(cmsg), sizeof(int));
+    levels[n] = '\0';
+    return 0;
+}
+
+// Decode the live recording's saved WAV after the live path failed,
+// taking back what was typed of it
+static int transcribe_saved(void) {
+    if (s.segments) {
+        delete_chars(s.typed);
+        paste("(transcribing...)");
+        s.segments = 0;
+        s.typed = 0;
+    }
+    buf_free(&s.text);
+    buf_free(&s.shown);
+
+    struct buf req = {0};
+    buf_str(&req, "{\"audio\": \"" RECORDING "\", ");
+    model_fields(&req);
+    buf_str(&req, ", \"stream\": true}\n");
+    int ret = server_request(&req, -1);
+    buf_free(&req);
+    s.fallback = 1;
+    return ret;
+}
+
+static void stop_recording(void) {
+    // Toggled again before the placeholder went up
+    if (timer_action == TIMER_PLACEHOLDER) set_timer(TIMER_NONE, 0);
+    if (s.placeholder) delete_chars(14);  // "(recording...)"
+    clock_gettime(CLOCK_MONOTONIC, &s.stopped);
+    paste("(transcribing...)");
+    clock_gettime(CLOCK_MONOTONIC, &s.started);
+    set_state(s.live ? ST_TRANSCRIBING : ST_ANALYZING);
+
+    struct buf req = {0};
+    int ret;
+    if (s.live) {
+        // The live client flushes its last phrase on SIGTERM
+        if (s.recorder > 0) kill(s.recorder, SIGTERM);
+        if (s.capture > 0) kill(s.capture, SIGTERM);
+        buf_str(&req, "{\"collect\": true, \"stream\": true, \"timeout\": 300}\n");
+        ret = server_request(&req, -1);
+        set_span(SPAN_STOP, elapsed_s(&s.stopped) * 1000);
+        if (ret < 0) ret = transcribe_saved();
+    } else {
+        char levels[256];
+        int memfd;
+        ret = stop_recorder(levels, sizeof(levels), &memfd);
+        if (ret == 0) {
+            // The recorder reports how long its analysis took
+            const char *analysis = strstr(levels, "analysis_ms=");
+            double analysis_ms = analysis ? atof(analysis + 12) : 0;
+            set_span(SPAN_SILENCE, analysis_ms);
+            set_span(SPAN_STOP, elapsed_s(&s.stopped) * 1000 - analysis_ms);
+        }
+        if (ret == 0 && strstr(levels, "verdict=silent")) {
+            close(memfd);
+            buf_free(&req);
+            delete_chars(17);  // "(transcribing...)"
+            show_no_sound();
+            return;
+        }
+        if (ret == 0) {
+            set_state(ST_TRANSCRIBING);
+            buf_str(&req, "{\"memfd\": \"s16\", ");
+            model_fields(&req);
+            buf_str(&req, ", \"stream\": true}\n");
+            ret = server_request(&req, memfd);
+            close(memfd);
+        }
+    }
+    buf_free(&req);
+
+    if (ret < 0) {
+        publish_error("transcription failed");
+        delete_chars(17);  // "(transcribing...)"
+        finish();
+    }
+}
+
+// Post-processing with a local LLM over Ollama's HTTP API. One HTTP/1.1
+// connection is kept alive across dictations. Each mode's instructions go
+// in "system" and never change, so the server can reuse its cached prompt
+// prefix; only the dictated text differs between requests. The answer
+// streams back as NDJSON lines in a chunked body and is typed as it arrives.
+
+static const char *const post_process_prompts[][2] = {
+    {"command", "You are a Linux command expert. Fix this command transcription. Rules: 1) Correct command names (sudo, apt, git, npm, systemctl, docker, etc.) 2) Keep flags exactly as spoken 3) Keep file paths as spoken 4) Fix pipe syntax 5) Output ONLY the corrected command, no explanations."},
+    {"email", "Fix the grammar, punctuation, and capitalization of this email body text. Rules: 1) Use proper paragraph breaks (double line breaks between paragraphs) 2) Keep the tone natural and conversational 3) Do NOT add subject, salutation, or sign-off - user is typing in the body field 4) Output ONLY the formatted body text."},
+    {"standard", "Fix the grammar, punctuation, and capitalization of this text. Important: use apostrophes for contractions like don't, can't, I'm, you're, it's, etc. Keep text natural and conversational. Output ONLY the corrected text."},
+};
+
+enum llm_state {
+    LLM_IDLE,       // no request outstanding
+    LLM_CONNECTING, // request waits for the connection (EPOLLOUT)
+    LLM_HEADERS,    // waiting for the status line and headers
+    LLM_BODY,
+};
+
+enum llm_chunk {
+    CHUNK_SIZE,     // next line is a chunk size (or the CRLF ending a chunk)
+    CHUNK_DATA,
+    CHUNK_TRAILER,  // after the last chunk, until an empty line
+};
+
+static struct {
+    int fd;
+    enum llm_state state;
+    int requests;           // sent on this connection
+    int reused;             // the current request went over an older connection
+    int replied;            // any byte of the answer arrived
+    int status;
+    int keep;               // the server keeps the connection open
+    int chunked;
+    enum llm_chunk chunk;
+    long left;              // of the chunk or Content-Length body; -1: until close
+    char host[256];         // host[:port] for the Host header
+    char resolved[256];     // host the addresses are for
+    struct sockaddr_storage addrs[LLM_ADDRS_MAX];
+    socklen_t addr_lens[LLM_ADDRS_MAX];
+    int naddrs;
+    int next_addr;          // tried next if connecting fails
+    struct buf in;          // received, not parsed yet
+    struct buf line;        // partial NDJSON line
+    struct buf error;
+    struct buf request;     // kept to resend over a fresh connection
+} llm = {.fd = -1};
+
+static void on_token(const char *token);
+static void post_process_end(const char *error);
+
+static void llm_close(void) {
+    if (llm.fd >= 0) {
+        epoll_ctl(fd_epoll, EPOLL_CTL_DEL, llm.fd, NULL);
+        close(llm.fd);
+    }
+    llm.fd = -1;
+    llm.state = LLM_IDLE;
+    buf_free(&llm.in);
+    buf_free(&llm.line);
+}
+
+// post-process-url, $OLLAMA_HOST or the default, as http://host:port
+static int llm_set_host(void) {
+    const char *url = cfg.post_process_url[0] ? cfg.post_process_url : getenv("OLLAMA_HOST");
+    if (!url || !*url) url = LLM_DEFAULT_HOST;
+    if (strncmp(url, "http://", 7) == 0) {
+        url += 7;
+    } else if (strstr(url, "://")) {
+        fprintf(stderr, "xhisper: unsupported post-process-url %s (http:// only)\n", url);
+        return -1;
+    }
+    snprintf(llm.host, sizeof(llm.host), "%.*s", (int)strcspn(url, "/"), url);
+    return 0;
+}
+
+// getaddrinfo blocks, so only when the host changes or its addresses all
+// failed; an address or a name from /etc/hosts answers at once
+static int llm_resolve(void) {
+    if (llm.naddrs && strcmp(llm.resolved, llm.host) == 0) return 0;
+
+    // host, host:port, [v6] or [v6]:port
+    char host[256], port[16] = "11434";
+    snprintf(host, sizeof(host), "%s", llm.host);
+    char *colon = strrchr(host, ':');
+    if (colon && !strchr(colon, ']') && (host[0] == '[' || colon == strchr(host, ':'))) {
+        snprintf(port, sizeof(port), "%s", colon + 1);
+        *colon = '\0';
+    }
+    if (host[0] == '[') {
+        memmove(host, host + 1, strlen(host));
+        host[strcspn(host, "]")] = '\0';
+    }
+
+    struct addrinfo hints = {.ai_socktype = SOCK_STREAM}, *res, *ai;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "xhisper: %s: %s\n", llm.host, gai_strerror(err));
+        return -1;
+    }
+    llm.naddrs = 0;
+    for (ai = res; ai && llm.naddrs < LLM_ADDRS_MAX; ai = ai->ai_next) {
+        memcpy(&llm.addrs[llm.naddrs], ai->ai_addr, ai->ai_addrlen);
+        llm.addr_lens[llm.naddrs++] = ai->ai_addrlen;
+    }
+    freeaddrinfo(res);
+    snprintf(llm.resolved, sizeof(llm.resolved), "%s", llm.host);
+    return 0;
+}
+
+// Start connecting to the next address; llm_connected() takes over once
+// the socket is writable
+static int llm_connect(void) {
+    while (llm.next_addr < llm.naddrs) {
+        int i = llm.next_addr++;
+        int fd = socket(llm.addrs[i].ss_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd < 0) continue;
+        if (connect(fd, (struct sockaddr *)&llm.addrs[i], llm.addr_lens[i]) < 0 && errno != EINPROGRESS) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            continue;
+        }
+
+        // Tokens are small; don't hold them back
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        struct epoll_event ev = {.events = EPOLLOUT, .data.fd = fd};
+        epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd, &ev);
+        llm.fd = fd;
+        llm.state = LLM_CONNECTING;
+        llm.requests = 0;
+        return 0;
+    }
+
+    fprintf(stderr, "xhisper: failed to connect to LLM server at %s: %s\n", llm.host, strerror(errno));
+    llm.naddrs = 0;  // resolve again next time
+    return -1;
+}
+
+// Send llm.request over a connected socket
+static int llm_write(void) {
+    // Blocking: a request fits the socket buffer
+    int flags = fcntl(llm.fd, F_GETFL);
+    fcntl(llm.fd, F_SETFL, flags & ~O_NONBLOCK);
+    ssize_t n = send(llm.fd, llm.request.data, llm.request.len, MSG_NOSIGNAL);
+    fcntl(llm.fd, F_SETFL, flags);
+    if (n != (ssize_t)llm.request.len) {
+        // The server may have dropped an idle connection; a new one gets one try
+        int was_reused = llm.requests > 0;
+        llm_close();
+        if (!was_reused) {
+            perror("failed to send request to LLM server");
+            return -1;
+        }
+        llm.next_addr = 0;
+        return llm_connect();
+    }
+
+    llm.reused = llm.requests++ > 0;
+    llm.replied = 0;
+    llm.status = 0;
+    llm.state = LLM_HEADERS;
+    buf_free(&llm.error);
+    return 0;
+}
+
+// Send llm.request, over the kept connection when there is one, else once
+// a new one is up
+static int llm_send(void) {
+    // An answer cut short leaves the connection mid-body
+    if (llm.state != LLM_IDLE) llm_close();
+    if (llm.fd >= 0) return llm_write();
+    if (llm_resolve() < 0) return -1;
+    llm.next_addr = 0;
+    return llm_connect();
+}
+
+static void llm_connected(void) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(llm.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+    if (err) {
+        epoll_ctl(fd_epoll, EPOLL_CTL_DEL, llm.fd, NULL);
+        close(llm.fd);
+        llm.fd = -1;
+        llm.state = LLM_IDLE;
+        errno = err;
+        if (llm_connect() < 0) post_process_end("failed");
+        return;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = llm.fd};
+    epoll_ctl(fd_epoll, EPOLL_CTL_MOD, llm.fd, &ev);
+    llm.state = LLM_IDLE;
+    if (llm_write() < 0) post_process_end("failed");
+}
+
+// A line of the streamed answer: {"response": "<token>", "done": false, ...}
+static void llm_on_line(const char *line) {
+    struct buf token = {0};
+    int done = 0;
+
+    if (json_get(line, "error", &llm.error, NULL) == 0 || llm.status != 200) return;
+    if (json_get(line, "response", &token, NULL) == 0) on_token(buf_cstr(&token));
+    buf_free(&token);
+    if (json_get(line, "done", NULL, &done) == 0 && done) post_process_end(NULL);
+}
+
+static void llm_on_body(const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] != '\n') {
+            buf_append(&llm.line, &data[i], 1);
+            continue;
+        }
+        if (llm.line.len) llm_on_line(llm.line.data);
+        buf_free(&llm.line);
+    }
+}
+
+static void llm_on_end(void) {
+    if (llm.line.len) llm_on_line(llm.line.data);
+    buf_free(&llm.line);
+    buf_free(&llm.in);  // nothing may follow an answer we didn't ask for
+    llm.state = LLM_IDLE;
+    if (!llm.keep) llm_close();
+
+    // Nothing left to do when "done" arrived
+    if (state != ST_FORMATTING) return;
+    if (llm.status != 200 || llm.error.len) {
+        fprintf(stderr, "xhisper: LLM server answered %d: %s\n", llm.status,
+                llm.error.len ? llm.error.data : "(no error message)");
+    } else {
+        fprintf(stderr, "xhisper: LLM answer ended before it was done\n");
+    }
+    post_process_end("failed");
+}
+
+// Status line and headers, then the body: chunked, Content-Length or until
+// the connection closes
+static void llm_parse(void) {
+    size_t used = 0;
+
+    if (llm.state == LLM_HEADERS) {
+        char *end = strstr(llm.in.data, "\r\n\r\n");
+        if (!end) return;
+        *end = '\0';
+        used = end + 4 - llm.in.data;
+
+        llm.keep = 1;
+        llm.chunked = 0;
+        llm.chunk = CHUNK_SIZE;
+        llm.left = -1;
+        if (sscanf(llm.in.data, "HTTP/%*s %d", &llm.status) != 1) llm.status = 0;
+        char *save, *line = strtok_r(llm.in.data, "\r\n", &save);
+        while ((line = strtok_r(NULL, "\r\n", &save))) {
+            if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+                llm.chunked = strcasestr(line, "chunked") != NULL;
+            } else if (strncasecmp(line, "Content-Length:", 15) == 0) {
+                llm.left = atol(line + 15);
+            } else if (strncasecmp(line, "Connection:", 11) == 0) {
+                llm.keep = !strcasestr(line, "close");
+            }
+        }
+        if (!llm.chunked && llm.left < 0) llm.keep = 0;
+        llm.state = LLM_BODY;
+        if (!llm.chunked && llm.left == 0) {
+            llm_on_end();
+            return;
+        }
+    }
+
+    while (llm.state == LLM_BODY && used < llm.in.len) {
+        char *p = llm.in.data + used;
+        size_t avail = llm.in.len - used;
+
+        if (!llm.chunked || llm.chunk == CHUNK_DATA) {
+            size_t take = llm.left >= 0 && (size_t)llm.left < avail ? (size_t)llm.left : avail;
+            used += take;
+            if (llm.left >= 0) llm.left -= take;
+            llm_on_body(p, take);
+            if (llm.fd < 0) return;
+            if (llm.left == 0 && !llm.chunked) {
+                llm_on_end();
+                return;
+            }
+            if (llm.left == 0) llm.chunk = CHUNK_SIZE;
+            continue;
+        }
+
+        char *eol = memmem(p, avail, "\r\n", 2);
+        if (!eol) break;
+        used += eol + 2 - p;
+        if (llm.chunk == CHUNK_TRAILER) {
+            if (eol == p) {
+                llm_on_end();
+                return;
+            }
+        } else if (eol != p) {  // an empty line ends the previous chunk
+            llm.left = strtol(p, NULL, 16);
+            llm.chunk = llm.left > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+        }
+    }
+
+    memmove(llm.in.data, llm.in.data + used, llm.in.len - used + 1);
+    llm.in.len -= used;
+}
+
+static void llm_read(void) {
+    char chunk[4096];
+    ssize_t n;
+    while ((n = recv(llm.fd, chunk, sizeof(chunk), 0)) > 0) {
+        llm.replied = 1;
+        buf_append(&llm.in, chunk, n);
+    }
+    int closed = n == 0 || (errno != EAGAIN && errno != EINTR);
+
+    if (llm.in.len && llm.state != LLM_IDLE) llm_parse();
+    if (!closed || llm.fd < 0) return;
+
+    // An idle kept-alive connection the server closed as the request went out
+    enum llm_state was = llm.state;
+    if (was == LLM_HEADERS && !llm.replied && llm.reused) {
+        llm_close();
+        if (llm_send() == 0) return;
+        post_process_end("failed");
+        return;
+    }
+    if (was == LLM_BODY && !llm.chunked && llm.left < 0) {
+        llm_on_end();
+        llm_close();
+        return;
+    }
+    llm_close();
+    if (was != LLM_IDLE && state == ST_FORMATTING) {
+        fprintf(stderr, "xhisper: LLM server closed the connection\n");
+        post_process_end("failed");
+    }
+}
+
+static void start_post_process(void) {
+    const char *mode = s.mode[0] ? s.mode : cfg.post_process_mode;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Replacements, and auto mode's choice, in one pass over the text
+    struct buf rewritten = {0};
+    int command, whole;
+    scan_transcript(buf_cstr(&s.text), &rewritten, &command, &whole);
+    if (strcmp(mode, "auto") == 0) mode = command ? "command" : "standard";
+    snprintf(s.post_mode, sizeof(s.post_mode), "%s", mode);
+    buf_free(&s.text);
+    s.text = rewritten;
+    const char *text = buf_cstr(&s.text);
+
+    // Typed straight away when a replacement covers it all or it was
+    // dictated before
+    struct buf cached = {0};
+    const char *source = whole ? "replacement" : cache_lookup(&cached) == 0 ? "cached" : NULL;
+    if (source) {
+        const char *result = whole ? text : cached.data;
+        char title[64];
+        snprintf(title, sizeof(title), "Post-Process [%s] (%s)", s.post_mode, source);
+        log_result(title, result, &start);
+        set_span(SPAN_POST_PROCESS, elapsed_s(&start) * 1000);
+        fprintf(stderr, "xhisper: post-processing %s: %.3f ms\n", source, elapsed_s(&start) * 1000);
+        paste(result);
+        buf_free(&cached);
+        finish();
+        return;
+    }
+
+    const char *system = post_process_prompts[2][1];
+    for (size_t i = 0; i < sizeof(post_process_prompts) / sizeof(post_process_prompts[0]); i++) {
+        if (strcmp(mode, post_process_prompts[i][0]) == 0) system = post_process_prompts[i][1];
+    }
+
+    struct buf body = {0};
+    buf_str(&body, "{\"model\": ");
+    json_string(&body, cfg.post_process_model);
+    buf_str(&body, ", \"system\": ");
+    json_string(&body, system);
+    buf_str(&body, ", \"prompt\": ");
+    json_string(&body, text);
+    buf_str(&body, ", \"stream\": true, \"keep_alive\": \"" LLM_KEEP_ALIVE "\"}");
+
+    paste("(formatting...)");
+    clock_gettime(CLOCK_MONOTONIC, &s.started);
+    set_state(ST_FORMATTING);
+
+    // Covers connecting too
+    set_timer(TIMER_POST_PROCESS, (int)(cfg.post_process_timeout * 1000));
+    llm.reused = 0;
+    if (llm_set_host() < 0) {
+        buf_free(&body);
+        post_process_end("failed");
+        return;
+    }
+    char head[512];
+    snprintf(head, sizeof(head),
+             "POST /api/generate HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+             "Content-Length: %zu\r\n\r\n", llm.host, body.len);
+    buf_free(&llm.request);
+    buf_str(&llm.request, head);
+    buf_append(&llm.request, body.data, body.len);
+    buf_free(&body);
+
+    if (llm_send() < 0) post_process_end("failed");
+}
+
+// Type the answer as it streams in. As one line without surrounding
+// whitespace: newlines are dropped, and trailing whitespace waits until
+// something follows it.
+static void on_token(const char *token) {
+    if (state != ST_FORMATTING) return;
+    if (*token && !s.formatted.len) s.first_token_ms = elapsed_s(&s.started) * 1000;
+    buf_str(&s.formatted, token);
+
+    for (const char *p = token; *p; p++) {
+        if (*p == '\n' || *p == '\r') continue;
+        if (!s.streamed && !s.held.len && (*p == ' ' || *p == '\t')) continue;
+        buf_append(&s.held, p, 1);
+    }
+    size_t end = s.held.len;
+    while (end > 0 && (s.held.data[end - 1] == ' ' || s.held.data[end - 1] == '\t')) end--;
+    if (end == 0) return;
+
+    if (!s.streamed) {
+        delete_chars(15);  // "(formatting...)"
+        press_wrap_key();
+        s.streamed = 1;
+    }
+    char rest = s.held.data[end];
+    s.held.data[end] = '\0';
+    type_text(s.held.data);
+    s.typed += utf8_count(s.held.data, end);
+    s.held.data[end] = rest;
+    memmove(s.held.data, s.held.data + end, s.held.len - end + 1);
+    s.held.len -= end;
+}
+
+// The answer is complete (error is NULL), failed or timed out
+static void post_process_end(const char *error) {
+    if (state != ST_FORMATTING) return;
+    set_timer(TIMER_NONE, 0);
+    if (error) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "post-processing %s", error);
+        publish_error(msg);
+    }
+
+    // One line, without surrounding whitespace
+    struct buf result = {0};
+    buf_append(&result, "", 0);
+    for (size_t i = 0; i < s.formatted.len; i++) {
+        char c = s.formatted.data[i];
+        if (c != '\n' && c != '\r') buf_append(&result, &c, 1);
+    }
+    char title[64];
+    snprintf(title, sizeof(title), "Post-Process [%s]", s.post_mode);
+    char *formatted = trim(result.data);
+    log_result(title, formatted, &s.started);
+    if (!error) cache_store(formatted);
+    buf_free(&result);
+    double total_ms = elapsed_s(&s.started) * 1000;
+    set_span(SPAN_POST_PROCESS, total_ms);
+    fprintf(stderr, "xhisper: post-processing %s: first token %.0f ms, total %.0f ms (%s connection)\n",
+            error ? error : "done", s.first_token_ms, total_ms, llm.reused ? "kept" : "new");
+
+    if (s.streamed && !error) {
+        press_wrap_key();
+    } else if (s.streamed) {
+        // Take back the partial answer and use the original text
+        delete_chars(s.typed);
+        type_text(buf_cstr(&s.text));
+        press_wrap_key();
+    } else {
+        delete_chars(15);  // "(formatting...)"
+        // If the LLM failed, timed out or said nothing, use the original text
+        paste(buf_cstr(&s.text));
+    }
+    finish();
+}
+
+// A segment is typed as soon as it arrives when there is no post-processing.
+// Replacements run over all the text so far, so a phrase split between
+// segments still matches; what that changes of the typed text is taken back.
+static void on_segment(const char *text) {
+    if (s.text.len) buf_str(&s.text, " ");
+    buf_str(&s.text, text);
+    if (cfg.post_process_model[0]) return;
+
+    struct buf rewritten = {0};
+    int command, whole;
+    if (s.segments++ == 0) delete_chars(17);  // "(transcribing...)"
+    scan_transcript(buf_cstr(&s.text), &rewritten, &command, &whole);
+
+    // Keep what is already on screen up to the first difference
+    size_t same = 0;
+    while (same < s.shown.len && same < rewritten.len && s.shown.data[same] == rewritten.data[same]) {
+        same++;
+    }
+    while (same > 0 && ((unsigned char)s.shown.data[same] & 0xc0) == 0x80) same--;
+    if (same < s.shown.len) {
+        long taken = utf8_count(s.shown.data + same, s.shown.len - same);
+        delete_chars(taken);
+        s.typed -= taken;
+    }
+    if (same < rewritten.len) {
+        paste(rewritten.data + same);
+        s.typed += utf8_count(rewritten.data + same, rewritten.len - same);
+    }
+    buf_free(&s.shown);
+    s.shown = rewritten;
+}
+
+// Final reply: {"text": ...}, with "silent" for live recordings, or {"error": ...}
+static void on_transcribed(const char *line) {
+    struct buf error = {0};
+    int silent = 0;
+
+    server_close();
+    if (!line || json_get(line, "error", &error, NULL) == 0) {
+        fprintf(stderr, "xhisper: transcription failed: %s\n", line ? buf_cstr(&error) : "no reply");
+        buf_free(&error);
+        // Server lost the live recording: decode the saved copy instead
+        if (s.live && !s.fallback && transcribe_saved() == 0) return;
+        publish_error("transcription failed");
+        if (s.segments == 0) delete_chars(17);  // "(transcribing...)"
+        finish();
+        return;
+    }
+
+    json_get(line, "silent", NULL, &silent);
+    if (silent) {
+        if (s.segments == 0) delete_chars(17);  // "(transcribing...)"
+        show_no_sound();
+        return;
+    }
+
+    // Server-side stage timings, when it decoded the audio itself
+    static const struct { const char *key; enum span span; } server_spans[] = {
+        {"load_s", SPAN_LOAD}, {"decode_s", SPAN_DECODE},
+    };
+    for (size_t i = 0; i < sizeof(server_spans) / sizeof(server_spans[0]); i++) {
+        struct buf value = {0};
+        if (json_get(line, server_spans[i].key, &value, NULL) == 0) {
+            set_span(server_spans[i].span, atof(buf_cstr(&value)) * 1000);
+        }
+        buf_free(&value);
+    }
+    struct buf audio = {0};
+    if (json_get(line, "audio_s", &audio, NULL) == 0) s.audio_s = atof(buf_cstr(&audio));
+    buf_free(&audio);
+
+    const char *title = s.live && !s.fallback ? "Transcription (live)" :
+                        cfg.post_process_model[0] ? "Transcription" : "Transcription (streamed)";
+    log_result(title, buf_cstr(&s.text), &s.started);
+
+    if (cfg.post_process_model[0] && s.text.len) {
+        delete_chars(17);  // "(transcribing...)"
+        start_post_process();
+        return;
+    }
+    if (s.segments == 0) delete_chars(17);  // "(transcribing...)"
+    finish();
+}
+
+static void read_transcription(void) {
+    int fd = s.fd_reply;
+    char chunk[4096];
+    ssize_t n;
+
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        buf_append(&s.line, chunk, n);
+
+        char *nl;
+        while ((nl = memchr(s.line.data, '\n', s.line.len))) {
+            *nl = '\0';
+            struct buf segment = {0};
+            if (json_get(s.line.data, "segment", &segment, NULL) == 0) {
+                on_segment(buf_cstr(&segment));
+            } else {
+                on_transcribed(s.line.data);
+            }
+            buf_free(&segment);
+            // Done, or the saved recording was requested instead
+            if (s.fd_reply != fd) return;
+
+            size_t rest = s.line.len - (nl + 1 - s.line.data);
+            memmove(s.line.data, nl + 1, rest);
+            s.line.len = rest;
+            s.line.data[rest] = '\0';
+        }
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    on_transcribed(NULL);
+}
+
+static void on_timer(void) {
+    uint64_t expirations;
+    read(fd_timer, &expirations, sizeof(expirations));
+    enum timer_action action = timer_action;
+    timer_action = TIMER_NONE;
+
+    if (action == TIMER_PLACEHOLDER && state == ST_RECORDING) {
+        paste("(recording...)");
+        s.placeholder = 1;
+    } else if (action == TIMER_NOTICE && state == ST_NOTICE) {
+        delete_chars(19);  // "(no sound detected)"
+        finish();
+    } else if (action == TIMER_POST_PROCESS && state == ST_FORMATTING) {
+        fprintf(stderr, "xhisper: post-processing timed out after %gs\n", cfg.post_process_timeout);
+        // Closing the connection makes the server stop generating
+        llm_close();
+        post_process_end("timed out");
+    }
+}
+
+static void reap_children(int fd_signal) {
+    struct signalfd_siginfo info;
+    while (read(fd_signal, &info, sizeof(info)) == sizeof(info));
+
+    pid_t pid;
+    int status;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if (pid == s.recorder && state == ST_RECORDING) {
+            fprintf(stderr, "xhisper: recording process exited early (status %d)\n",
+                    WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        }
+        if (pid == s.recorder) s.recorder = 0;
+        if (pid == s.capture) s.capture = 0;
+    }
+}
+
+// "toggle [mode=<mode>] [wrap=<cmd>]" or "state"; replies with the state.
+// "subscribe" keeps the connection: the current state, then every change.
+// "stats [json]" replies with the stage percentiles.
+static void handle_request(int fd_listen) {
+    int fd = accept4(fd_listen, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) return;
+
+    char msg[256];
+    struct timeval timeout = {.tv_sec = 1};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    ssize_t n = recv(fd, msg, sizeof(msg) - 1, 0);
+    if (n <= 0) {
+        close(fd);
+        return;
+    }
+    msg[n] = '\0';
+
+    if (strncmp(msg, "toggle", 6) == 0) {
+        // The LLM server address may have changed
+        if (config_reload() && state == ST_IDLE) llm_close();
+        replacements_reload();
+
+        // A recording started by xhisper.sh or a previous controller
+        if (state == ST_IDLE) {
+            int fd_rec = connect_abstract(RECORD_SOCKET_NAME, SOCK_SEQPACKET, 1);
+            if (fd_rec >= 0) {
+                close(fd_rec);
+                set_state(ST_RECORDING);
+                s.placeholder = 1;
+            }
+        }
+
+        // A new dictation may start while the last one is still typing
+        if (state == ST_TYPING) {
+            spans_done(0);
+            set_state(ST_IDLE);
+        }
+        if (state == ST_IDLE || state == ST_RECORDING) {
+            char *mode = strstr(msg, " mode=");
+            char *wrap = strstr(msg, " wrap=");
+            if (mode) snprintf(s.mode, sizeof(s.mode), "%.*s", (int)strcspn(mode + 6, " "), mode + 6);
+            if (wrap) s.wrap = wrap[6];
+            if (state == ST_IDLE) start_recording();
+            else stop_recording();
+        } else {
+            fprintf(stderr, "xhisper: busy (%s), toggle ignored\n", state_names[state]);
+        }
+    }
+
+    if (strncmp(msg, "stats", 5) == 0) {
+        struct buf stats = {0};
+        format_stats(&stats, strcmp(msg, "stats json") == 0);
+        send(fd, stats.data, stats.len, MSG_NOSIGNAL);
+        buf_free(&stats);
+        close(fd);
+        return;
+    }
+
+    if (strcmp(msg, "subscribe") == 0) {
+        for (int i = 0; i < MAX_SUBSCRIBERS; i++) {
+            if (subscribers[i] >= 0) continue;
+            const char *current = state_names[state];
+            if (send(fd, current, strlen(current), MSG_NOSIGNAL) < 0) break;
+            subscribers[i] = fd;
+            // Only hangups are expected from here on
+            struct epoll_event ev = {.events = EPOLLIN | EPOLLRDHUP, .data.fd = fd};
+            epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd, &ev);
+            return;
+        }
+        fprintf(stderr, "xhisper: too many subscribers\n");
+        close(fd);
+        return;
+    }
+
+    const char *reply = state_names[state];
+    send(fd, reply, strlen(reply), MSG_NOSIGNAL);
+    close(fd);
+}
+
+static int run_controller(int fd_listen) {
+    signal(SIGPIPE, SIG_IGN);
+
+    // CUDA libraries for faster-whisper, as in xhisper.sh
+    const char *ld_path = getenv("LD_LIBRARY_PATH");
+    char cuda_path[PATH_MAX];
+    snprintf(cuda_path, sizeof(cuda_path), "/usr/local/lib/ollama/cuda_v12/lib:%s", ld_path ? ld_path : "");
+    setenv("LD_LIBRARY_PATH", cuda_path, 1);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int fd_signal = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+
+    fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+    fd_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd_signal < 0 || fd_epoll < 0 || fd_timer < 0) {
+        perror("failed to set up event loop");
+        return 1;
+    }
+
+    for (int i = 0; i < MAX_SUBSCRIBERS; i++) subscribers[i] = -1;
+    int fds[] = {fd_listen, fd_signal, fd_timer};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = fds[i]};
+        epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fds[i], &ev);
+    }
+
+    config_reload();
+    replacements_reload();
+    tool_connect();
+    server_preload();
+
+    fprintf(stderr, "xhisper: controller listening on @%s\n", CONTROL_SOCKET_NAME);
+
+    while (1) {
+        struct epoll_event events[8];
+        int n = epoll_wait(fd_epoll, events, 8, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            return 1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == fd_listen) {
+                handle_request(fd_listen);
+            } else if (fd == fd_signal) {
+                reap_children(fd_signal);
+            } else if (fd == fd_timer) {
+                on_timer();
+            } else if (fd == fd_tool) {
+                tool_acks(0, MSG_DONTWAIT);
+            } else if (fd == s.fd_reply) {
+                read_transcription();
+            } else if (fd == llm.fd && llm.state == LLM_CONNECTING) {
+                llm_connected();
+            } else if (fd == llm.fd) {
+                llm_read();
+            } else {
+                for (int slot = 0; slot < MAX_SUBSCRIBERS; slot++) {
+                    if (subscribers[slot] == fd) unsubscribe(slot);
+                }
+            }
+        }
+    }
+}
+
+// Client mode
+
+static void show_usage(void) {
+    fprintf(stderr,
+        "Usage: xhisper [--local] [--log] [--state] [--watch] [--stats[=json]]\n"
+        "               [--mode=auto|standard|command|email]\n"
+        "               [--leftalt|--rightalt|--leftctrl|--rightctrl|--leftshift|--rightshift|--super]\n");
+}
+
+// Binaries next to this one (--local) or from $PATH
+static int find_binaries(int local) {
+    if (local) {
+        char exe[PATH_MAX - 32];  // room for the file names
+        ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (n < 0) {
+            perror("failed to locate xhisper");
+            return -1;
+        }
+        exe[n] = '\0';
+        *strrchr(exe, '/') = '\0';
+        snprintf(tool_path, sizeof(tool_path), "%s/xhispertool", exe);
+        snprintf(daemon_path, sizeof(daemon_path), "%s/xhispertoold", exe);
+        snprintf(script_path, sizeof(script_path), "%s/xhisper_transcribe.py", exe);
+        return 0;
+    }
+
+    if (find_in_path("xhispertool", tool_path, sizeof(tool_path)) < 0 ||
+        find_in_path("xhispertoold", daemon_path, sizeof(daemon_path)) < 0) {
+        fprintf(stderr, "Error: xhispertool not found\n"
+                        "Please either:\n"
+                        "  - Run 'sudo make install' to install system-wide\n"
+                        "  - Run 'xhisper --local' from the build directory\n");
+        return -1;
+    }
+    if (find_in_path("xhisper_transcribe", script_path, sizeof(script_path)) < 0) {
+        fprintf(stderr, "Error: xhisper_transcribe not found\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Become the controller: bind first so concurrent calls queue on the socket
+static int start_controller(int local) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path + 1, CONTROL_SOCKET_NAME, sizeof(addr.sun_path) - 2);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        if (fd >= 0) close(fd);
+        // Lost the race to another call: that one is the controller
+        return errno == EADDRINUSE ? 0 : -1;
+    }
+    if (find_binaries(local) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    const char *config_home = getenv("XDG_CONFIG_HOME");
+    if (config_home && *config_home) {
+        snprintf(cfg_path, sizeof(cfg_path), "%s/xhisper/xhisperrc", config_home);
+    } else {
+        snprintf(cfg_path, sizeof(cfg_path), "%s/.config/xhisper/xhisperrc", getenv("HOME") ? getenv("HOME") : "");
+    }
+    snprintf(matcher.path, sizeof(matcher.path), "%.*s/replacements",
+             (int)(strrchr(cfg_path, '/') - cfg_path), cfg_path);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("failed to fork");
+        close(fd);
+        return -1;
+    }
+    if (pid == 0) {
+        setsid();
+        int null = open("/dev/null", O_RDWR);
+        int log = open(LOGFILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        if (log >= 0) dup2(log, STDERR_FILENO);
+        setvbuf(stderr, NULL, _IOLBF, 0);
+        _exit(run_controller(fd));
+    }
+    close(fd);
+    return 0;
+}
+
+// --watch: print the state, then one line per change, for status bars. Never
+// starts the controller; without one it is idle until one appears.
+static int watch_state(void) {
+    char last[128] = "";
+
+    while (1) {
+        int fd = connect_abstract(CONTROL_SOCKET_NAME, SOCK_SEQPACKET, 1);
+        if (fd >= 0 && send(fd, "subscribe", 9, MSG_NOSIGNAL) == 9) {
+            ssize_t n;
+            while ((n = recv(fd, last, sizeof(last) - 1, 0)) > 0) {
+                last[n] = '\0';
+                if (printf("%s\n", last) < 0 || fflush(stdout) != 0) return 1;
+            }
+        }
+        if (fd >= 0) close(fd);
+
+        if (strcmp(last, state_names[ST_IDLE]) != 0) {
+            snprintf(last, sizeof(last), "%s", state_names[ST_IDLE]);
+            if (printf("%s\n", last) < 0 || fflush(stdout) != 0) return 1;
+        }
+        sleep_s(1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int local = 0;
+    const char *query = NULL;  // "state" or "stats [json]" instead of a toggle
+    const char *mode = NULL;
+    char wrap = 0;
+    static const struct {
+        const char *flag;
+        char cmd;
+    } wrap_keys[] = {
+        {"--leftalt", 'L'}, {"--rightalt", 'r'}, {"--leftctrl", 'C'}, {"--rightctrl", 'R'},
+        {"--leftshift", 'S'}, {"--rightshift", 'T'}, {"--super", 'M'},
+    };
+
+    for (int i = 1; i < argc; i++) {
+        char key = 0;
+        for (size_t k = 0; k < sizeof(wrap_keys) / sizeof(wrap_keys[0]); k++) {
+            if (strcmp(argv[i], wrap_keys[k].flag) == 0) key = wrap_keys[k].cmd;
+        }
+
+        if (strcmp(argv[i], "--local") == 0) {
+            local = 1;
+        } else if (strcmp(argv[i], "--log") == 0) {
+            FILE *f = fopen(LOGFILE, "r");
+            if (!f) {
+                fprintf(stderr, "No log file found at %s\n", LOGFILE);
+                return 0;
+            }
+            char chunk[4096];
+            size_t n;
+            while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) fwrite(chunk, 1, n, stdout);
+            fclose(f);
+            return 0;
+        } else if (strcmp(argv[i], "--state") == 0) {
+            query = "state";
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            query = "stats";
+        } else if (strcmp(argv[i], "--stats=json") == 0) {
+            query = "stats json";
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            return watch_state();
+        } else if (strncmp(argv[i], "--mode=", 7) == 0) {
+            mode = argv[i] + 7;
+        } else if (key) {
+            if (wrap) {
+                fprintf(stderr, "Error: Multiple wrap keys not yet supported\n");
+                return 1;
+            }
+            wrap = key;
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+            show_usage();
+            return 1;
+        }
+    }
+
+    int fd = connect_abstract(CONTROL_SOCKET_NAME, SOCK_SEQPACKET, 1);
+    if (fd < 0 && query && strcmp(query, "state") == 0) {
+        printf("%s\n", state_names[ST_IDLE]);
+        return 0;
+    }
+    if (fd < 0 && query) {
+        fprintf(stderr, "Error: the xhisper controller is not running\n");
+        return 1;
+    }
+    if (fd < 0) {
+        if (start_controller(local) < 0) return 1;
+        fd = connect_wait(CONTROL_SOCKET_NAME, SOCK_SEQPACKET, 1, DAEMON_START_MS);
+        if (fd < 0) {
+            fprintf(stderr, "Error: failed to start the xhisper controller, see %s\n", LOGFILE);
+            return 1;
+        }
+    }
+
+    char msg[128];
+    int len;
+    if (query) {
+        len = snprintf(msg, sizeof(msg), "%s", query);
+    } else {
+        len = snprintf(msg, sizeof(msg), "toggle");
+        if (mode) len += snprintf(msg + len, sizeof(msg) - len, " mode=%.15s", mode);
+        if (wrap) len += snprintf(msg + len, sizeof(msg) - len, " wrap=%c", wrap);
+    }
+
+    char reply[4096];
+    ssize_t n = -1;
+    if (send(fd, msg, len, MSG_NOSIGNAL) == len) n = recv(fd, reply, sizeof(reply) - 1, 0);
+    close(fd);
+    if (n <= 0) {
+        fprintf(stderr, "Error: no reply from the xhisper controller\n");
+        return 1;
+    }
+    if (query) printf("%.*s%s", (int)n, reply, reply[n - 1] == '\n' ? "" : "\n");
+    return 0;
+}
@@ -13,9 +13,16 @@ export LD_LIBRARY_PATH=/usr/local/lib/ollama/cuda_v12/lib:$LD_LIBRARY_PATH
 # - model-language : Language code for faster/more accurate transcription (e.g., en)
 # - transcription-prompt : context words for better Whisper accuracy
 # - silence-threshold : max volume in dB to consider silent (e.g., -50)
-# - silence-percentage : percentage of recording that must be silent (e.g., 95)
+# - silence-percentage : percentage of 30 ms frames that must be silent (e.g., 95)
 # - non-ascii-initial-delay : sleep after first non-ASCII paste (seconds)
 # - non-ascii-default-delay : sleep after subsequent non-ASCII pastes (seconds)
+# - typing-profile : key timing profile for xhispertoold (safe, fast, burst)
+# - unicode-method : how non-ASCII is typed (clipboard, ctrl-shift-u)
+# - keyboard-layout : desktop keyboard layout (us, fr, de, dvorak)
+# - live-transcription : transcribe phrases while still recording (on, off)
+# - trim-silence : cut silence out of the recording before decoding (on, off)
+# - hotkey : chords xhispertoold toggles dictation on (e.g. leftalt+leftshift+d)
+# - hotkey-device : /dev/input/eventN to watch instead of every keyboard
 
 # Requirements:
 # - pipewire, pipewire-utils (audio)
@@ -63,15 +70,17 @@ done
 if [ "$LOCAL_MODE" -eq 1 ]; then
   SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
   XHISPERTOOL="$SCRIPT_DIR/xhispertool"
-  XHISPERTOOLD="$SCRIPT_DIR/xhispertoold"
+  TRANSCRIPT_SCRIPT="$SCRIPT_DIR/xhisper_transcribe.py"
 else
   XHISPERTOOL="xhispertool"
-  XHISPERTOOLD="xhispertoold"
+  TRANSCRIPT_SCRIPT="$(command -v xhisper_transcribe)"
 fi
 
 RECORDING="/tmp/xhisper.wav"
+TRIMMED="/tmp/xhisper.f32"
 LOGFILE="/tmp/xhisper.log"
-PROCESS_PATTERN="pw-record.*$RECORDING"
+CLIPBOARD_SAVED="/tmp/xhisper.clipboard"
+LIVE_PATTERN="xhisper_transcribe(\.py)? --live"
 
 # Default configuration
 model_name="base"
@@ -82,9 +91,16 @@ silence_threshold=-50
 silence_percentage=95
 non_ascii_initial_delay=0.1
 non_ascii_default_delay=0.025
+typing_profile="safe"
+unicode_method="clipboard"
+keyboard_layout="us"
+live_transcription="off"
+trim_silence="on"
 post_process_model=""
 post_process_timeout=10
 post_process_mode="auto"
+hotkey=""
+hotkey_device=""
 
 CONFIG_FILE="${XDG_CONFIG_HOME:-$HOME/.config}/xhisper/xhisperrc"
 
@@ -107,9 +123,16 @@ if [ -f "$CONFIG_FILE" ]; then
       silence-percentage) silence_percentage="$value" ;;
       non-ascii-initial-delay) non_ascii_initial_delay="$value" ;;
       non-ascii-default-delay) non_ascii_default_delay="$value" ;;
+      typing-profile) typing_profile="$value" ;;
+      unicode-method) unicode_method="$value" ;;
+      keyboard-layout) keyboard_layout="$value" ;;
+      live-transcription) live_transcription="$value" ;;
+      trim-silence) trim_silence="$value" ;;
       post-process-model) post_process_model="$value" ;;
       post-process-timeout) post_process_timeout="$value" ;;
       post-process-mode) post_process_mode="$value" ;;
+      hotkey) hotkey="$value" ;;
+      hotkey-device) hotkey_device="$value" ;;
     esac
   done < "$CONFIG_FILE"
 fi
@@ -117,17 +140,30 @@ fi
 # Command-line mode overrides config
 [ -n "$POST_PROCESS_MODE" ] && post_process_mode="$POST_PROCESS_MODE"
 
-# Auto-start daemon if not running
-if ! pgrep -x xhispertoold > /dev/null; then
-    "$XHISPERTOOLD" 2>> /tmp/xhispertoold.log &
-    sleep 1  # Give daemon time to start
+# Start the daemon unless it is running; returns as soon as it can type
+daemon_args=(--profile="$typing_profile" --unicode="$unicode_method" --layout="$keyboard_layout")
+IFS=, read -ra entries <<< "$hotkey"
+for entry in "${entries[@]}"; do
+  entry=$(echo "$entry" | tr -d '[:space:]')
+  [ -n "$entry" ] && daemon_args+=(--hotkey="$entry")
+done
+IFS=, read -ra entries <<< "$hotkey_device"
+for entry in "${entries[@]}"; do
+  entry=$(echo "$entry" | tr -d '[:space:]')
+  [ -n "$entry" ] && daemon_args+=(--hotkey-device="$entry")
+done
+if ! "$XHISPERTOOL" start "${daemon_args[@]}" >> /tmp/xhispertoold.log 2>&1; then
+    echo "Error: Failed to start xhispertoold daemon" >&2
+    echo "Check /tmp/xhispertoold.log for details" >&2
+    exit 1
+fi
 
-    # Verify daemon started successfully
-    if ! pgrep -x xhispertoold > /dev/null; then
-        echo "Error: Failed to start xhispertoold daemon" >&2
-        echo "Check /tmp/xhispertoold.log for details" >&2
-        exit 1
-    fi
+# Auto-start the transcription server; it loads the model once and keeps it
+# (a model-name/model-device change is picked up by the next request)
+TRANSCRIBE_SERVER_PATTERN="xhisper_transcribe(\.py)? --server"
+if ! pgrep -f "$TRANSCRIBE_SERVER_PATTERN" > /dev/null; then
+    python3 "$TRANSCRIPT_SCRIPT" --server --model "$model_name" --device "$model_device" \
+        2>> /tmp/xhisper_transcribe.log &
 fi
 
 # Check if xhispertool is available
@@ -139,52 +175,135 @@ if ! command -v "$XHISPERTOOL" &> /dev/null; then
     exit 1
 fi
 
-# Detect clipboard tool
-if command -v wl-copy &> /dev/null; then
-    CLIP_COPY="wl-copy"
-    CLIP_PASTE="wl-paste"
+# Detect clipboard tool (only needed when non-ASCII goes through the clipboard)
+if [ "$unicode_method" != "clipboard" ]; then
+    :
+elif command -v wl-copy &> /dev/null; then
+    CLIP_COPY() { wl-copy ${1:+--type "$1"}; }
+    CLIP_PASTE() { wl-paste --no-newline --type "$1"; }
+    CLIP_TYPES() { wl-paste --list-types; }
 elif command -v xclip &> /dev/null; then
-    CLIP_COPY() { xclip -selection clipboard; }
-    CLIP_PASTE() { xclip -o -selection clipboard; }
+    CLIP_COPY() { xclip -selection clipboard ${1:+-t "$1"}; }
+    CLIP_PASTE() { xclip -o -selection clipboard -t "$1"; }
+    CLIP_TYPES() { xclip -o -selection clipboard -t TARGETS; }
 else
     echo "Error: No clipboard tool found. Install wl-clipboard or xclip." >&2
     exit 1
 fi
 
+# Select the timing profile for this session (the daemon may predate a config change)
+"$XHISPERTOOL" profile "$typing_profile"
+"$XHISPERTOOL" unicode "$unicode_method"
+"$XHISPERTOOL" layout "$keyboard_layout"
+
+# Non-ASCII characters the layout has a key for are typed, not pasted
+declare -A LAYOUT_CHARS=()
+if [ "$unicode_method" = "clipboard" ]; then
+  while IFS= read -r ch; do
+    LAYOUT_CHARS["$ch"]=1
+  done < <("$XHISPERTOOL" layout-chars "$keyboard_layout")
+fi
+
 press_wrap_key() {
   if [ -n "$WRAP_KEY" ]; then
     "$XHISPERTOOL" "$WRAP_KEY"
   fi
 }
 
+# Save the clipboard's bytes to $CLIPBOARD_SAVED and its type to clip_type,
+# as text when text is offered so the restore pastes anywhere, else in the
+# first type offered (an image, say)
+save_clipboard() {
+  local types t
+  types=$(CLIP_TYPES 2>/dev/null) || return 1
+  clip_type=""
+  for t in UTF8_STRING "text/plain;charset=utf-8" text/plain STRING; do
+    grep -qxF "$t" <<< "$types" && clip_type="$t" && break
+  done
+  [ -z "$clip_type" ] && clip_type=$(grep -vxE -m1 'TARGETS|TIMESTAMP|MULTIPLE|SAVE_TARGETS' <<< "$types")
+  [ -n "$clip_type" ] && CLIP_PASTE "$clip_type" > "$CLIPBOARD_SAVED" 2>/dev/null
+}
+
+# Paste one run via the clipboard; uses paste()'s clip_type/had_clipboard/pasted
+paste_run() {
+  # Save the user's clipboard before the first paste
+  if [ "$pasted" -eq 0 ]; then
+    save_clipboard && had_clipboard=1
+  fi
+
+  printf '%s' "$1" | CLIP_COPY
+  "$XHISPERTOOL" paste
+  # Ctrl+V is down, and the delay gives the application time to fetch the
+  # clipboard before the next run or the restore replaces it
+  "$XHISPERTOOL" sync
+  # On first paste (more error-prone), sleep longer
+  [ "$pasted" -eq 0 ] && sleep "$non_ascii_initial_delay" || sleep "$non_ascii_default_delay"
+  pasted=1
+}
+
 paste() {
   local text="$1"
   press_wrap_key
-  # Type character by character
-  # Use xhispertool type for ASCII (32-126), clipboard+paste for Unicode
-  for ((i=0; i<${#text}; i++)); do
-    local char="${text:$i:1}"
-    local ascii=$(printf '%d' "'$char")
-
-    if [[ $ascii -ge 32 && $ascii -le 126 ]]; then
-      # ASCII printable character - use direct key typing (faster)
-      "$XHISPERTOOL" type "$char"
-    else
-      # Unicode or special character - use clipboard
-      echo -n "$char" | $CLIP_COPY
-      "$XHISPERTOOL" paste
-      # On first character (more error-prone), sleep longer
-      [ "$i" -eq 0 ] && sleep "$non_ascii_initial_delay" || sleep "$non_ascii_default_delay"
+  # The daemon types Unicode itself, no clipboard needed
+  if [ "$unicode_method" != "clipboard" ]; then
+    "$XHISPERTOOL" string -- "$text"
+    press_wrap_key
+    return
+  fi
+
+  # Split into maximal runs by byte: printable ASCII runs are typed with one
+  # xhispertool call each, everything else (UTF-8 sequences never contain
+  # ASCII bytes) is pasted one run at a time via the clipboard
+  local LC_ALL=C
+  local rest="$text" run clip_type had_clipboard=0 pasted=0
+  while [ -n "$rest" ]; do
+    run="${rest%%[^ -~]*}"
+    if [ -n "$run" ]; then
+      "$XHISPERTOOL" string -- "$run"
+      rest="${rest:${#run}}"
+      [ -z "$rest" ] && break
     fi
+
+    run="${rest%%[ -~]*}"
+    rest="${rest:${#run}}"
+
+    if [ "${#LAYOUT_CHARS[@]}" -eq 0 ]; then
+      paste_run "$run"
+      continue
+    fi
+
+    # Split the run into characters (by UTF-8 lead byte) and type the ones
+    # the keyboard layout has a key for
+    local direct="" clip="" ch lead
+    while [ -n "$run" ]; do
+      printf -v lead '%d' "'${run:0:1}"
+      if [ "$lead" -ge 240 ]; then ch="${run:0:4}"
+      elif [ "$lead" -ge 224 ]; then ch="${run:0:3}"
+      elif [ "$lead" -ge 192 ]; then ch="${run:0:2}"
+      else ch="${run:0:1}"; fi
+      run="${run:${#ch}}"
+
+      if [ -n "${LAYOUT_CHARS[$ch]}" ]; then
+        [ -n "$clip" ] && paste_run "$clip" && clip=""
+        direct+="$ch"
+      else
+        [ -n "$direct" ] && "$XHISPERTOOL" string -- "$direct" && direct=""
+        clip+="$ch"
+      fi
+    done
+    [ -n "$clip" ] && paste_run "$clip"
+    [ -n "$direct" ] && "$XHISPERTOOL" string -- "$direct"
   done
+
+  if [ "$had_clipboard" -eq 1 ]; then
+    CLIP_COPY "$clip_type" < "$CLIPBOARD_SAVED"
+    rm -f "$CLIPBOARD_SAVED"
+  fi
   press_wrap_key
 }
 
 delete_n_chars() {
-  local n="$1"
-  for ((i=0; i<n; i++)); do
-    "$XHISPERTOOL" backspace
-  done
+  "$XHISPERTOOL" backspace "$1"
 }
 
 get_duration() {
@@ -192,21 +311,11 @@ get_duration() {
   ffprobe -v error -show_entries format=duration -of default=noprint_wrappers=1:nokey=1 "$recording" 2>/dev/null || echo "0"
 }
 
-is_silent() {
-  local recording="$1"
-
-  # Use ffmpeg volumedetect to get mean and max volume
-  local vol_stats=$(ffmpeg -i "$recording" -af "volumedetect" -f null /dev/null 2>&1 | grep -E "mean_volume|max_volume")
-  local max_vol=$(echo "$vol_stats" | grep "max_volume" | awk '{print $5}')
-
-  # If max volume is below threshold, consider it silent
-  # Note: ffmpeg reports in dB, negative values (e.g., -50 dB is quiet)
-  if [ -n "$max_vol" ]; then
-    local is_quiet=$(echo "$max_vol < $silence_threshold" | bc -l)
-    [ "$is_quiet" -eq 1 ] && return 0
-  fi
-
-  return 1
+# Store microseconds since the epoch in the named variable, without a
+# subshell (bash 5's EPOCHREALTIME; date on older shells)
+now_us() {
+  local now="${EPOCHREALTIME/[.,]/}"
+  printf -v "$1" "%s" "${now:-$(date +%s%6N)}"
 }
 
 logging_end_and_write_to_logfile() {
@@ -214,8 +323,10 @@ logging_end_and_write_to_logfile() {
   local result="$2"
   local logging_start="$3"
 
-  local logging_end=$(date +%s%N)
-  local time=$(echo "scale=3; ($logging_end - $logging_start) / 1000000000" | bc)
+  local logging_end
+  now_us logging_end
+  local elapsed=$(( logging_end - logging_start ))
+  local time=$(printf "%d.%03d" $(( elapsed / 1000000 )) $(( elapsed / 1000 % 1000 )))
 
   echo "=== $title ===" >> "$LOGFILE"
   echo "Result: [$result]" >> "$LOGFILE"
@@ -225,7 +336,7 @@ logging_end_and_write_to_logfile() {
 post_process() {
   local text="$1"
   local mode="${2:-$post_process_mode}"
-  local logging_start=$(date +%s%N)
+  local logging_start; now_us logging_start
 
   # Skip if empty or no model configured
   [ -z "$text" ] && echo "$text" && return
@@ -279,54 +390,127 @@ post_process() {
 
 transcribe() {
   local recording="$1"
-  local logging_start=$(date +%s%N)
-
-  # Set up transcription script path
-  if [ "$LOCAL_MODE" -eq 1 ]; then
-    TRANSCRIPT_SCRIPT="$SCRIPT_DIR/xhisper_transcribe.py"
-  else
-    TRANSCRIPT_SCRIPT="xhisper_transcribe"
-  fi
+  local stream="$2"
+  local logging_start; now_us logging_start
 
   # Build command arguments
-  local cmd_args="--model $model_name --device $model_device"
+  local cmd_args=(--model="$model_name" --device="$model_device")
 
   if [ -n "$model_language" ]; then
-    cmd_args="$cmd_args --language $model_language"
+    cmd_args+=(--language="$model_language")
   fi
 
   if [ -n "$transcription_prompt" ]; then
-    cmd_args="$cmd_args --prompt \"$transcription_prompt\""
+    cmd_args+=(--prompt="$transcription_prompt")
+  fi
+
+  # Hand the decoder only the speech, as raw float32 it can use directly
+  local audio="$recording"
+  if [ "$trim_silence" = "on" ] &&
+     "$XHISPERTOOL" trim --threshold="$silence_threshold" "$recording" "$TRIMMED" 2>> "$LOGFILE"; then
+    audio="$TRIMMED"
+    cmd_args+=(--raw=f32)
+  fi
+
+  # Segments one per line as they are decoded, logged by type_segments
+  if [ "$stream" = "--stream" ]; then
+    "$XHISPERTOOL" transcribe "${cmd_args[@]}" --stream "$audio" 2>/dev/null
+    rm -f "$TRIMMED"
+    return
   fi
 
-  # Run transcription
-  local transcription=$(python3 "$TRANSCRIPT_SCRIPT" "$recording" $cmd_args 2>/dev/null)
+  # Run transcription on the resident server
+  local transcription=$("$XHISPERTOOL" transcribe "${cmd_args[@]}" "$audio" 2>/dev/null)
+  rm -f "$TRIMMED"
 
   logging_end_and_write_to_logfile "Transcription" "$transcription" "$logging_start"
 
   echo "$transcription"
 }
 
-# Main
+# Stop xhispertool record and transcribe the audio it hands over. It is
+# silent when its peak is below silence-threshold or at least
+# silence-percentage of its frames are; exits 4 then.
+transcribe_recorder() {
+  local logging_start; now_us logging_start
+  local transcription status
+  local cmd_args=(--from-recorder --model="$model_name" --device="$model_device"
+                  --threshold="$silence_threshold"
+                  --percentage="$silence_percentage")
+
+  [ -n "$model_language" ] && cmd_args+=(--language="$model_language")
+  [ -n "$transcription_prompt" ] && cmd_args+=(--prompt="$transcription_prompt")
+  [ "$trim_silence" = "on" ] && cmd_args+=(--trim=1)
+
+  if [ "$1" = "--stream" ]; then
+    "$XHISPERTOOL" transcribe "${cmd_args[@]}" --stream 2>/dev/null
+    return
+  fi
 
-# Find recording process, if so then kill
-if pgrep -f "$PROCESS_PATTERN" > /dev/null; then
-  pkill -f "$PROCESS_PATTERN"; sleep 0.2 # Buffer for flush
-  delete_n_chars 14 # "(recording...)"
+  transcription=$("$XHISPERTOOL" transcribe "${cmd_args[@]}" 2>/dev/null)
+  status=$?
 
-  # Check if recording is silent
-  if is_silent "$RECORDING"; then
-    paste "(no sound detected)"
-    sleep 0.6
-    delete_n_chars 19 # "(no sound detected)"
-    rm -f "$RECORDING"
-    exit 0
+  logging_end_and_write_to_logfile "Transcription" "$transcription" "$logging_start"
+
+  echo "$transcription"
+  return $status
+}
+
+# Text of a live recording; the phrases were transcribed while recording,
+# only the last one is left. Exits 4 if the recording was silent.
+collect_live() {
+  local logging_start; now_us logging_start
+  local transcription status
+
+  if [ "$1" = "--stream" ]; then
+    "$XHISPERTOOL" transcribe --collect --stream 2>/dev/null
+    return
   fi
 
-  paste "(transcribing...)"
-  TRANSCRIPTION=$(transcribe "$RECORDING")
-  delete_n_chars 17 # "(transcribing...)"
+  transcription=$("$XHISPERTOOL" transcribe --collect 2>/dev/null)
+  status=$?
 
+  logging_end_and_write_to_logfile "Transcription (live)" "$transcription" "$logging_start"
+
+  echo "$transcription"
+  return $status
+}
+
+# Type segments (one per line on stdin) as they arrive, so the first
+# sentence is on screen while later ones are still being decoded. The
+# first segment replaces the "(transcribing...)" placeholder. What was
+# typed is left in TYPED_SEGMENTS.
+type_segments() {
+  local title="$1"
+  local logging_start; now_us logging_start
+  local segment text=""
+
+  while IFS= read -r segment; do
+    [ -z "$segment" ] && continue
+    if [ -z "$text" ]; then
+      delete_n_chars 17 # "(transcribing...)"
+      paste "$segment"
+      text="$segment"
+    else
+      paste " $segment"
+      text="$text $segment"
+    fi
+  done
+  [ -z "$text" ] && delete_n_chars 17 # "(transcribing...)"
+  TYPED_SEGMENTS="$text"
+
+  logging_end_and_write_to_logfile "$title" "$text" "$logging_start"
+}
+
+show_no_sound() {
+  paste "(no sound detected)"
+  "$XHISPERTOOL" sync # Wait until it is actually on screen
+  sleep 0.4 # Time to read it
+  delete_n_chars 19 # "(no sound detected)"
+  rm -f "$RECORDING"
+}
+
+type_transcription() {
   # Post-process with LLM if configured
   if [ -n "$post_process_model" ] && [ -n "$TRANSCRIPTION" ]; then
     paste "(formatting...)"
@@ -343,9 +527,92 @@ if pgrep -f "$PROCESS_PATTERN" > /dev/null; then
   fi
 
   rm -f "$RECORDING"
+}
+
+# Stop a recording with $1 (collect_live or transcribe_recorder, which
+# print its text and exit 4 when it was silent) and type the result.
+# Returns the fetch status.
+finish_recording() {
+  local fetch="$1"
+  local title="$2"
+  local status
+
+  delete_n_chars 14 # "(recording...)"
+  paste "(transcribing...)"
+
+  if [ -z "$post_process_model" ]; then
+    "$fetch" --stream | type_segments "$title"
+    status=${PIPESTATUS[0]}
+  else
+    TRANSCRIPTION=$("$fetch")
+    status=$?
+    delete_n_chars 17 # "(transcribing...)"
+  fi
+
+  if [ "$status" -eq 4 ]; then
+    show_no_sound
+  elif [ "$status" -eq 0 ] && [ -n "$post_process_model" ]; then
+    type_transcription
+  fi
+  return $status
+}
+
+# Transcribe the saved recording and type it. Without post-processing
+# the text is typed segment by segment while the rest is still decoding.
+transcribe_and_type() {
+  paste "(transcribing...)"
+  if [ -z "$post_process_model" ]; then
+    transcribe "$RECORDING" --stream | type_segments "Transcription (streamed)"
+    rm -f "$RECORDING"
+    return
+  fi
+
+  TRANSCRIPTION=$(transcribe "$RECORDING")
+  delete_n_chars 17 # "(transcribing...)"
+  type_transcription
+}
+
+# Main
+
+# The last command of a pipeline runs in this shell, so TYPED_SEGMENTS
+# survives type_segments
+shopt -s lastpipe
+TYPED_SEGMENTS=""
+
+# Live recording running: stop it, its last phrase is flushed on exit
+if pgrep -f "$LIVE_PATTERN" > /dev/null; then
+  pkill -f "$LIVE_PATTERN"
+  finish_recording collect_live "Transcription (live)"
+  status=$?
+
+  # Server lost the recording: take back what was typed of it and decode
+  # the saved copy instead
+  if [ "$status" -ne 0 ] && [ "$status" -ne 4 ]; then
+    [ -n "$TYPED_SEGMENTS" ] && delete_n_chars "${#TYPED_SEGMENTS}"
+    transcribe_and_type
+  fi
+  rm -f "$RECORDING"
+
+# Recording running: stopping it hands its audio straight over, no flush wait
+elif "$XHISPERTOOL" recording; then
+  finish_recording transcribe_recorder "Transcription (streamed)"
 else
   # No recording running, so start
-  sleep 0.2
   paste "(recording...)"
-  pw-record --channels=1 --rate=16000 "$RECORDING"
+  if [ "$live_transcription" = "on" ]; then
+    # Phrases are transcribed as soon as a pause ends them
+    live_args=(--model "$model_name" --device "$model_device"
+                --vad-threshold "$silence_threshold" --silence-threshold "$silence_threshold")
+    [ -n "$model_language" ] && live_args+=(--language "$model_language")
+    [ -n "$transcription_prompt" ] && live_args+=(--prompt "$transcription_prompt")
+    pw-record --channels=1 --rate=16000 --format=s16 - |
+      python3 "$TRANSCRIPT_SCRIPT" --live --save "$RECORDING" "${live_args[@]}" \
+        2>> /tmp/xhisper_transcribe.log
+  else
+    # Load a changed model while the user speaks
+    "$XHISPERTOOL" transcribe --preload --model="$model_name" --device="$model_device" \
+      > /dev/null 2>&1 &
+    # Captured in memory until the next invocation stops it
+    "$XHISPERTOOL" record 2>> "$LOGFILE"
+  fi
 fi
@@ -0,0 +1,201 @@
+/*
+ * xhisper_json.h - growable buffers and the little JSON the transcription
+ * and LLM servers speak, shared by the xhisper controller and xhispertool
+ */
+
+#ifndef XHISPER_JSON_H
+#define XHISPER_JSON_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct buf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+static inline void buf_append(struct buf *b, const char *data, size_t len) {
+    if (b->len + len + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap : 256;
+        while (cap < b->len + len + 1) cap *= 2;
+        char *grown = realloc(b->data, cap);
+        if (!grown) {
+            perror("failed to allocate buffer");
+            exit(1);
+        }
+        b->data = grown;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+}
+
+static inline void buf_str(struct buf *b, const char *str) {
+    buf_append(b, str, strlen(str));
+}
+
+static inline void buf_free(struct buf *b) {
+    free(b->data);
+    *b = (struct buf){0};
+}
+
+static inline const char *buf_cstr(const struct buf *b) {
+    return b->data ? b->data : "";
+}
+
+// JSON, only as much as the transcription and LLM servers speak: objects of
+// strings, booleans and numbers, where nested values are skipped
+
+static inline void json_string(struct buf *b, const char *str) {
+    buf_str(b, "\"");
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\') {
+            char esc[2] = {'\\', c};
+            buf_append(b, esc, 2);
+        } else if (c < 0x20) {
+            char esc[8];
+            buf_append(b, esc, snprintf(esc, sizeof(esc), "\\u%04x", c));
+        } else {
+            buf_append(b, (const char *)&c, 1);
+        }
+    }
+    buf_str(b, "\"");
+}
+
+static inline void utf8_put(struct buf *b, uint32_t cp) {
+    char out[4];
+    size_t n;
+    if (cp < 0x80) {
+        out[0] = cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        out[0] = 0xc0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3f);
+        n = 2;
+    } else if (cp < 0x10000) {
+        out[0] = 0xe0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3f);
+        out[2] = 0x80 | (cp & 0x3f);
+        n = 3;
+    } else {
+        out[0] = 0xf0 | (cp >> 18);
+        out[1] = 0x80 | ((cp >> 12) & 0x3f);
+        out[2] = 0x80 | ((cp >> 6) & 0x3f);
+        out[3] = 0x80 | (cp & 0x3f);
+        n = 4;
+    }
+    buf_append(b, out, n);
+}
+
+// Decode the string starting at *p (on its opening quote)
+static inline int json_parse_string(const char **p, struct buf *out) {
+    const char *q = *p + 1;
+
+    while (*q && *q != '"') {
+        if (*q != '\\') {
+            if (out) buf_append(out, q, 1);
+            q++;
+            continue;
+        }
+        q++;
+        char c = *q++;
+        uint32_t cp = c;
+        switch (c) {
+            case 'n': cp = '\n'; break;
+            case 't': cp = '\t'; break;
+            case 'r': cp = '\r'; break;
+            case 'b': cp = '\b'; break;
+            case 'f': cp = '\f'; break;
+            case 'u': {
+                char hex[5] = {0};
+                if (strlen(q) < 4) return -1;
+                memcpy(hex, q, 4);
+                cp = strtoul(hex, NULL, 16);
+                q += 4;
+                // Surrogate pair
+                if (cp >= 0xd800 && cp < 0xdc00 && q[0] == '\\' && q[1] == 'u') {
+                    if (strlen(q + 2) < 4) return -1;
+                    memcpy(hex, q + 2, 4);
+                    uint32_t low = strtoul(hex, NULL, 16);
+                    if (low >= 0xdc00 && low < 0xe000) {
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                        q += 6;
+                    }
+                }
+                break;
+            }
+            case '\0': return -1;
+        }
+        if (out) utf8_put(out, cp);
+    }
+    if (*q != '"') return -1;
+    *p = q + 1;
+    return 0;
+}
+
+// Length of the array or object at p
+static inline size_t json_skip_nested(const char *p) {
+    const char *q = p;
+    int depth = 0;
+
+    while (*q) {
+        if (*q == '"') {
+            if (json_parse_string(&q, NULL) < 0) return strlen(p);
+            continue;
+        }
+        if (*q == '[' || *q == '{') depth++;
+        else if ((*q == ']' || *q == '}') && --depth == 0) return q + 1 - p;
+        q++;
+    }
+    return q - p;
+}
+
+// Find a top-level member; string values are decoded into out, other values
+// are copied as is (numbers) and reported as true unless they are
+// false/null/0
+static inline int json_get(const char *line, const char *key, struct buf *out, int *truthy) {
+    const char *p = strchr(line, '{');
+    if (!p) return -1;
+    p++;
+
+    while (1) {
+        while (*p == ' ' || *p == ',' || *p == '\n') p++;
+        if (*p != '"') return -1;
+
+        struct buf name = {0};
+        if (json_parse_string(&p, &name) < 0) {
+            buf_free(&name);
+            return -1;
+        }
+        int match = strcmp(buf_cstr(&name), key) == 0;
+        buf_free(&name);
+
+        while (*p == ' ' || *p == ':') p++;
+        if (*p == '"') {
+            if (json_parse_string(&p, match ? out : NULL) < 0) return -1;
+            if (match) {
+                if (truthy) *truthy = 1;
+                return 0;
+            }
+        } else {
+            size_t len = *p == '[' || *p == '{' ? json_skip_nested(p) : strcspn(p, ",}");
+            if (match) {
+                if (out) buf_append(out, p, strcspn(p, ",} \n"));
+                if (truthy) {
+                    *truthy = !(strncmp(p, "false", 5) == 0 || strncmp(p, "null", 4) == 0 ||
+                                (len == 1 && *p == '0'));
+                }
+                return 0;
+            }
+            p += len;
+        }
+        if (*p != ',') return -1;
+    }
+}
+
+#endif
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""
+Stand-in for Ollama's /api/generate, for trying xhisper's post-processing
+without a model.
+
+Answers like Ollama does with "stream": true: a chunked body of NDJSON lines,
+one token per line and --token-ms apart, then a final line with "done": true.
+The "formatting" only capitalizes the first letter and a lone "i" and ends the
+text with a period. The model "missing" gets a 404, like a model that was
+never pulled.
+
+Each request is logged to stderr with whether it came over a kept-alive
+connection and whether its system prompt matched the previous one (the part
+a real server could reuse from its prompt cache).
+"""
+
+import re
+import sys
+import json
+import time
+import argparse
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+def format_text(text):
+    text = re.sub(r"\bi\b", "I", text.strip())
+    if text and text[-1] not in ".!?":
+        text += "."
+    return text[:1].upper() + text[1:]
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    last_system = None
+
+    def setup(self):
+        super().setup()
+        self.requests = 0
+
+    def log_message(self, format, *args):
+        pass
+
+    def send_json(self, status, obj):
+        body = json.dumps(obj).encode()
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def send_chunk(self, obj):
+        data = (json.dumps(obj) + "\n").encode()
+        self.wfile.write(b"%x\r\n%s\r\n" % (len(data), data))
+        self.wfile.flush()
+
+    def do_POST(self):
+        self.requests += 1
+        length = int(self.headers.get("Content-Length", 0))
+        try:
+            req = json.loads(self.rfile.read(length))
+        except ValueError:
+            self.send_json(400, {"error": "invalid JSON"})
+            return
+        if self.path != "/api/generate":
+            self.send_json(404, {"error": "not found"})
+            return
+
+        model = req.get("model", "")
+        system = req.get("system", "")
+        cached = system == Handler.last_system
+        Handler.last_system = system
+        print(
+            f"{model}: request {self.requests} on this connection, "
+            f"system prompt {'unchanged' if cached else 'new'}: {req.get('prompt', '')!r}",
+            file=sys.stderr,
+            flush=True,
+        )
+        if model == "missing":
+            self.send_json(404, {"error": f"model '{model}' not found"})
+            return
+
+        start = time.monotonic_ns()
+        self.send_response(200)
+        self.send_header("Content-Type", "application/x-ndjson")
+        self.send_header("Transfer-Encoding", "chunked")
+        self.end_headers()
+
+        try:
+            tokens = re.findall(r"\s*\S+", format_text(req.get("prompt", "")))
+            for token in tokens:
+                time.sleep(self.server.token_ms / 1000)
+                self.send_chunk({"model": model, "response": token, "done": False})
+            self.send_chunk({
+                "model": model,
+                "response": "",
+                "done": True,
+                "done_reason": "stop",
+                "context": [1, 2, 3],
+                "total_duration": time.monotonic_ns() - start,
+                "eval_count": len(tokens),
+            })
+            self.wfile.write(b"0\r\n\r\n")
+            self.wfile.flush()
+        except (BrokenPipeError, ConnectionResetError):
+            # The client gave up (post-process-timeout): stop generating
+            print(f"{model}: cancelled by the client", file=sys.stderr, flush=True)
+            self.close_connection = True
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Serve a stand-in for Ollama's streaming /api/generate"
+    )
+    parser.add_argument(
+        "--host",
+        default="127.0.0.1",
+        help="Address to listen on (default: 127.0.0.1)",
+    )
+    parser.add_argument(
+        "--port",
+        type=int,
+        default=11434,
+        help="Port to listen on (default: 11434, Ollama's)",
+    )
+    parser.add_argument(
+        "--token-ms",
+        type=float,
+        default=30,
+        help="Delay before each token in milliseconds (default: 30)",
+    )
+    args = parser.parse_args()
+
+    server = ThreadingHTTPServer((args.host, args.port), Handler)
+    server.daemon_threads = True
+    server.token_ms = args.token_ms
+    print(f"Listening on http://{args.host}:{args.port}", file=sys.stderr, flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
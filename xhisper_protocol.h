@@ -0,0 +1,56 @@
+/*
+ * xhisper_protocol.h - sockets and wire format shared by xhispertool and
+ * the xhisper controller
+ */
+
+#ifndef XHISPER_PROTOCOL_H
+#define XHISPER_PROTOCOL_H
+
+#include <stdint.h>
+
+// Largest datagram the daemon accepts (command byte + payload)
+#define MAX_MSG 4096
+
+// Abstract socket names: queued commands, priority control (abort), and
+// the acknowledged request/response protocol
+#define SOCKET_NAME "xhisper_socket"
+#define CTL_SOCKET_NAME "xhisper_socket_ctl"
+#define SEQ_SOCKET_NAME "xhisper_socket_seq"
+
+// xhispertool record (SOCK_SEQPACKET): "stop [threshold=..] ..." is answered
+// with a levels line and the recording's memfd
+#define RECORD_SOCKET_NAME "xhisper_record"
+
+// xhisper controller (SOCK_SEQPACKET): one request, one reply line
+#define CONTROL_SOCKET_NAME "xhisper_control"
+
+// xhisper_transcribe --server: newline-delimited JSON on SOCK_STREAM. Python
+// binds the bare name, so unlike our own sockets it is not NUL-padded.
+#define TRANSCRIBE_SOCKET_NAME "xhisper_transcribe"
+
+// Framed protocol on @xhisper_socket_seq (SOCK_SEQPACKET). Each request is
+// one packet: header + the same payload as the datagram command, where
+// cmd is the datagram command byte. Each request gets exactly one response
+// packet with cmd 'A', the same id and a status; its payload, if any, is
+// a human-readable message. 'X' (abort) and 'Q' (stats) are answered
+// without queueing; the reply to 'Q' carries the statistics, as JSON when
+// its payload is "json".
+#define PROTO_VERSION 1
+
+struct frame_header {
+    uint8_t version;
+    uint8_t cmd;
+    uint16_t status;
+    uint32_t id;
+};
+
+enum status {
+    XH_OK,
+    XH_EVERSION,   // unsupported protocol version
+    XH_EUNKNOWN,   // unknown command
+    XH_EINVAL,     // malformed or invalid argument
+    XH_EABORTED,   // dropped or stopped by abort
+    XH_EIO,        // writing to uinput failed
+};
+
+#endif
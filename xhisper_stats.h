@@ -0,0 +1,55 @@
+/*
+ * xhisper_stats.h - rolling latency windows shared by xhispertoold, the
+ * xhisper controller and the typing benchmark
+ */
+
+#ifndef XHISPER_STATS_H
+#define XHISPER_STATS_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Percentiles cover the most recent samples only, so a regression shows up
+// without restarting anything
+#define STATS_WINDOW 256
+
+struct window {
+    double v[STATS_WINDOW];
+    size_t n;               // samples held, up to STATS_WINDOW
+    size_t next;            // slot the next sample overwrites
+    unsigned long total;    // samples ever added
+};
+
+static inline void window_add(struct window *w, double v) {
+    w->v[w->next] = v;
+    w->next = (w->next + 1) % STATS_WINDOW;
+    if (w->n < STATS_WINDOW) w->n++;
+    w->total++;
+}
+
+static inline int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// p50, p95 and p99 (nearest rank) of n samples, sorted in place; zeros
+// when there are none
+static inline void percentiles(double *v, size_t n, double out[3]) {
+    static const size_t pct[3] = {50, 95, 99};
+
+    qsort(v, n, sizeof(double), cmp_double);
+    for (int i = 0; i < 3; i++) {
+        size_t rank = (pct[i] * n + 99) / 100;
+        out[i] = n ? v[rank > 0 ? rank - 1 : 0] : 0;
+    }
+}
+
+static inline void window_percentiles(const struct window *w, double out[3]) {
+    double sorted[STATS_WINDOW];
+
+    memcpy(sorted, w->v, w->n * sizeof(double));
+    percentiles(sorted, w->n, out);
+}
+
+#endif
@@ -6,6 +6,7 @@ Works on any desktop including COSMIC/Wayland.
 """
 
 import gi
+import socket
 import subprocess
 import sys
 from pathlib import Path
@@ -15,12 +16,15 @@ from gi.repository import Gtk, GLib, Gdk
 
 XHISPER_DIR = Path(__file__).parent
 LOGFILE = Path("/tmp/xhisper.log")
+# The controller's abstract socket, padded like the C side binds it
+CONTROL_SOCKET = b"\0xhisper_control".ljust(108, b"\0")
 
 class XhisperToggle:
     def __init__(self):
         self.current_mode = "auto"
+        self.state = "idle"
         self.recording = False
-        self.first_run = True
+        self.sock = None
 
         # Create the window
         self.window = Gtk.Window(
@@ -74,8 +78,9 @@ class XhisperToggle:
         # Update initial state
         self.update_button()
 
-        # Check recording state periodically
-        GLib.timeout_add(500, self.check_recording_state)
+        # Follow the controller's state changes as they happen
+        if self.subscribe():
+            GLib.timeout_add_seconds(1, self.subscribe)
 
         self.window.show_all()
 
@@ -88,6 +93,12 @@ class XhisperToggle:
             context.remove_class("idle")
             context.add_class("recording")
             self.window.set_title("xhisper - Recording")
+        elif self.state in ("analyzing", "transcribing", "formatting", "typing"):
+            label = self.state.capitalize()
+            self.button.set_label(f"⏳ {label}")
+            context.remove_class("recording")
+            context.add_class("idle")
+            self.window.set_title(f"xhisper - {label}")
         else:
             mode_label = self.current_mode.capitalize()
             self.button.set_label(f"🎤 {mode_label}")
@@ -95,29 +106,72 @@ class XhisperToggle:
             context.add_class("idle")
             self.window.set_title(f"xhisper - {mode_label}")
 
-    def check_recording_state(self):
-        """Check if pw-record is running for xhisper"""
+    def subscribe(self):
+        """Subscribe to the controller's state events; returns True (retry)
+        while no controller is running"""
+        if self.sock:
+            return False
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_SEQPACKET)
         try:
-            result = subprocess.run(
-                ["pgrep", "-f", "pw-record.*xhisper.wav"],
-                capture_output=True,
-                text=True
-            )
-            was_recording = self.recording
-            self.recording = result.returncode == 0
+            sock.connect(CONTROL_SOCKET)
+            sock.send(b"subscribe")
+        except OSError:
+            sock.close()
+            return True
 
-            if was_recording != self.recording or self.first_run:
-                self.update_button()
-                self.first_run = False
-        except Exception:
-            pass
+        self.sock = sock
+        GLib.io_add_watch(
+            sock.fileno(),
+            GLib.PRIORITY_DEFAULT,
+            GLib.IO_IN | GLib.IO_HUP | GLib.IO_ERR,
+            self.on_event
+        )
+        return False
 
+    def on_event(self, fd, condition):
+        """One state event: "recording", "idle", "error <what>", ..."""
+        try:
+            event = self.sock.recv(128).decode()
+        except OSError:
+            event = ""
+
+        if not event:
+            # Controller exited: idle until one is running again
+            self.sock.close()
+            self.sock = None
+            self.set_state("idle")
+            GLib.timeout_add_seconds(1, self.subscribe)
+            return False
+
+        if event.startswith("error"):
+            print(f"xhisper: {event}")
+        else:
+            self.set_state(event)
         return True
 
+    def set_state(self, state):
+        """Show a state reported by the controller"""
+        if state != self.state:
+            self.state = state
+            self.recording = state == "recording"
+            self.update_button()
+
     def toggle_recording(self):
         """Toggle recording state"""
+        request = "toggle"
+        if self.current_mode != "auto":
+            request += f" mode={self.current_mode}"
+        try:
+            # A running controller takes the request directly
+            with socket.socket(socket.AF_UNIX, socket.SOCK_SEQPACKET) as sock:
+                sock.connect(CONTROL_SOCKET)
+                sock.send(request.encode())
+            return
+        except OSError:
+            pass
+
         try:
-            cmd = [str(XHISPER_DIR / "xhisper.sh"), "--local"]
+            cmd = [str(XHISPER_DIR / "xhisper"), "--local"]
             if self.current_mode != "auto":
                 cmd.append(f"--mode={self.current_mode}")
 
@@ -128,6 +182,9 @@ class XhisperToggle:
                 stdout=subprocess.DEVNULL,
                 stderr=subprocess.DEVNULL
             )
+            # The controller it starts listens within milliseconds; the
+            # once-a-second retry is the fallback
+            GLib.timeout_add(100, lambda: self.subscribe() and False)
         except Exception as e:
             print(f"Error: {e}")
 
@@ -0,0 +1,29 @@
+/*
+ * xhisper_trace.h - key event trace format written by xhispertoold's trace
+ * output and read by `xhispertool replay` and the typing benchmark
+ */
+
+#ifndef XHISPER_TRACE_H
+#define XHISPER_TRACE_H
+
+#include <stdint.h>
+
+// A header, then one record per input event in the order it was written.
+// Host byte order: traces are replayed on the machine that made them.
+#define TRACE_MAGIC "XHTRACE1"
+
+struct trace_header {
+    char magic[8];
+    int64_t start_ns;   // CLOCK_MONOTONIC when the trace was opened
+};
+
+// Stamped when the event's frame was handed to the output, so events of
+// one frame share a timestamp
+struct trace_event {
+    int64_t t_ns;       // CLOCK_MONOTONIC
+    uint16_t type;
+    uint16_t code;
+    int32_t value;
+};
+
+#endif
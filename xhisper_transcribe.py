@@ -2,46 +2,119 @@
 """
 xhisper transcription module using faster-whisper
 Transcribes audio files locally using Whisper models.
+
+Run with --server to keep the model loaded between dictations; the client
+mode (the default) hands the file to the server when one is running and
+transcribes in-process otherwise.
+
+--live streams audio (stdin, or --input FILE) to the server, cutting it into
+phrases at pauses so they are transcribed while recording continues;
+--collect then prints the text once the recording has stopped.
+
+--from-recorder stops a running `xhispertool record` and transcribes the
+audio it hands over as a sealed memfd, without a temp file.
 """
 
+import io
 import sys
+import os
+import json
+import mmap
+import math
+import time
+import wave
+import array
+import queue
+import base64
+import select
+import signal
+import socket
+import struct
 import argparse
 import logging
+import threading
+import collections
 from pathlib import Path
 
 # Configure logging to suppress verbose output
 logging.getLogger("faster_whisper").setLevel(logging.WARNING)
 
-def transcribe_file(
+# Abstract socket name, like xhispertoold's @xhisper_socket
+SOCKET_NAME = "\0xhisper_transcribe"
+
+# xhispertool record's socket (SOCK_SEQPACKET); the C side binds the whole
+# NUL-padded sun_path, so the name must be padded the same way
+RECORD_SOCKET_NAME = b"\0xhisper_record".ljust(108, b"\0")
+
+# Live capture: 16 kHz mono s16le in 30 ms frames
+SAMPLE_RATE = 16000
+FRAME_SECONDS = 0.03
+FRAME_BYTES = int(SAMPLE_RATE * FRAME_SECONDS) * 2
+
+# A phrase ends after this much silence, once it is at least
+# PHRASE_MIN_BYTES long; longer ones are cut regardless
+PHRASE_END_SILENCE = 0.6
+PHRASE_PRE_ROLL = 0.3
+PHRASE_MIN_BYTES = SAMPLE_RATE * 2 * 1
+PHRASE_MAX_BYTES = SAMPLE_RATE * 2 * 25
+
+# Loaded model and the (model_size, device) it was loaded with
+_model = None
+_model_key = None
+
+
+def load_model(model_size: str = "base", device: str = "auto"):
+    """
+    Return a WhisperModel, reusing the loaded one if size and device match.
+    """
+    global _model, _model_key
+
+    if _model is not None and _model_key == (model_size, device):
+        return _model
+
+    from faster_whisper import WhisperModel
+
+    # Drop the old model first so two are never resident at once
+    _model = None
+    _model_key = None
+    _model = WhisperModel(
+        model_size,
+        device=device,
+        compute_type="float16" if device == "cuda" else "int8",
+    )
+    _model_key = (model_size, device)
+    return _model
+
+
+def transcribe_segments(
     audio_path: str,
     model_size: str = "base",
     device: str = "auto",
     language: str = None,
     prompt: str = None,
-) -> str:
+):
     """
-    Transcribe an audio file using faster-whisper.
+    Transcribe an audio file using faster-whisper, yielding the text of each
+    segment as soon as it is decoded.
 
     Args:
-        audio_path: Path to the audio file (WAV, MP3, etc.)
+        audio_path: Path to the audio file (WAV, MP3, etc.), or a float32
+            array of 16 kHz samples
         model_size: Model size (tiny, base, small, medium, large-v1, large-v2, large-v3)
         device: Device to use (auto, cpu, cuda)
         language: Language code (e.g., 'en', 'es') or None for auto-detect
         prompt: Optional context text for better accuracy
 
-    Returns:
-        Transcribed text
+    Yields:
+        Segment text with whitespace cleaned up, empty segments skipped
     """
-    from faster_whisper import WhisperModel
+    # Nothing left after trimming: no speech
+    if not isinstance(audio_path, str) and len(audio_path) == 0:
+        return
 
-    # Initialize model
-    model = WhisperModel(
-        model_size,
-        device=device,
-        compute_type="float16" if device == "cuda" else "int8",
-    )
+    model = load_model(model_size, device)
 
-    # Transcribe
+    # Transcribe (segments is a generator: decoding happens as we iterate)
     segments, info = model.transcribe(
         audio_path,
         language=language,
@@ -50,20 +123,677 @@ def transcribe_file(
         vad_filter=True,  # Voice activity detection to remove silence
     )
 
-    # Combine all segments
-    text = " ".join(segment.text for segment in segments)
+    for segment in segments:
+        text = " ".join(segment.text.split())
+        if text:
+            yield text
+
+
+def transcribe_file(
+    audio_path: str,
+    model_size: str = "base",
+    device: str = "auto",
+    language: str = None,
+    prompt: str = None,
+) -> str:
+    """
+    Transcribe an audio file using faster-whisper.
+
+    Takes the same arguments as transcribe_segments().
+
+    Returns:
+        Transcribed text
+    """
+    return " ".join(
+        transcribe_segments(audio_path, model_size, device, language, prompt)
+    )
+
+
+def log(message: str):
+    print(f"xhisper_transcribe: {message}", file=sys.stderr, flush=True)
+
+
+def ensure_model(model_size: str, device: str) -> float:
+    """
+    Load the requested model if it is not the resident one (hold _model_lock).
+    Returns the seconds spent loading, 0 if it was resident.
+    """
+    if _model_key == (model_size, device):
+        return 0.0
+    start = time.monotonic()
+    load_model(model_size, device)
+    elapsed = time.monotonic() - start
+    log(f"loaded {model_size} on {device} in {elapsed:.2f}s")
+    return elapsed
+
+
+def pcm_to_audio(pcm: bytes):
+    """
+    Convert 16 kHz mono s16le PCM to the float32 array faster-whisper takes.
+    """
+    import numpy as np
+
+    return np.frombuffer(pcm, dtype=np.int16).astype(np.float32) / 32768.0
+
+
+def load_raw(path: str, raw: str):
+    """
+    Read a raw 16 kHz mono PCM file (f32 or s16le, as written by
+    xhispertool trim) straight into the array faster-whisper takes.
+    """
+    import numpy as np
+
+    if raw == "f32":
+        return np.fromfile(path, dtype=np.float32)
+    return np.fromfile(path, dtype=np.int16).astype(np.float32) / 32768.0
+
+
+def load_memfd(fd: int):
+    """
+    Map a sealed memfd of 16 kHz mono s16le PCM (from xhispertool record)
+    and convert it to the array faster-whisper takes.
+    """
+    import numpy as np
+
+    size = os.fstat(fd).st_size
+    if size == 0:
+        return np.zeros(0, dtype=np.float32)
+    with mmap.mmap(fd, size, prot=mmap.PROT_READ) as pcm:
+        return np.frombuffer(pcm, dtype=np.int16).astype(np.float32) / 32768.0
+
+
+class LiveSession:
+    """
+    Phrases transcribed while a live recording is still running.
+    """
+
+    def __init__(self):
+        self.texts = []
+        self.done = False
+        self.silent = False
+        self.cond = threading.Condition()
+
+
+# The live recording in progress or waiting to be collected
+_live = None
+_live_lock = threading.Lock()
+
+# One decode at a time; connections are served from their own threads
+_model_lock = threading.Lock()
+
+
+def send_line(conn: socket.socket, message: dict):
+    conn.sendall(json.dumps(message).encode() + b"\n")
+
+
+def serve_file(request: dict, conn: socket.socket, fds: list) -> dict:
+    model_size = request.get("model", "base")
+    device = request.get("device", "auto")
+    audio = request.get("audio")
+    if request.get("memfd") and fds:
+        audio = "recording"
+
+    with _model_lock:
+        load = ensure_model(model_size, device)
+
+        # No audio: the client only wanted the model loaded
+        if audio is None:
+            return {"loaded": True}
+
+        start = time.monotonic()
+        first = None
+        if request.get("memfd") and fds:
+            samples = load_memfd(fds[0])
+        elif request.get("raw"):
+            samples = load_raw(audio, request["raw"])
+        else:
+            samples = audio
+        texts = []
+        for text in transcribe_segments(
+            samples,
+            model_size=model_size,
+            device=device,
+            language=request.get("language") or None,
+            prompt=request.get("prompt") or None,
+        ):
+            if first is None:
+                first = time.monotonic() - start
+            # Streaming clients get each segment as soon as it is decoded
+            if request.get("stream"):
+                if not texts:
+                    log(f"first segment after {first:.2f}s")
+                send_line(conn, {"segment": text})
+            texts.append(text)
+    decode = time.monotonic() - start
+    log(f"transcribed {audio} in {decode:.2f}s")
+    # Stage timings for the controller's spans
+    response = {
+        "text": " ".join(texts),
+        "load_s": round(load, 4),
+        "decode_s": round(decode, 4),
+        "first_segment_s": round(first or decode, 4),
+    }
+    if not isinstance(samples, str):
+        response["audio_s"] = round(len(samples) / 16000, 3)
+    return response
+
+
+def serve_live(request: dict, reader) -> dict:
+    """
+    Transcribe phrases as the live client sends them, until it sends "end".
+    """
+    global _live
+
+    session = LiveSession()
+    with _live_lock:
+        _live = session
+
+    model_size = request.get("model", "base")
+    device = request.get("device", "auto")
+    silent = False
+
+    try:
+        # Load (or reload) while the user is already speaking
+        with _model_lock:
+            ensure_model(model_size, device)
+
+        for line in reader:
+            message = json.loads(line)
+            if message.get("end"):
+                silent = bool(message.get("silent"))
+                break
+
+            pcm = base64.b64decode(message["pcm"])
+            # The tail of what was said so far keeps phrases consistent
+            context = " ".join(session.texts)[-200:]
+            prompt = " ".join(p for p in (request.get("prompt"), context) if p)
+
+            start = time.monotonic()
+            with _model_lock:
+                ensure_model(model_size, device)
+                text = transcribe_file(
+                    pcm_to_audio(pcm),
+                    model_size=model_size,
+                    device=device,
+                    language=request.get("language") or None,
+                    prompt=prompt or None,
+                )
+            log(f"live phrase {len(pcm) / (SAMPLE_RATE * 2):.1f}s "
+                f"transcribed in {time.monotonic() - start:.2f}s")
 
-    # Clean up extra whitespace
-    text = " ".join(text.split())
+            with session.cond:
+                if text:
+                    session.texts.append(text)
+    finally:
+        with session.cond:
+            session.done = True
+            session.silent = silent
+            session.cond.notify_all()
 
-    return text
+    return {"phrases": len(session.texts)}
+
+
+def collect_live(timeout: float, conn: socket.socket, stream: bool) -> dict:
+    """
+    Wait for the live recording to finish and hand over its text (once).
+    Streaming clients get each phrase as soon as it is transcribed.
+    """
+    global _live
+
+    with _live_lock:
+        session = _live
+    if session is None:
+        return {"error": "no live recording"}
+
+    sent = 0
+    deadline = time.monotonic() + timeout
+    with session.cond:
+        while True:
+            ready = lambda: session.done or (stream and len(session.texts) > sent)
+            if not session.cond.wait_for(ready, deadline - time.monotonic()):
+                return {"error": "timed out waiting for the live recording"}
+            if stream and not session.silent:
+                for text in session.texts[sent:]:
+                    send_line(conn, {"segment": text})
+                sent = len(session.texts)
+            if session.done:
+                break
+
+    with _live_lock:
+        if _live is session:
+            _live = None
+    return {"text": " ".join(session.texts), "silent": session.silent}
+
+
+class PrefixedSocketIO(io.RawIOBase):
+    """
+    Socket reads that first return bytes already received with recv_fds().
+    """
+
+    def __init__(self, conn: socket.socket, prefix: bytes):
+        self.conn = conn
+        self.prefix = prefix
+
+    def readable(self):
+        return True
+
+    def readinto(self, buf):
+        if self.prefix:
+            n = min(len(buf), len(self.prefix))
+            buf[:n] = self.prefix[:n]
+            self.prefix = self.prefix[n:]
+            return n
+        return self.conn.recv_into(buf)
+
+
+def handle_connection(conn: socket.socket):
+    """
+    Serve one connection: a JSON request line, then one JSON response line.
+    The request may carry a file descriptor (a recording's memfd).
+    """
+    fds = []
+    try:
+        data, fds, _, _ = socket.recv_fds(conn, 65536, 1)
+    except OSError as e:
+        log(f"error: {e}")
+        conn.close()
+        return
+
+    with conn, io.BufferedReader(PrefixedSocketIO(conn, data)) as reader:
+        line = reader.readline()
+        if not line:
+            for fd in fds:
+                os.close(fd)
+            return
+
+        try:
+            request = json.loads(line)
+            if request.get("live"):
+                response = serve_live(request, reader)
+            elif request.get("collect"):
+                response = collect_live(
+                    request.get("timeout", 300), conn, bool(request.get("stream"))
+                )
+            else:
+                response = serve_file(request, conn, fds)
+        except Exception as e:
+            log(f"error: {e}")
+            response = {"error": str(e)}
+        finally:
+            for fd in fds:
+                os.close(fd)
+
+        try:
+            send_line(conn, response)
+        except OSError:
+            pass
+
+
+def run_server(model_size: str, device: str):
+    """
+    Serve transcription requests on the abstract socket.
+    """
+    server = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        server.bind(SOCKET_NAME)
+    except OSError as e:
+        log(f"failed to bind socket: {e}")
+        sys.exit(1)
+
+    # Clients that connect while the model loads wait in the backlog
+    server.listen(8)
+    with _model_lock:
+        ensure_model(model_size, device)
+
+    while True:
+        conn, _ = server.accept()
+        threading.Thread(target=handle_connection, args=(conn,), daemon=True).start()
+
+
+def connect_server(wait: float = 0):
+    """
+    Connect to the server, retrying for up to `wait` seconds while it starts.
+    """
+    deadline = time.monotonic() + wait
+    while True:
+        client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            client.connect(SOCKET_NAME)
+            return client
+        except OSError:
+            client.close()
+            if time.monotonic() >= deadline:
+                return None
+            time.sleep(0.05)
+
+
+def read_response(client: socket.socket, on_segment=None) -> dict:
+    """
+    Read the final response line, passing "segment" lines to on_segment.
+    """
+    with client.makefile("rb") as reader:
+        for line in reader:
+            response = json.loads(line)
+            if "segment" not in response:
+                return response
+            if on_segment:
+                on_segment(response["segment"])
+    raise RuntimeError("transcription server closed the connection")
+
+
+def request_server(request: dict, on_segment=None, fd: int = None):
+    """
+    Send a request (and optionally a file descriptor) to the running server.
+    Returns the response, or None if no server is listening.
+    """
+    client = connect_server()
+    if client is None:
+        return None
+
+    with client:
+        if fd is None:
+            send_line(client, request)
+        else:
+            socket.send_fds(client, [json.dumps(request).encode() + b"\n"], [fd])
+        return read_response(client, on_segment)
+
+
+def print_segment(text: str):
+    print(text, flush=True)
+
+
+def to_db(level: float) -> float:
+    return 20 * math.log10(level / 32768) if level > 0 else -120.0
+
+
+def frame_levels(frame: bytes):
+    """
+    RMS and peak level of a s16le frame in dBFS.
+    """
+    samples = array.array("h", frame)
+    if sys.byteorder == "big":
+        samples.byteswap()
+    if not samples:
+        return -120.0, -120.0
+    rms = math.sqrt(sum(x * x for x in samples) / len(samples))
+    peak = max(-min(samples), max(samples))
+    return to_db(rms), to_db(peak)
+
+
+def read_frames(fd: int, stopping, realtime: bool = False):
+    """
+    Yield FRAME_BYTES chunks of 16 kHz mono s16le audio from fd, which holds
+    either raw PCM or a WAV stream. Stops at EOF or once stopping() is true.
+    """
+    buf = b""
+    header_checked = False
+    started = time.monotonic()
+    frames = 0
+
+    while not stopping():
+        ready, _, _ = select.select([fd], [], [], 0.1)
+        if not ready:
+            continue
+        chunk = os.read(fd, 65536)
+        if not chunk:
+            break
+        buf += chunk
+
+        if not header_checked:
+            if len(buf) < 12:
+                continue
+            if buf[:4] == b"RIFF":
+                # Skip the header; the data chunk runs to the end of the stream
+                pos = buf.find(b"data")
+                if pos < 0:
+                    continue
+                if b"fmt " in buf[:pos]:
+                    fmt = buf.index(b"fmt ")
+                    channels, rate = struct.unpack_from("<HI", buf, fmt + 10)
+                    bits = struct.unpack_from("<H", buf, fmt + 22)[0]
+                    if (channels, rate, bits) != (1, SAMPLE_RATE, 16):
+                        raise ValueError(
+                            f"need 16 kHz mono 16-bit audio, got {rate} Hz, "
+                            f"{channels} channel(s), {bits}-bit"
+                        )
+                buf = buf[pos + 8:]
+            header_checked = True
+
+        while len(buf) >= FRAME_BYTES:
+            yield buf[:FRAME_BYTES]
+            buf = buf[FRAME_BYTES:]
+            frames += 1
+            if realtime:
+                # Pace a file source like a live microphone
+                lag = started + frames * FRAME_SECONDS - time.monotonic()
+                if lag > 0:
+                    time.sleep(lag)
+
+    if header_checked and len(buf) >= 2:
+        yield buf[:len(buf) - len(buf) % 2]
+
+
+def run_live(args) -> int:
+    """
+    Read audio, cut it into phrases at pauses and send each finished phrase
+    to the server while recording continues. SIGTERM/SIGINT end the
+    recording: the last phrase is flushed before exiting.
+    """
+    stop = []
+    signal.signal(signal.SIGTERM, lambda *_: stop.append(True))
+    signal.signal(signal.SIGINT, lambda *_: stop.append(True))
+
+    if args.input and args.input != "-":
+        source = open(args.input, "rb")
+    else:
+        source = sys.stdin.buffer
+
+    client = connect_server(wait=5)
+    if client is None:
+        print("Error: transcription server is not running", file=sys.stderr)
+        return 2
+
+    send_line(client, {
+        "live": True,
+        "model": args.model,
+        "device": args.device,
+        "language": args.language,
+        "prompt": args.prompt,
+    })
+
+    # Sending happens off the read loop so a busy decoder never stalls capture
+    outbox = queue.Queue()
+
+    def sender():
+        while True:
+            message = outbox.get()
+            if message is None:
+                return
+            send_line(client, message)
+
+    sending = threading.Thread(target=sender, daemon=True)
+    sending.start()
+
+    save = None
+    if args.save:
+        save = wave.open(args.save, "wb")
+        save.setnchannels(1)
+        save.setsampwidth(2)
+        save.setframerate(SAMPLE_RATE)
+
+    threshold = args.vad_threshold
+    end_frames = int(PHRASE_END_SILENCE / FRAME_SECONDS)
+    pre_roll = collections.deque(maxlen=int(PHRASE_PRE_ROLL / FRAME_SECONDS))
+    phrase = bytearray()
+    silence_run = 0
+    peak_max = -120.0
+    phrases = 0
+    started = time.monotonic()
+
+    def flush():
+        nonlocal phrase, phrases
+        if phrase:
+            outbox.put({"pcm": base64.b64encode(bytes(phrase)).decode()})
+            phrases += 1
+            log(f"phrase {phrases}: {len(phrase) / (SAMPLE_RATE * 2):.1f}s "
+                f"at {time.monotonic() - started:.1f}s")
+        phrase = bytearray()
+
+    try:
+        for frame in read_frames(source.fileno(), lambda: stop, args.realtime):
+            if save:
+                save.writeframes(frame)
+            rms, peak = frame_levels(frame)
+            peak_max = max(peak_max, peak)
+
+            if rms >= threshold:
+                if not phrase:
+                    phrase.extend(b"".join(pre_roll))
+                    pre_roll.clear()
+                phrase.extend(frame)
+                silence_run = 0
+            elif phrase:
+                phrase.extend(frame)
+                silence_run += 1
+                if silence_run >= end_frames and len(phrase) >= PHRASE_MIN_BYTES:
+                    flush()
+            else:
+                pre_roll.append(frame)
+
+            if len(phrase) >= PHRASE_MAX_BYTES:
+                flush()
+    except ValueError as e:
+        print(f"Error: {e}", file=sys.stderr)
+    finally:
+        flush()
+        if save:
+            save.close()
+        outbox.put({"end": True, "silent": peak_max < args.silence_threshold})
+        outbox.put(None)
+        sending.join()
+
+    response = read_response(client)
+    client.close()
+    if "error" in response:
+        print(f"Error during transcription: {response['error']}", file=sys.stderr)
+        return 1
+
+    # A file source is a self-contained run: print the result as well
+    if args.input:
+        return run_collect(args.stream)
+    return 0
+
+
+def run_collect(stream: bool = False) -> int:
+    """
+    Print the text of the live recording once it has finished (or each
+    phrase as it is transcribed, one per line, with stream); exit 4 if it
+    was silent.
+    """
+    try:
+        response = request_server(
+            {"collect": True, "stream": stream},
+            print_segment if stream else None,
+        )
+    except Exception as e:
+        print(f"Error during transcription: {e}", file=sys.stderr)
+        return 1
+    if response is None:
+        print("Error: transcription server is not running", file=sys.stderr)
+        return 2
+    if "error" in response:
+        print(f"Error during transcription: {response['error']}", file=sys.stderr)
+        return 1
+    if response.get("silent"):
+        return 4
+    if not stream:
+        print(response["text"])
+    return 0
+
+
+def stop_recorder(args):
+    """
+    Stop xhispertool record. Returns its levels line and the memfd holding
+    the (trimmed) s16le audio, or None if no recording is running.
+    """
+    client = socket.socket(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+    with client:
+        try:
+            client.connect(RECORD_SOCKET_NAME)
+        except OSError:
+            return None
+        client.send(
+            f"stop threshold={args.silence_threshold} "
+            f"percentage={args.silence_percentage} trim={int(args.trim)}".encode()
+        )
+        message, fds, _, _ = socket.recv_fds(client, 256, 1)
+    if not fds:
+        raise RuntimeError("recorder sent no audio")
+    return message.decode(), fds[0]
+
+
+def run_from_recorder(args) -> int:
+    """
+    Stop the recorder and transcribe its audio; exit 4 if it was silent.
+    """
+    try:
+        stopped = stop_recorder(args)
+    except Exception as e:
+        print(f"Error stopping the recording: {e}", file=sys.stderr)
+        return 1
+    if stopped is None:
+        print("Error: no recording is running", file=sys.stderr)
+        return 2
+
+    levels, fd = stopped
+    try:
+        if "verdict=silent" in levels.split():
+            return 4
+
+        response = None
+        if not args.no_server:
+            response = request_server({
+                "memfd": "s16",
+                "model": args.model,
+                "device": args.device,
+                "language": args.language,
+                "prompt": args.prompt,
+                "stream": args.stream,
+            }, print_segment if args.stream else None, fd)
+        if response is not None:
+            if "error" in response:
+                raise RuntimeError(response["error"])
+            if not args.stream:
+                print(response["text"])
+            return 0
+
+        segments = transcribe_segments(
+            load_memfd(fd),
+            model_size=args.model,
+            device=args.device,
+            language=args.language,
+            prompt=args.prompt,
+        )
+        if args.stream:
+            for text in segments:
+                print_segment(text)
+        else:
+            print(" ".join(segments))
+        return 0
+    except Exception as e:
+        print(f"Error during transcription: {e}", file=sys.stderr)
+        return 1
+    finally:
+        os.close(fd)
 
 
 def main():
     parser = argparse.ArgumentParser(
         description="Transcribe audio files using faster-whisper"
     )
-    parser.add_argument("audio_file", help="Path to audio file to transcribe")
+    parser.add_argument(
+        "audio_file", nargs="?", help="Path to audio file to transcribe"
+    )
     parser.add_argument(
         "--model",
         default="base",
@@ -84,6 +814,82 @@ def main():
         "--prompt",
         help="Context words for better accuracy",
     )
+    parser.add_argument(
+        "--server",
+        action="store_true",
+        help="Keep the model loaded and serve requests on a Unix socket",
+    )
+    parser.add_argument(
+        "--preload",
+        action="store_true",
+        help="Ask the running server to load --model/--device and exit",
+    )
+    parser.add_argument(
+        "--live",
+        action="store_true",
+        help="Transcribe phrases while recording (audio on stdin or --input)",
+    )
+    parser.add_argument(
+        "--input",
+        help="Live audio source: WAV or raw 16 kHz mono s16le file, - for stdin",
+    )
+    parser.add_argument(
+        "--realtime",
+        action="store_true",
+        help="Read --input at recording speed, like a live microphone",
+    )
+    parser.add_argument(
+        "--save",
+        help="Also write the live audio to this WAV file",
+    )
+    parser.add_argument(
+        "--vad-threshold",
+        type=float,
+        default=-50,
+        help="Frame level in dB that counts as speech (default: -50)",
+    )
+    parser.add_argument(
+        "--silence-threshold",
+        type=float,
+        default=-50,
+        help="Peak level in dB below which a recording is silent (default: -50)",
+    )
+    parser.add_argument(
+        "--silence-percentage",
+        type=float,
+        default=95,
+        help="Percent of silent frames that makes a recording silent (default: 95)",
+    )
+    parser.add_argument(
+        "--from-recorder",
+        action="store_true",
+        help="Stop xhispertool record and transcribe its audio (exit 4 if silent)",
+    )
+    parser.add_argument(
+        "--trim",
+        action="store_true",
+        help="With --from-recorder: have the recorder trim silence first",
+    )
+    parser.add_argument(
+        "--collect",
+        action="store_true",
+        help="Print the live recording's text once it has stopped (exit 4 if silent)",
+    )
+    parser.add_argument(
+        "--raw",
+        choices=["f32", "s16"],
+        help="audio_file is raw 16 kHz mono PCM (e.g. from xhispertool trim)",
+    )
+    parser.add_argument(
+        "--stream",
+        action="store_true",
+        help="Print each segment on its own line as soon as it is decoded",
+    )
+    parser.add_argument(
+        "--no-server",
+        action="store_true",
+        help="Always transcribe in this process",
+    )
     parser.add_argument(
         "--debug",
         action="store_true",
@@ -95,20 +901,72 @@ def main():
     if args.debug:
         logging.getLogger("faster_whisper").setLevel(logging.DEBUG)
 
+    if args.server:
+        run_server(args.model, args.device)
+        return
+
+    if args.live:
+        sys.exit(run_live(args))
+
+    if args.collect:
+        sys.exit(run_collect(args.stream))
+
+    if args.from_recorder:
+        sys.exit(run_from_recorder(args))
+
+    if args.preload:
+        try:
+            response = request_server({"model": args.model, "device": args.device})
+        except Exception as e:
+            print(f"Error during preload: {e}", file=sys.stderr)
+            sys.exit(1)
+        if response is None:
+            print("Error: transcription server is not running", file=sys.stderr)
+            sys.exit(2)
+        return
+
+    if not args.audio_file:
+        parser.error("audio_file is required unless --server is given")
+
     # Check if audio file exists
     if not Path(args.audio_file).exists():
         print(f"Error: Audio file not found: {args.audio_file}", file=sys.stderr)
         sys.exit(1)
 
     try:
-        result = transcribe_file(
-            args.audio_file,
+        response = None
+        if not args.no_server:
+            response = request_server({
+                "audio": os.path.abspath(args.audio_file),
+                "model": args.model,
+                "device": args.device,
+                "language": args.language,
+                "prompt": args.prompt,
+                "raw": args.raw,
+                "stream": args.stream,
+            }, print_segment if args.stream else None)
+        if response is not None:
+            if "error" in response:
+                raise RuntimeError(response["error"])
+            if not args.stream:
+                print(response["text"])
+            return
+
+        audio = args.audio_file
+        if args.raw:
+            audio = load_raw(audio, args.raw)
+        segments = transcribe_segments(
+            audio,
             model_size=args.model,
             device=args.device,
             language=args.language,
             prompt=args.prompt,
         )
-        print(result)
+        if args.stream:
+            for text in segments:
+                print_segment(text)
+        else:
+            print(" ".join(segments))
     except Exception as e:
         print(f"Error during transcription: {e}", file=sys.stderr)
         sys.exit(1)
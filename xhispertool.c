@@ -3,16 +3,36 @@
  * Combined daemon and client for text input via uinput
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <math.h>
 #include <libgen.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/sendfile.h>
+#include <sys/inotify.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <linux/netlink.h>
 #include <linux/uinput.h>
 #define KEY_LEFTCTRL 29
 #define KEY_RIGHTCTRL 97
@@ -21,183 +41,801 @@
 #define KEY_LEFTSHIFT 42
 #define KEY_RIGHTSHIFT 54
 #define KEY_LEFTMETA 125
-#define KEY_V 47
-#define FLAG_UPPERCASE 0x80000000
+#include "keymaps.h"
+#include "xhisper_json.h"
+#include "xhisper_protocol.h"
+#include "xhisper_stats.h"
+#include "xhisper_trace.h"
+
+// Events buffered before a forced flush to uinput
+#define EVBUF_MAX 64
+
+// Longest wait for udev to announce the new uinput device
+#define UINPUT_SETTLE_MS 1000
+
+// Longest `xhispertool start` waits for the daemon to report ready
+#define START_WAIT_MS 5000
+
+// Longest timing profile name accepted over the socket
+#define PROFILE_NAME_MAX 32
+
+// Commands waiting for the typing worker before the socket is paused
+#define QUEUE_MAX 64
+
+// Level analysis frame length (milliseconds)
+#define FRAME_MS 30
+
+// Recorder: capture format and buffer limit
+#define RECORD_RATE 16000
+#define RECORD_MAX_SECONDS 600
+#define RECORD_CLIENTS 4   // connected, request not read yet
+
+// Connections accepted on the seqpacket socket
+#define MAX_CLIENTS 16
+
+// Acks held for a client that isn't reading them before it is dropped
+#define UNSENT_MAX (64 * 1024)
+
+// Hotkeys (--hotkey), keys per chord, and keyboards watched for them
+#define HOTKEY_MAX 4
+#define CHORD_MAX 4
+#define HOTKEY_DEVICES_MAX 16
+
+// Longest typing waits for the chord's keys to be released
+#define HOTKEY_RELEASE_WAIT_MS 1000
+
+static const char *status_names[] = {
+    [XH_OK] = "ok",
+    [XH_EVERSION] = "unsupported protocol version",
+    [XH_EUNKNOWN] = "unknown command",
+    [XH_EINVAL] = "invalid argument",
+    [XH_EABORTED] = "aborted",
+    [XH_EIO] = "uinput write failed",
+};
 
 // Function prototypes
 void cleanup(void);
 void emit(int type, int code, int val);
+int flush_events(void);
+void wait_us(useconds_t us);
+void pace_begin(void);
+void pace_end(void);
 void do_paste(void);
 void type_char(unsigned char c);
+void type_unicode(uint32_t cp);
+void type_string(const char *s, size_t len);
 void do_backspace(void);
+void do_backspaces(int count);
 void do_key(int keycode);
 int setup_uinput(void);
 int setup_socket(void);
-int run_daemon(void);
+void *typing_worker(void *arg);
+int run_daemon(int argc, char *argv[]);
 void show_usage(void);
 int run_client(int argc, char *argv[]);
 
-// ASCII to Linux keycode mapping for US QWERTY layout
-// Independently derived from:
-// - ASCII character set specification (characters 0-127)
-// - Linux input-event-codes.h KEY_* constants
-// - US QWERTY keyboard physical layout
-// Each entry maps an ASCII code to either:
-//   -1 (unmapped/unsupported)
-//   KEY_* constant for unshifted characters
-//   KEY_* | FLAG_UPPERCASE for shifted characters
-static const int32_t ascii2keycode_map[128] = {
-	// Control characters (0x00-0x1f): mostly unmapped except tab and enter
-	-1,-1,-1,-1,-1,-1,-1,-1,  // 0x00-0x07
-	-1,KEY_TAB,KEY_ENTER,-1,-1,-1,-1,-1,  // 0x08-0x0f (tab=0x09, enter=0x0a)
-	-1,-1,-1,-1,-1,-1,-1,-1,  // 0x10-0x17
-	-1,-1,-1,-1,-1,-1,-1,-1,  // 0x18-0x1f
-
-	// Printable characters (0x20-0x7e)
-	// Space and symbols (0x20-0x2f)
-	KEY_SPACE,                      // 0x20 ' '
-	KEY_1|FLAG_UPPERCASE,           // 0x21 '!' (shift+1)
-	KEY_APOSTROPHE|FLAG_UPPERCASE,  // 0x22 '"' (shift+')
-	KEY_3|FLAG_UPPERCASE,           // 0x23 '#' (shift+3)
-	KEY_4|FLAG_UPPERCASE,           // 0x24 '$' (shift+4)
-	KEY_5|FLAG_UPPERCASE,           // 0x25 '%' (shift+5)
-	KEY_7|FLAG_UPPERCASE,           // 0x26 '&' (shift+7)
-	KEY_APOSTROPHE,                 // 0x27 '''
-	KEY_9|FLAG_UPPERCASE,           // 0x28 '(' (shift+9)
-	KEY_0|FLAG_UPPERCASE,           // 0x29 ')' (shift+0)
-	KEY_8|FLAG_UPPERCASE,           // 0x2a '*' (shift+8)
-	KEY_EQUAL|FLAG_UPPERCASE,       // 0x2b '+' (shift+=)
-	KEY_COMMA,                      // 0x2c ','
-	KEY_MINUS,                      // 0x2d '-'
-	KEY_DOT,                        // 0x2e '.'
-	KEY_SLASH,                      // 0x2f '/'
-
-	// Digits (0x30-0x39)
-	KEY_0,KEY_1,KEY_2,KEY_3,KEY_4,KEY_5,KEY_6,KEY_7,KEY_8,KEY_9,
-
-	// More symbols (0x3a-0x40)
-	KEY_SEMICOLON|FLAG_UPPERCASE,   // 0x3a ':' (shift+;)
-	KEY_SEMICOLON,                  // 0x3b ';'
-	KEY_COMMA|FLAG_UPPERCASE,       // 0x3c '<' (shift+,)
-	KEY_EQUAL,                      // 0x3d '='
-	KEY_DOT|FLAG_UPPERCASE,         // 0x3e '>' (shift+.)
-	KEY_SLASH|FLAG_UPPERCASE,       // 0x3f '?' (shift+/)
-	KEY_2|FLAG_UPPERCASE,           // 0x40 '@' (shift+2)
-
-	// Uppercase letters (0x41-0x5a): A-Z
-	KEY_A|FLAG_UPPERCASE,KEY_B|FLAG_UPPERCASE,KEY_C|FLAG_UPPERCASE,KEY_D|FLAG_UPPERCASE,
-	KEY_E|FLAG_UPPERCASE,KEY_F|FLAG_UPPERCASE,KEY_G|FLAG_UPPERCASE,KEY_H|FLAG_UPPERCASE,
-	KEY_I|FLAG_UPPERCASE,KEY_J|FLAG_UPPERCASE,KEY_K|FLAG_UPPERCASE,KEY_L|FLAG_UPPERCASE,
-	KEY_M|FLAG_UPPERCASE,KEY_N|FLAG_UPPERCASE,KEY_O|FLAG_UPPERCASE,KEY_P|FLAG_UPPERCASE,
-	KEY_Q|FLAG_UPPERCASE,KEY_R|FLAG_UPPERCASE,KEY_S|FLAG_UPPERCASE,KEY_T|FLAG_UPPERCASE,
-	KEY_U|FLAG_UPPERCASE,KEY_V|FLAG_UPPERCASE,KEY_W|FLAG_UPPERCASE,KEY_X|FLAG_UPPERCASE,
-	KEY_Y|FLAG_UPPERCASE,KEY_Z|FLAG_UPPERCASE,
-
-	// Brackets and symbols (0x5b-0x60)
-	KEY_LEFTBRACE,                  // 0x5b '['
-	KEY_BACKSLASH,                  // 0x5c '\'
-	KEY_RIGHTBRACE,                 // 0x5d ']'
-	KEY_6|FLAG_UPPERCASE,           // 0x5e '^' (shift+6)
-	KEY_MINUS|FLAG_UPPERCASE,       // 0x5f '_' (shift+-)
-	KEY_GRAVE,                      // 0x60 '`'
-
-	// Lowercase letters (0x61-0x7a): a-z
-	KEY_A,KEY_B,KEY_C,KEY_D,KEY_E,KEY_F,KEY_G,KEY_H,
-	KEY_I,KEY_J,KEY_K,KEY_L,KEY_M,KEY_N,KEY_O,KEY_P,
-	KEY_Q,KEY_R,KEY_S,KEY_T,KEY_U,KEY_V,KEY_W,KEY_X,
-	KEY_Y,KEY_Z,
-
-	// Final symbols (0x7b-0x7e)
-	KEY_LEFTBRACE|FLAG_UPPERCASE,   // 0x7b '{' (shift+[)
-	KEY_BACKSLASH|FLAG_UPPERCASE,   // 0x7c '|' (shift+\)
-	KEY_RIGHTBRACE|FLAG_UPPERCASE,  // 0x7d '}' (shift+])
-	KEY_GRAVE|FLAG_UPPERCASE,       // 0x7e '~' (shift+`)
-
-	-1  // 0x7f DEL (unmapped)
+// Keyboard layout the compositor uses for the virtual keyboard; the tables
+// come from keymaps/*.map via gen_keymaps.py. keymaps[0] is US QWERTY.
+static const struct keymap *layout = &keymaps[0];
+
+// Typing timing profiles (microseconds per phase)
+// - hold: key press to key release
+// - gap: key release to the next key press
+// - shift: shift press to the shifted key
+// - ctrl: ctrl press to V when pasting
+struct timing_profile {
+    const char *name;
+    useconds_t hold;
+    useconds_t gap;
+    useconds_t shift;
+    useconds_t ctrl;
+};
+
+static const struct timing_profile timing_profiles[] = {
+    {"safe",  8000, 2000, 2000, 8000},  // original constants, works everywhere
+    {"fast",  4000, 1000, 1000, 4000},  // terminals and most editors
+    {"burst", 1000,  250,  250, 2000},  // apps that keep up with raw input
 };
 
+#define NUM_PROFILES (sizeof(timing_profiles) / sizeof(timing_profiles[0]))
+
+static const struct timing_profile *timing = &timing_profiles[0];
+
+// How type_string() handles non-ASCII characters
+// - UNICODE_CLIPBOARD: skip them, the caller pastes them via the clipboard
+// - UNICODE_HEX: Ctrl+Shift+U <hex> Space (GTK and IBus input methods)
+enum unicode_method {
+    UNICODE_CLIPBOARD,
+    UNICODE_HEX,
+};
+
+static const char *unicode_method_names[] = {
+    [UNICODE_CLIPBOARD] = "clipboard",
+    [UNICODE_HEX] = "ctrl-shift-u",
+};
+
+static enum unicode_method unicode_method = UNICODE_CLIPBOARD;
+
+// Output backends: where flushed key events go
+// - uinput: the virtual keyboard the desktop reads
+// - trace:<file>: binary trace with monotonic timestamps (xhisper_trace.h),
+//   for `xhispertool replay` and for tests without /dev/uinput
+// - null: discarded, to time the typing engine without the kernel
+struct output {
+    const char *name;
+    int (*open)(const char *arg);
+    int (*write)(const struct input_event *ev, size_t n);  // all or -1
+    void (*close)(void);
+};
+
+static int uinput_open(const char *arg);
+static int uinput_write(const struct input_event *ev, size_t n);
+static void uinput_close(void);
+static int trace_open(const char *path);
+static int trace_write(const struct input_event *ev, size_t n);
+static void trace_close(void);
+static int null_open(const char *arg);
+static int null_write(const struct input_event *ev, size_t n);
+static void null_close(void);
+
+static const struct output outputs[] = {
+    {"uinput", uinput_open, uinput_write, uinput_close},
+    {"trace", trace_open, trace_write, trace_close},
+    {"null", null_open, null_write, null_close},
+};
+
+#define NUM_OUTPUTS (sizeof(outputs) / sizeof(outputs[0]))
+
+static const struct output *output = &outputs[0];
+
 static int fd_uinput = -1;
+static int fd_trace = -1;
 static int fd_socket = -1;
+static int fd_ctl = -1;
+static int fd_seq = -1;
+static int fd_wake = -1;  // eventfd: worker tells main the queue has room
 
-void cleanup() {
-    if (fd_uinput >= 0) {
-        ioctl(fd_uinput, UI_DEV_DESTROY);
-        close(fd_uinput);
+// Readiness: whoever started the daemon reads --notify-fd until READY=1 (or
+// EOF if startup failed); systemd passes $NOTIFY_SOCKET for Type=notify
+static int fd_notify = -1;
+static struct timespec daemon_started;
+static double output_ms;
+
+// Seqpacket connections; serial guards acks against fd reuse after close
+struct client {
+    int fd;
+    unsigned serial;
+    uint32_t events;        // armed in epoll (main thread)
+    int hung_up;            // taken out of epoll while reads were paused
+    char *unsent;           // acks waiting for room: u16 length, packet
+    size_t unsent_len;
+};
+
+static struct client clients[MAX_CLIENTS];
+static unsigned client_serial = 0;
+
+// Bounded command queue between the socket loop and the typing worker
+struct command {
+    char buf[MAX_MSG];
+    ssize_t len;
+    unsigned long gen;          // abort generation when queued
+    struct timespec queued;
+    int client;                 // clients[] slot to ack, -1 for datagrams
+    unsigned client_serial;
+    uint32_t id;
+};
+
+static struct command cmd_queue[QUEUE_MAX];
+static size_t queue_head = 0;
+static size_t queue_len = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+// Abort bumps the generation; the worker stops any command from an older one
+static atomic_ulong abort_gen;
+
+// Frames read from clients while the queue is full, so an abort sent behind
+// them is still seen: a held header then the message, packed; main thread
+// only. A megabyte covers far more than a client's socket buffer holds.
+#define READAHEAD_MAX (1024 * 1024)
+
+struct held {
+    int client;
+    unsigned client_serial;
+    uint32_t id;
+    uint16_t len;
+};
+
+static char readahead_buf[READAHEAD_MAX];
+static size_t readahead_start = 0;
+static size_t readahead_end = 0;
+static unsigned long current_gen;
+
+static struct {
+    size_t max_depth;
+    unsigned long paused;
+    unsigned long dropped;
+} queue_stats;
+
+// Pending events; flushed with a single write() before every pause
+static struct input_event evbuf[EVBUF_MAX];
+static size_t evbuf_len = 0;
+
+// Emission counters, reset per command
+static struct {
+    unsigned long events;
+    unsigned long writes;
+    unsigned long eagain;
+    unsigned long errors;
+} emit_stats;
+
+// Totals and rolling windows per kind of typing command, for `stats`
+struct cmd_stats {
+    const char *name;
+    const char *cmds;           // command bytes counted here
+    unsigned long count;
+    unsigned long aborted;
+    unsigned long failed;
+    unsigned long long bytes;
+    unsigned long long events;
+    unsigned long long writes;  // write() calls to uinput
+    unsigned long long sleeps;  // paced waits
+    unsigned long long eagain;
+    struct window queue_us;     // queued until the worker took it
+    struct window exec_us;
+    struct window chars_per_s;  // 's' and 'b' only
+};
+
+static struct cmd_stats cmd_stats[] = {
+    {.name = "string", .cmds = "s"},
+    {.name = "backspace", .cmds = "b"},
+    {.name = "paste", .cmds = "p"},
+    {.name = "char", .cmds = "t"},
+    {.name = "key", .cmds = "rLCRSTM"},
+};
+
+#define NUM_CMD_STATS (sizeof(cmd_stats) / sizeof(cmd_stats[0]))
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct timing_profile *find_profile(const char *name, size_t len) {
+    for (size_t i = 0; i < NUM_PROFILES; i++) {
+        if (strlen(timing_profiles[i].name) == len &&
+            strncmp(timing_profiles[i].name, name, len) == 0) {
+            return &timing_profiles[i];
+        }
+    }
+    return NULL;
+}
+
+// Key pacing: each wait_us() sleeps until an absolute deadline on
+// CLOCK_MONOTONIC, so oversleeping one phase is absorbed by the next instead
+// of accumulating. A phase is never shortened below half its nominal length
+// so a late wakeup cannot squeeze a press/release pair together.
+static struct timespec pace_deadline;
+static int pace_active = 0;
+static int pace_realtime = 0;  // --realtime: raise priority while typing
+static int pace_saved_policy;  // scheduling to return to in pace_end()
+static struct sched_param pace_saved_param;
+static int pace_saved_nice;
+
+static struct {
+    unsigned long waits;
+    unsigned long clamped;
+    int64_t late_total_ns;
+    int64_t late_max_ns;
+} pace_stats;
+
+static int64_t ts_ns(const struct timespec *ts) {
+    return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static struct timespec ns_ts(int64_t ns) {
+    struct timespec ts = {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000};
+    return ts;
+}
+
+static double ms_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (ts_ns(&now) - ts_ns(start)) / 1e6;
+}
+
+static int find_unicode_method(const char *name, size_t len) {
+    for (int i = UNICODE_CLIPBOARD; i <= UNICODE_HEX; i++) {
+        if (strlen(unicode_method_names[i]) == len &&
+            strncmp(unicode_method_names[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static const struct keymap *find_layout(const char *name, size_t len) {
+    for (size_t i = 0; i < NUM_KEYMAPS; i++) {
+        if (strlen(keymaps[i].name) == len &&
+            strncmp(keymaps[i].name, name, len) == 0) {
+            return &keymaps[i];
+        }
     }
+    return NULL;
+}
+
+// Non-ASCII character with a direct key on the current layout, or -1
+static int32_t find_extra(uint32_t cp) {
+    size_t lo = 0, hi = layout->n_extra;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (layout->extra[mid].cp == cp) return layout->extra[mid].kdef;
+        if (layout->extra[mid].cp < cp) lo = mid + 1;
+        else hi = mid;
+    }
+    return -1;
+}
+
+void cleanup() {
+    output->close();
     if (fd_socket >= 0) {
         close(fd_socket);
     }
+    if (fd_ctl >= 0) {
+        close(fd_ctl);
+    }
+    if (fd_seq >= 0) {
+        close(fd_seq);
+    }
 }
 
 void emit(int type, int code, int val) {
+    if (evbuf_len == EVBUF_MAX) flush_events();
+
     struct input_event ie = {
         .type = type,
         .code = code,
         .value = val
     };
-    write(fd_uinput, &ie, sizeof(ie));
+    evbuf[evbuf_len++] = ie;
+    emit_stats.events++;
+}
+
+// Hand all buffered events to the output in one write
+int flush_events() {
+    size_t n = evbuf_len;
+
+    evbuf_len = 0;
+    if (n > 0 && output->write(evbuf, n) < 0) {
+        emit_stats.errors++;
+        return -1;
+    }
+    return 0;
+}
+
+// Resume after partial writes and wait for the non-blocking uinput fd to
+// become writable on EAGAIN
+static int uinput_write(const struct input_event *ev, size_t n) {
+    const char *p = (const char *)ev;
+    size_t left = n * sizeof(struct input_event);
+    int stalls = 0;
+
+    while (left > 0) {
+        ssize_t written = write(fd_uinput, p, left);
+        emit_stats.writes++;
+        if (written > 0) {
+            p += written;
+            left -= written;
+            continue;
+        }
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && stalls++ < 50) {
+            struct pollfd pfd = {.fd = fd_uinput, .events = POLLOUT};
+            emit_stats.eagain++;
+            poll(&pfd, 1, 10);
+            continue;
+        }
+        perror("failed to write to uinput");
+        return -1;
+    }
+    return 0;
+}
+
+static void uinput_close(void) {
+    if (fd_uinput >= 0) {
+        ioctl(fd_uinput, UI_DEV_DESTROY);
+        close(fd_uinput);
+        fd_uinput = -1;
+    }
+}
+
+static int trace_open(const char *path) {
+    if (!path || !*path) {
+        fprintf(stderr, "Error: the trace output needs a file (trace:<file>)\n");
+        return -1;
+    }
+    fd_trace = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_trace < 0) {
+        fprintf(stderr, "failed to open trace %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct trace_header hdr = {.magic = TRACE_MAGIC};
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    hdr.start_ns = ts_ns(&now);
+    if (write(fd_trace, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        perror("failed to write trace");
+        return -1;
+    }
+    return 0;
+}
+
+// One write per frame, so a reader on a FIFO gets whole records
+static int trace_write(const struct input_event *ev, size_t n) {
+    struct trace_event rec[EVBUF_MAX];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (size_t i = 0; i < n; i++) {
+        rec[i] = (struct trace_event){ts_ns(&now), ev[i].type, ev[i].code, ev[i].value};
+    }
+
+    const char *p = (const char *)rec;
+    size_t left = n * sizeof(rec[0]);
+    while (left > 0) {
+        ssize_t w = write(fd_trace, p, left);
+        emit_stats.writes++;
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) {
+            perror("failed to write trace");
+            return -1;
+        }
+        p += w;
+        left -= w;
+    }
+    return 0;
+}
+
+static void trace_close(void) {
+    if (fd_trace >= 0) {
+        close(fd_trace);
+        fd_trace = -1;
+    }
+}
+
+static int null_open(const char *arg) {
+    if (arg) {
+        fprintf(stderr, "Error: the null output takes no argument\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int null_write(const struct input_event *ev, size_t n) {
+    (void)ev;
+    (void)n;
+    return 0;
+}
+
+static void null_close(void) {
+}
+
+// "name" or "name:arg"; opens the backend and makes it the output
+static int open_output(const char *spec) {
+    size_t len = strcspn(spec, ":");
+    const char *arg = spec[len] ? spec + len + 1 : NULL;
+
+    for (size_t i = 0; i < NUM_OUTPUTS; i++) {
+        if (strlen(outputs[i].name) == len && strncmp(outputs[i].name, spec, len) == 0) {
+            output = &outputs[i];
+            return output->open(arg);
+        }
+    }
+    fprintf(stderr, "Error: Unknown output '%.*s' (uinput, trace:<file>, null)\n", (int)len, spec);
+    return -1;
+}
+
+// End the current key frame: flush it, then hold for the given time
+void wait_us(useconds_t us) {
+    flush_events();
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!pace_active) {
+        pace_deadline = now;
+    }
+
+    int64_t deadline = ts_ns(&pace_deadline) + (int64_t)us * 1000;
+    int64_t earliest = ts_ns(&now) + (int64_t)us * 500;
+    if (deadline < earliest) {
+        deadline = earliest;
+        pace_stats.clamped++;
+    }
+    pace_deadline = ns_ts(deadline);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &pace_deadline, NULL) == EINTR);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t late = ts_ns(&now) - deadline;
+    pace_stats.waits++;
+    pace_stats.late_total_ns += late;
+    if (late > pace_stats.late_max_ns) pace_stats.late_max_ns = late;
+}
+
+// Start a paced run: deadlines chain from now until pace_end()
+void pace_begin() {
+    memset(&pace_stats, 0, sizeof(pace_stats));
+    clock_gettime(CLOCK_MONOTONIC, &pace_deadline);
+    pace_active = 1;
+
+    if (pace_realtime) {
+        pace_saved_policy = sched_getscheduler(0);
+        sched_getparam(0, &pace_saved_param);
+        errno = 0;
+        pace_saved_nice = getpriority(PRIO_PROCESS, 0);
+        if (pace_saved_nice == -1 && errno) pace_saved_nice = 0;
+
+        struct sched_param sp = {.sched_priority = 10};
+        if (sched_setscheduler(0, SCHED_FIFO, &sp) < 0 &&
+            setpriority(PRIO_PROCESS, 0, -10) < 0) {
+            perror("xhispertoold: failed to raise priority");
+            pace_realtime = 0;
+        }
+    }
+}
+
+void pace_end() {
+    flush_events();
+    pace_active = 0;
+
+    if (pace_realtime) {
+        if (pace_saved_policy >= 0) sched_setscheduler(0, pace_saved_policy, &pace_saved_param);
+        setpriority(PRIO_PROCESS, 0, pace_saved_nice);
+    }
 }
 
 void do_paste() {
+    // Shortcuts follow the layout: Ctrl+V is wherever 'v' is
+    uint16_t key_v = layout->ascii['v'] & 0xffff;
+
     emit(EV_KEY, KEY_LEFTCTRL, 1);
     emit(EV_SYN, SYN_REPORT, 0);
-    usleep(8000);
-    emit(EV_KEY, KEY_V, 1);
+    wait_us(timing->ctrl);
+    emit(EV_KEY, key_v, 1);
     emit(EV_SYN, SYN_REPORT, 0);
-    usleep(8000);
-    emit(EV_KEY, KEY_V, 0);
+    wait_us(timing->hold);
+    emit(EV_KEY, key_v, 0);
     emit(EV_SYN, SYN_REPORT, 0);
-    usleep(2000);
+    wait_us(timing->gap);
     emit(EV_KEY, KEY_LEFTCTRL, 0);
     emit(EV_SYN, SYN_REPORT, 0);
 }
 
-void type_char(unsigned char c) {
-    if (c >= 128) return;
-
-    int32_t kdef = ascii2keycode_map[c];
-    if (kdef == -1) return;
-
+// Press one key definition: shift and/or AltGr around the key, and a space
+// after a dead key so it produces its own character
+static void type_kdef(int32_t kdef) {
     uint16_t keycode = kdef & 0xffff;
 
+    if (kdef & FLAG_ALTGR) {
+        emit(EV_KEY, KEY_RIGHTALT, 1);
+        emit(EV_SYN, SYN_REPORT, 0);
+        wait_us(timing->shift);
+    }
     if (kdef & FLAG_UPPERCASE) {
         emit(EV_KEY, KEY_LEFTSHIFT, 1);
         emit(EV_SYN, SYN_REPORT, 0);
-        usleep(2000);
+        wait_us(timing->shift);
     }
 
     emit(EV_KEY, keycode, 1);
     emit(EV_SYN, SYN_REPORT, 0);
-    usleep(8000);
+    wait_us(timing->hold);
 
     emit(EV_KEY, keycode, 0);
     emit(EV_SYN, SYN_REPORT, 0);
-    usleep(2000);
+    wait_us(timing->gap);
 
     if (kdef & FLAG_UPPERCASE) {
         emit(EV_KEY, KEY_LEFTSHIFT, 0);
         emit(EV_SYN, SYN_REPORT, 0);
     }
+    if (kdef & FLAG_ALTGR) {
+        emit(EV_KEY, KEY_RIGHTALT, 0);
+        emit(EV_SYN, SYN_REPORT, 0);
+    }
+
+    if (kdef & FLAG_DEAD) {
+        if (kdef & (FLAG_UPPERCASE | FLAG_ALTGR)) wait_us(timing->gap);
+        type_kdef(layout->ascii[' ']);
+    }
+}
+
+void type_char(unsigned char c) {
+    if (c >= 128) return;
+
+    int32_t kdef = layout->ascii[c];
+    if (kdef == -1) return;
+
+    type_kdef(kdef);
+}
+
+// Checked between characters so an abort never leaves a key held down
+static int aborted(void) {
+    return atomic_load(&abort_gen) != current_gen;
+}
+
+// Decode one UTF-8 sequence; returns bytes consumed, *cp = 0 if malformed
+static size_t utf8_decode(const char *s, size_t len, uint32_t *cp) {
+    const unsigned char *u = (const unsigned char *)s;
+    size_t need;
+
+    if (u[0] < 0x80) {
+        *cp = u[0];
+        return 1;
+    } else if ((u[0] & 0xe0) == 0xc0) {
+        *cp = u[0] & 0x1f;
+        need = 2;
+    } else if ((u[0] & 0xf0) == 0xe0) {
+        *cp = u[0] & 0x0f;
+        need = 3;
+    } else if ((u[0] & 0xf8) == 0xf0) {
+        *cp = u[0] & 0x07;
+        need = 4;
+    } else {
+        *cp = 0;
+        return 1;
+    }
+
+    if (need > len) {
+        *cp = 0;
+        return len;
+    }
+    for (size_t i = 1; i < need; i++) {
+        if ((u[i] & 0xc0) != 0x80) {
+            *cp = 0;
+            return i;
+        }
+        *cp = (*cp << 6) | (u[i] & 0x3f);
+    }
+    return need;
+}
+
+// Enter a code point with the Ctrl+Shift+U hex sequence
+void type_unicode(uint32_t cp) {
+    static const char hex[] = "0123456789abcdef";
+    uint16_t key_u = layout->ascii['u'] & 0xffff;
+    char digits[8];
+    int n = 0;
+
+    do {
+        digits[n++] = hex[cp & 0xf];
+        cp >>= 4;
+    } while (cp && n < (int)sizeof(digits));
+
+    emit(EV_KEY, KEY_LEFTCTRL, 1);
+    emit(EV_KEY, KEY_LEFTSHIFT, 1);
+    emit(EV_SYN, SYN_REPORT, 0);
+    wait_us(timing->ctrl);
+    emit(EV_KEY, key_u, 1);
+    emit(EV_SYN, SYN_REPORT, 0);
+    wait_us(timing->hold);
+    emit(EV_KEY, key_u, 0);
+    emit(EV_SYN, SYN_REPORT, 0);
+    wait_us(timing->gap);
+    emit(EV_KEY, KEY_LEFTSHIFT, 0);
+    emit(EV_KEY, KEY_LEFTCTRL, 0);
+    emit(EV_SYN, SYN_REPORT, 0);
+    wait_us(timing->gap);
+
+    while (n > 0) {
+        type_char(digits[--n]);
+    }
+    type_char(' ');
+}
+
+// Type a UTF-8 string; non-ASCII characters the layout has no key for are
+// entered as hex codes, or skipped when the caller pastes them via the
+// clipboard
+void type_string(const char *s, size_t len) {
+    size_t i = 0;
+    while (i < len && !aborted()) {
+        uint32_t cp;
+        int32_t kdef;
+        i += utf8_decode(s + i, len - i, &cp);
+
+        if (cp < 128) {
+            type_char(cp);
+        } else if ((kdef = find_extra(cp)) != -1) {
+            type_kdef(kdef);
+        } else if (unicode_method == UNICODE_HEX) {
+            type_unicode(cp);
+        }
+    }
 }
 
 void do_backspace() {
     emit(EV_KEY, KEY_BACKSPACE, 1);
     emit(EV_SYN, SYN_REPORT, 0);
-    usleep(8000);
+    wait_us(timing->hold);
     emit(EV_KEY, KEY_BACKSPACE, 0);
     emit(EV_SYN, SYN_REPORT, 0);
 }
 
+void do_backspaces(int count) {
+    for (int i = 0; i < count && !aborted(); i++) {
+        if (i > 0) wait_us(timing->gap);
+        do_backspace();
+    }
+}
+
+// Parse an optional decimal repeat count from a message payload (default 1)
+static int parse_count(const char *s, size_t len) {
+    if (len == 0) return 1;
+
+    int count = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') return 0;
+        count = count * 10 + (s[i] - '0');
+        if (count > 100000) return 0;
+    }
+    return count;
+}
+
 void do_key(int keycode) {
     emit(EV_KEY, keycode, 1);
     emit(EV_SYN, SYN_REPORT, 0);
-    usleep(8000);
+    wait_us(timing->hold);
     emit(EV_KEY, keycode, 0);
     emit(EV_SYN, SYN_REPORT, 0);
 }
 
+// libinput (and so the compositor) learns about a new device from udev once
+// its rules have run; listen for that instead of sleeping. -1 without udev,
+// where nothing would pick the device up later anyway.
+static int udev_monitor_open(void) {
+    if (access("/run/udev/control", F_OK) < 0) return -1;
+
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    struct sockaddr_nl addr = {.nl_family = AF_NETLINK, .nl_groups = 2};  // udev, not kernel
+    if (fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Wait for udev's "add" of the event node under /sys/.../<sysname>
+static int udev_wait_added(int fd, const char *sysname, int timeout_ms) {
+    char match[80];
+    snprintf(match, sizeof(match), "/%s/event", sysname);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int remaining = timeout_ms;
+    while (remaining > 0) {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (poll(&pfd, 1, remaining) <= 0) break;
+
+        // Properties are NUL-separated KEY=VALUE strings after a binary header
+        char buf[8192];
+        ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+        if (n > 0) {
+            buf[n] = '\0';
+            int add = 0, ours = 0;
+            for (char *p = buf; p < buf + n; p += strlen(p) + 1) {
+                if (strcmp(p, "ACTION=add") == 0) add = 1;
+                else if (strncmp(p, "DEVPATH=", 8) == 0 && strstr(p, match)) ours = 1;
+            }
+            if (add && ours) return 0;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        remaining = timeout_ms - (int)((ts_ns(&now) - ts_ns(&start)) / 1000000);
+    }
+    return -1;
+}
+
 int setup_uinput() {
-    fd_uinput = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    fd_uinput = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
     if (fd_uinput < 0) {
         perror("failed to open /dev/uinput");
         return -1;
@@ -229,6 +867,7 @@ int setup_uinput() {
     ioctl(fd_uinput, UI_SET_KEYBIT, KEY_TAB);
     ioctl(fd_uinput, UI_SET_KEYBIT, KEY_ENTER);
     ioctl(fd_uinput, UI_SET_KEYBIT, KEY_BACKSPACE);
+    ioctl(fd_uinput, UI_SET_KEYBIT, KEY_102ND);  // ISO key left of Z
 
     // Register modifiers
     ioctl(fd_uinput, UI_SET_KEYBIT, KEY_LEFTCTRL);
@@ -249,18 +888,36 @@ int setup_uinput() {
         perror("failed to setup uinput device");
         return -1;
     }
+    int fd_udev = udev_monitor_open();
     if (ioctl(fd_uinput, UI_DEV_CREATE) < 0) {
         perror("failed to create uinput device");
+        if (fd_udev >= 0) close(fd_udev);
         return -1;
     }
 
-    usleep(100000);
+    // Typing before the compositor has opened the device loses keys
+    char sysname[64];
+    if (fd_udev >= 0 && ioctl(fd_uinput, UI_GET_SYSNAME(sizeof(sysname)), sysname) >= 0) {
+        if (udev_wait_added(fd_udev, sysname, UINPUT_SETTLE_MS) < 0) {
+            fprintf(stderr, "xhispertoold: udev did not announce %s within %d ms\n",
+                    sysname, UINPUT_SETTLE_MS);
+        }
+    }
+    if (fd_udev >= 0) close(fd_udev);
     return 0;
 }
 
-int setup_socket() {
-    fd_socket = socket(AF_UNIX, SOCK_DGRAM, 0);
-    if (fd_socket < 0) {
+static int uinput_open(const char *arg) {
+    if (arg) {
+        fprintf(stderr, "Error: the uinput output takes no argument\n");
+        return -1;
+    }
+    return setup_uinput();
+}
+
+static int bind_socket(const char *name, int type) {
+    int fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
         perror("failed to create socket");
         return -1;
     }
@@ -269,64 +926,2260 @@ int setup_socket() {
     // First byte is null, no filesystem entry, kernel manages lifecycle
     struct sockaddr_un addr = {.sun_family = AF_UNIX};
     addr.sun_path[0] = '\0';
-    strncpy(addr.sun_path + 1, "xhisper_socket", sizeof(addr.sun_path) - 2);
+    strncpy(addr.sun_path + 1, name, sizeof(addr.sun_path) - 2);
 
-    if (bind(fd_socket, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         if (errno == EADDRINUSE) {
             fprintf(stderr, "xhispertoold is already running\n");
         } else {
             perror("failed to bind socket");
         }
+        close(fd);
         return -1;
     }
 
-    return 0;
+    return fd;
 }
 
-// Daemon mode
-int run_daemon() {
-    atexit(cleanup);
+int setup_socket() {
+    fd_socket = bind_socket(SOCKET_NAME, SOCK_DGRAM);
+    if (fd_socket < 0) return -1;
 
-    if (setup_uinput() < 0) {
-        return 1;
+    fd_ctl = bind_socket(CTL_SOCKET_NAME, SOCK_DGRAM);
+    if (fd_ctl < 0) return -1;
+
+    fd_seq = bind_socket(SEQ_SOCKET_NAME, SOCK_SEQPACKET | SOCK_NONBLOCK);
+    if (fd_seq < 0) return -1;
+    if (listen(fd_seq, MAX_CLIENTS) < 0) {
+        perror("failed to listen on socket");
+        return -1;
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
     }
 
-    if (setup_socket() < 0) {
-        return 1;
+    fd_wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd_wake < 0) {
+        perror("failed to create eventfd");
+        return -1;
     }
 
-    printf("xhispertoold: listening on @xhisper_socket\n");
+    return 0;
+}
 
-    char buf[2];
-    while (1) {
-        ssize_t n = recv(fd_socket, buf, sizeof(buf), 0);
-        if (n >= 1) {
-            char cmd = buf[0];
-            if (cmd == 'p') {
-                do_paste();
-            } else if (cmd == 't' && n == 2) {
-                type_char((unsigned char)buf[1]);
-            } else if (cmd == 'b') {
-                do_backspace();
-            } else if (cmd == 'r') {
-                do_key(KEY_RIGHTALT);
-            } else if (cmd == 'L') {
-                do_key(KEY_LEFTALT);
-            } else if (cmd == 'C') {
-                do_key(KEY_LEFTCTRL);
-            } else if (cmd == 'R') {
-                do_key(KEY_RIGHTCTRL);
-            } else if (cmd == 'S') {
-                do_key(KEY_LEFTSHIFT);
-            } else if (cmd == 'T') {
-                do_key(KEY_RIGHTSHIFT);
-            } else if (cmd == 'M') {
-                do_key(KEY_LEFTMETA);
-            }
-        }
+// Reply to a seqpacket request with a message; caller holds queue_lock
+static void send_reply_locked(int slot, unsigned serial, uint32_t id, int status, const char *msg) {
+    if (slot < 0 || clients[slot].fd < 0 || clients[slot].serial != serial) return;
+
+    struct frame_header hdr = {
+        .version = PROTO_VERSION,
+        .cmd = 'A',
+        .status = status,
+        .id = id,
+    };
+    struct iovec iov[2] = {
+        {.iov_base = &hdr, .iov_len = sizeof(hdr)},
+        {.iov_base = (void *)msg, .iov_len = strlen(msg)},
+    };
+    struct msghdr mh = {.msg_iov = iov, .msg_iovlen = 2};
+    struct client *cl = &clients[slot];
+
+    // Never block the caller on a client that stopped reading: keep the
+    // ack, in order behind any others, until the socket has room
+    if (!cl->unsent_len && sendmsg(cl->fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0) return;
+    if (!cl->unsent_len && errno != EAGAIN && errno != EWOULDBLOCK) {
+        if (errno != EPIPE && errno != ECONNRESET) perror("xhispertoold: failed to send ack");
+        return;
     }
 
-    return 0;
+    uint16_t len = sizeof(hdr) + iov[1].iov_len;
+    if (cl->unsent_len + sizeof(len) + len > UNSENT_MAX) {
+        fprintf(stderr, "xhispertoold: client not reading its acks, disconnecting it\n");
+        shutdown(cl->fd, SHUT_RDWR);
+        free(cl->unsent);
+        cl->unsent = NULL;
+        cl->unsent_len = 0;
+        return;
+    }
+    char *unsent = realloc(cl->unsent, cl->unsent_len + sizeof(len) + len);
+    if (!unsent) return;
+    cl->unsent = unsent;
+    memcpy(unsent + cl->unsent_len, &len, sizeof(len));
+    memcpy(unsent + cl->unsent_len + sizeof(len), &hdr, sizeof(hdr));
+    memcpy(unsent + cl->unsent_len + sizeof(len) + sizeof(hdr), msg, iov[1].iov_len);
+    cl->unsent_len += sizeof(len) + len;
+
+    // The main loop arms EPOLLOUT for it
+    uint64_t one = 1;
+    write(fd_wake, &one, sizeof(one));
+}
+
+// Send held acks while the client's socket has room (main thread)
+static void flush_acks(int slot) {
+    pthread_mutex_lock(&queue_lock);
+    struct client *cl = &clients[slot];
+    size_t off = 0;
+    if (!cl->unsent_len) {
+        pthread_mutex_unlock(&queue_lock);
+        return;
+    }
+    while (off < cl->unsent_len) {
+        uint16_t len;
+        memcpy(&len, cl->unsent + off, sizeof(len));
+        if (send(cl->fd, cl->unsent + off + sizeof(len), len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            off = cl->unsent_len;   // gone: nobody left to tell
+            break;
+        }
+        off += sizeof(len) + len;
+    }
+    memmove(cl->unsent, cl->unsent + off, cl->unsent_len - off);
+    cl->unsent_len -= off;
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static void send_ack_locked(int slot, unsigned serial, uint32_t id, int status) {
+    send_reply_locked(slot, serial, id, status, status_names[status]);
+}
+
+static void send_ack(int slot, unsigned serial, uint32_t id, int status) {
+    if (slot < 0) return;
+    pthread_mutex_lock(&queue_lock);
+    send_ack_locked(slot, serial, id, status);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// Characters a command types: UTF-8 sequences for 's', the count for 'b'
+static long typed_chars(char cmd, const char *payload, ssize_t len) {
+    if (cmd == 'b') return parse_count(payload, len);
+    long chars = 0;
+    for (ssize_t i = 0; cmd == 's' && i < len; i++) {
+        if (((unsigned char)payload[i] & 0xc0) != 0x80) chars++;
+    }
+    return chars;
+}
+
+static void record_stats(const struct command *c, int status, const struct timespec *start) {
+    char cmd = c->buf[0];
+    struct cmd_stats *st = NULL;
+    for (size_t i = 0; i < NUM_CMD_STATS; i++) {
+        if (strchr(cmd_stats[i].cmds, cmd)) st = &cmd_stats[i];
+    }
+    if (!st) return;
+
+    struct timespec done;
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    double exec_us = (ts_ns(&done) - ts_ns(start)) / 1e3;
+    long chars = typed_chars(cmd, c->buf + 1, c->len - 1);
+
+    pthread_mutex_lock(&stats_lock);
+    st->count++;
+    if (status == XH_EABORTED) st->aborted++;
+    else if (status != XH_OK) st->failed++;
+    st->bytes += c->len - 1;
+    st->events += emit_stats.events;
+    st->writes += emit_stats.writes;
+    st->sleeps += pace_stats.waits;
+    st->eagain += emit_stats.eagain;
+    window_add(&st->queue_us, (ts_ns(start) - ts_ns(&c->queued)) / 1e3);
+    window_add(&st->exec_us, exec_us);
+    if (status == XH_OK && chars > 0 && exec_us > 0) window_add(&st->chars_per_s, chars * 1e6 / exec_us);
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static int execute_command(const struct command *c, size_t depth) {
+    const char *buf = c->buf;
+    ssize_t n = c->len;
+    char cmd = buf[0];
+    int status = XH_OK;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    memset(&emit_stats, 0, sizeof(emit_stats));
+    pace_begin();
+    if (cmd == 'p') {
+        do_paste();
+    } else if (cmd == 't') {
+        if (n == 2) {
+            type_char((unsigned char)buf[1]);
+        } else {
+            status = XH_EINVAL;
+        }
+    } else if (cmd == 's') {
+        type_string(buf + 1, n - 1);
+    } else if (cmd == 'b') {
+        int count = parse_count(buf + 1, n - 1);
+        if (count > 0) {
+            do_backspaces(count);
+        } else {
+            status = XH_EINVAL;
+        }
+    } else if (cmd == 'W') {
+        // Sync: nothing to do, the ack tells the caller the queue got here
+    } else if (cmd == 'P') {
+        const struct timing_profile *p = find_profile(buf + 1, n - 1);
+        if (p) {
+            timing = p;
+        } else {
+            fprintf(stderr, "xhispertoold: unknown timing profile '%.*s'\n",
+                    (int)(n - 1), buf + 1);
+            status = XH_EINVAL;
+        }
+    } else if (cmd == 'U') {
+        int method = find_unicode_method(buf + 1, n - 1);
+        if (method >= 0) {
+            unicode_method = method;
+        } else {
+            fprintf(stderr, "xhispertoold: unknown unicode method '%.*s'\n",
+                    (int)(n - 1), buf + 1);
+            status = XH_EINVAL;
+        }
+    } else if (cmd == 'K') {
+        const struct keymap *k = find_layout(buf + 1, n - 1);
+        if (k) {
+            layout = k;
+        } else {
+            fprintf(stderr, "xhispertoold: unknown keyboard layout '%.*s'\n",
+                    (int)(n - 1), buf + 1);
+            status = XH_EINVAL;
+        }
+    } else if (cmd == 'r') {
+        do_key(KEY_RIGHTALT);
+    } else if (cmd == 'L') {
+        do_key(KEY_LEFTALT);
+    } else if (cmd == 'C') {
+        do_key(KEY_LEFTCTRL);
+    } else if (cmd == 'R') {
+        do_key(KEY_RIGHTCTRL);
+    } else if (cmd == 'S') {
+        do_key(KEY_LEFTSHIFT);
+    } else if (cmd == 'T') {
+        do_key(KEY_RIGHTSHIFT);
+    } else if (cmd == 'M') {
+        do_key(KEY_LEFTMETA);
+    } else {
+        status = XH_EUNKNOWN;
+    }
+    pace_end();
+
+    if (status == XH_OK && emit_stats.errors) status = XH_EIO;
+    if (status == XH_OK && aborted()) status = XH_EABORTED;
+    record_stats(c, status, &start);
+
+    if (cmd == 's' || cmd == 'b') {
+        fprintf(stderr, "xhispertoold: '%c' %zd bytes%s: %lu events, %lu writes, %lu EAGAIN, "
+                "jitter avg %ldus max %ldus (%lu clamped), queued %ldus, depth %zu\n",
+                cmd, n - 1, status == XH_EABORTED ? " (aborted)" : "",
+                emit_stats.events, emit_stats.writes, emit_stats.eagain,
+                pace_stats.waits ? (long)(pace_stats.late_total_ns / pace_stats.waits / 1000) : 0L,
+                (long)(pace_stats.late_max_ns / 1000), pace_stats.clamped,
+                (long)((ts_ns(&start) - ts_ns(&c->queued)) / 1000), depth);
+    }
+    return status;
+}
+
+// Hotkey: a chord on a physical keyboard toggles dictation via the
+// xhisper controller, without the desktop running a command
+struct hotkey {
+    uint16_t keys[CHORD_MAX];
+    int nkeys;
+    char mode[16];          // passed as --mode=, empty for the configured one
+};
+
+static struct hotkey hotkeys[HOTKEY_MAX];
+static int num_hotkeys = 0;
+
+static struct {
+    int fd;
+    char path[32];
+} hotkey_devs[HOTKEY_DEVICES_MAX];
+
+static const char *hotkey_paths[HOTKEY_DEVICES_MAX];  // --hotkey-device, else scan
+static int num_hotkey_paths = 0;
+static int fd_inotify = -1;
+
+static unsigned char keys_down[KEY_MAX / 8 + 1];  // main thread only
+static atomic_int chord_keys_held;                 // read by the typing worker
+
+static const struct {
+    const char *name;
+    uint16_t code;
+} key_names[] = {
+    {"ctrl", KEY_LEFTCTRL}, {"leftctrl", KEY_LEFTCTRL}, {"rightctrl", KEY_RIGHTCTRL},
+    {"alt", KEY_LEFTALT}, {"leftalt", KEY_LEFTALT}, {"rightalt", KEY_RIGHTALT},
+    {"shift", KEY_LEFTSHIFT}, {"leftshift", KEY_LEFTSHIFT}, {"rightshift", KEY_RIGHTSHIFT},
+    {"super", KEY_LEFTMETA}, {"rightsuper", KEY_RIGHTMETA},
+    {"space", KEY_SPACE}, {"enter", KEY_ENTER}, {"tab", KEY_TAB}, {"esc", KEY_ESC},
+    {"insert", KEY_INSERT}, {"pause", KEY_PAUSE}, {"scrolllock", KEY_SCROLLLOCK},
+    {"menu", KEY_COMPOSE},
+};
+
+// Key name: one of key_names, f1-f12, or a letter/digit (US positions)
+static int parse_key(const char *name, size_t len) {
+    for (size_t i = 0; i < sizeof(key_names) / sizeof(key_names[0]); i++) {
+        if (strlen(key_names[i].name) == len && strncmp(key_names[i].name, name, len) == 0) {
+            return key_names[i].code;
+        }
+    }
+    if (len == 1 && ((name[0] >= 'a' && name[0] <= 'z') || (name[0] >= '0' && name[0] <= '9'))) {
+        return keymaps[0].ascii[(unsigned char)name[0]] & 0xffff;
+    }
+    if ((len == 2 || len == 3) && name[0] == 'f') {
+        int n = atoi(name + 1);
+        if (n >= 1 && n <= 10) return KEY_F1 + n - 1;
+        if (n == 11 || n == 12) return KEY_F11 + n - 11;
+    }
+    return -1;
+}
+
+// "<key>+<key>...[:<mode>]", e.g. leftalt+leftshift+d:command
+static int parse_hotkey(const char *spec) {
+    if (num_hotkeys == HOTKEY_MAX) {
+        fprintf(stderr, "Error: at most %d hotkeys\n", HOTKEY_MAX);
+        return -1;
+    }
+    struct hotkey *h = &hotkeys[num_hotkeys];
+    memset(h, 0, sizeof(*h));
+
+    size_t chord_len = strcspn(spec, ":");
+    if (spec[chord_len] == ':') snprintf(h->mode, sizeof(h->mode), "%s", spec + chord_len + 1);
+
+    const char *p = spec;
+    while (p < spec + chord_len) {
+        size_t len = strcspn(p, "+:");
+        int code = parse_key(p, len);
+        if (code < 0 || h->nkeys == CHORD_MAX) {
+            fprintf(stderr, "Error: bad hotkey '%s' (%s)\n", spec,
+                    code < 0 ? "unknown key" : "too many keys");
+            return -1;
+        }
+        h->keys[h->nkeys++] = code;
+        p += len + (p[len] == '+');
+    }
+    if (h->nkeys == 0) {
+        fprintf(stderr, "Error: empty hotkey\n");
+        return -1;
+    }
+    num_hotkeys++;
+    return 0;
+}
+
+static int key_is_down(uint16_t code) {
+    return keys_down[code / 8] & (1 << (code % 8));
+}
+
+static int is_chord_key(uint16_t code) {
+    for (int i = 0; i < num_hotkeys; i++) {
+        for (int k = 0; k < hotkeys[i].nkeys; k++) {
+            if (hotkeys[i].keys[k] == code) return 1;
+        }
+    }
+    return 0;
+}
+
+// Typed keys would combine with a chord still held on the real keyboard
+static void wait_hotkey_release(void) {
+    for (int waited = 0; waited < HOTKEY_RELEASE_WAIT_MS && atomic_load(&chord_keys_held) > 0;
+         waited += 5) {
+        usleep(5000);
+    }
+}
+
+// Watch a keyboard that can type a hotkey; never our own uinput device
+static void hotkey_open(int fd_epoll, const char *path, int quiet) {
+    int slot = -1;
+    for (int i = 0; i < HOTKEY_DEVICES_MAX; i++) {
+        if (hotkey_devs[i].fd >= 0 && strcmp(hotkey_devs[i].path, path) == 0) return;
+        if (hotkey_devs[i].fd < 0 && slot < 0) slot = i;
+    }
+    if (slot < 0) return;
+
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        if (!quiet) fprintf(stderr, "xhispertoold: %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    char name[256] = "";
+    unsigned char bits[KEY_MAX / 8 + 1] = {0};
+    ioctl(fd, EVIOCGNAME(sizeof(name)), name);
+    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(bits)), bits);
+
+    int usable = 0;
+    for (int i = 0; i < num_hotkeys && !usable; i++) {
+        usable = 1;
+        for (int k = 0; k < hotkeys[i].nkeys; k++) {
+            uint16_t code = hotkeys[i].keys[k];
+            if (!(bits[code / 8] & (1 << (code % 8)))) usable = 0;
+        }
+    }
+    if (strcmp(name, "xhisper") == 0 || !usable) {
+        close(fd);
+        return;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+    if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        return;
+    }
+    hotkey_devs[slot].fd = fd;
+    snprintf(hotkey_devs[slot].path, sizeof(hotkey_devs[slot].path), "%s", path);
+    fprintf(stderr, "xhispertoold: watching %s (%s) for hotkeys\n", path, name);
+}
+
+static void hotkey_scan(int fd_epoll) {
+    DIR *dir = opendir("/dev/input");
+    if (!dir) return;
+    struct dirent *d;
+    while ((d = readdir(dir))) {
+        if (strncmp(d->d_name, "event", 5) != 0) continue;
+        char path[32];
+        snprintf(path, sizeof(path), "/dev/input/%.20s", d->d_name);
+        hotkey_open(fd_epoll, path, 1);
+    }
+    closedir(dir);
+}
+
+static int setup_hotkeys(int fd_epoll) {
+    for (int i = 0; i < HOTKEY_DEVICES_MAX; i++) hotkey_devs[i].fd = -1;
+    if (num_hotkeys == 0) return 0;
+
+    if (num_hotkey_paths > 0) {
+        for (int i = 0; i < num_hotkey_paths; i++) hotkey_open(fd_epoll, hotkey_paths[i], 0);
+    } else {
+        // Keyboards plugged in later show up in /dev/input (readable once
+        // udev has set their permissions)
+        fd_inotify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        if (fd_inotify >= 0 && inotify_add_watch(fd_inotify, "/dev/input", IN_CREATE | IN_ATTRIB) >= 0) {
+            struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd_inotify};
+            epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_inotify, &ev);
+        }
+        hotkey_scan(fd_epoll);
+    }
+
+    int watched = 0;
+    for (int i = 0; i < HOTKEY_DEVICES_MAX; i++) watched += hotkey_devs[i].fd >= 0;
+    if (watched == 0) {
+        fprintf(stderr, "xhispertoold: no readable keyboard for the hotkey yet "
+                        "(is this user in the 'input' group?)\n");
+    }
+    return 0;
+}
+
+static void hotkey_devices_changed(int fd_epoll) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    int changed = 0;
+    while ((n = read(fd_inotify, buf, sizeof(buf))) > 0) changed = 1;
+    if (changed) hotkey_scan(fd_epoll);
+}
+
+// Ask the controller to toggle; start it (it then handles this toggle) if
+// it is not running. Never waits: the controller talks back to us.
+static void hotkey_trigger(const struct hotkey *h) {
+    char msg[64];
+    int len = snprintf(msg, sizeof(msg), "toggle");
+    if (h->mode[0]) len += snprintf(msg + len, sizeof(msg) - len, " mode=%s", h->mode);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path + 1, CONTROL_SOCKET_NAME, sizeof(addr.sun_path) - 2);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        if (send(fd, msg, len, MSG_NOSIGNAL) < 0) perror("failed to send toggle");
+        close(fd);
+        return;
+    }
+    if (fd >= 0) close(fd);
+
+    // xhisper next to us (with --local from a build directory), else $PATH
+    char exe[PATH_MAX - 32], xhisper[PATH_MAX], script[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    exe[n > 0 ? n : 0] = '\0';
+    char *dir = dirname(exe);
+    snprintf(xhisper, sizeof(xhisper), "%s/xhisper", dir);
+    snprintf(script, sizeof(script), "%s/xhisper_transcribe.py", dir);
+    int sibling = access(xhisper, X_OK) == 0;
+    int local = sibling && access(script, R_OK) == 0;
+
+    char mode[32];
+    snprintf(mode, sizeof(mode), "--mode=%s", h->mode);
+    const char *argv[4] = {sibling ? xhisper : "xhisper"};
+    int argc = 1;
+    if (local) argv[argc++] = "--local";
+    if (h->mode[0]) argv[argc++] = mode;
+
+    // Double fork: the controller is not our child to reap
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (fork() == 0) {
+            setsid();
+            execvp(argv[0], (char *const *)argv);
+            fprintf(stderr, "xhispertoold: failed to run %s: %s\n", argv[0], strerror(errno));
+        }
+        _exit(0);
+    }
+    if (pid > 0) waitpid(pid, NULL, 0);
+}
+
+static void hotkey_read(int fd_epoll, int slot) {
+    struct input_event events[64];
+    ssize_t n;
+
+    while ((n = read(hotkey_devs[slot].fd, events, sizeof(events))) > 0) {
+        for (size_t i = 0; i < n / sizeof(events[0]); i++) {
+            const struct input_event *ev = &events[i];
+            if (ev->type != EV_KEY || ev->code > KEY_MAX) continue;
+
+            int was_down = key_is_down(ev->code);
+            if (ev->value == 1 && !was_down) {
+                keys_down[ev->code / 8] |= 1 << (ev->code % 8);
+                if (!is_chord_key(ev->code)) continue;
+                atomic_fetch_add(&chord_keys_held, 1);
+
+                // The press that completes a chord fires it
+                for (int h = 0; h < num_hotkeys; h++) {
+                    int complete = 1, involved = 0;
+                    for (int k = 0; k < hotkeys[h].nkeys; k++) {
+                        complete &= key_is_down(hotkeys[h].keys[k]) != 0;
+                        involved |= hotkeys[h].keys[k] == ev->code;
+                    }
+                    if (complete && involved) {
+                        fprintf(stderr, "xhispertoold: hotkey %d pressed\n", h + 1);
+                        hotkey_trigger(&hotkeys[h]);
+                        break;
+                    }
+                }
+            } else if (ev->value == 0 && was_down) {
+                keys_down[ev->code / 8] &= ~(1 << (ev->code % 8));
+                if (is_chord_key(ev->code)) atomic_fetch_sub(&chord_keys_held, 1);
+            }
+        }
+    }
+
+    if (n < 0 && errno != EAGAIN && errno != EINTR) {
+        // Unplugged: forget its keys so typing is not held up
+        fprintf(stderr, "xhispertoold: %s gone\n", hotkey_devs[slot].path);
+        epoll_ctl(fd_epoll, EPOLL_CTL_DEL, hotkey_devs[slot].fd, NULL);
+        close(hotkey_devs[slot].fd);
+        hotkey_devs[slot].fd = -1;
+        memset(keys_down, 0, sizeof(keys_down));
+        atomic_store(&chord_keys_held, 0);
+    }
+}
+
+// Typing worker: drains the queue in order, one command at a time
+void *typing_worker(void *arg) {
+    static struct command current;
+    (void)arg;
+
+    while (1) {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_len == 0) {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        current = cmd_queue[queue_head];
+        queue_head = (queue_head + 1) % QUEUE_MAX;
+        int was_full = queue_len-- == QUEUE_MAX;
+        size_t depth = queue_len;
+        pthread_mutex_unlock(&queue_lock);
+
+        // Let the socket loop resume reading
+        if (was_full) {
+            uint64_t one = 1;
+            write(fd_wake, &one, sizeof(one));
+        }
+
+        current_gen = current.gen;
+        if (!aborted()) wait_hotkey_release();
+        int status = aborted() ? XH_EABORTED : execute_command(&current, depth);
+        send_ack(current.client, current.client_serial, current.id, status);
+    }
+
+    return NULL;
+}
+
+// Drop everything queued and stop the command being typed
+static void abort_commands() {
+    pthread_mutex_lock(&queue_lock);
+    queue_stats.dropped += queue_len;
+    fprintf(stderr, "xhispertoold: abort, dropping %zu queued commands\n", queue_len);
+    for (size_t i = 0; i < queue_len; i++) {
+        const struct command *c = &cmd_queue[(queue_head + i) % QUEUE_MAX];
+        send_ack_locked(c->client, c->client_serial, c->id, XH_EABORTED);
+    }
+    queue_len = 0;
+    atomic_fetch_add(&abort_gen, 1);
+
+    // Read ahead before the abort, so dropped with the queue
+    struct held h;
+    for (; readahead_start < readahead_end; readahead_start += sizeof(h) + h.len) {
+        memcpy(&h, readahead_buf + readahead_start, sizeof(h));
+        send_ack_locked(h.client, h.client_serial, h.id, XH_EABORTED);
+        queue_stats.dropped++;
+    }
+    readahead_start = readahead_end = 0;
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static int queue_full() {
+    pthread_mutex_lock(&queue_lock);
+    int full = queue_len == QUEUE_MAX;
+    pthread_mutex_unlock(&queue_lock);
+    return full;
+}
+
+static void enqueue_command(const char *buf, ssize_t n, int slot, unsigned serial, uint32_t id) {
+    pthread_mutex_lock(&queue_lock);
+    struct command *c = &cmd_queue[(queue_head + queue_len) % QUEUE_MAX];
+    memcpy(c->buf, buf, n);
+    c->len = n;
+    c->gen = atomic_load(&abort_gen);
+    c->client = slot;
+    c->client_serial = serial;
+    c->id = id;
+    clock_gettime(CLOCK_MONOTONIC, &c->queued);
+    if (++queue_len > queue_stats.max_depth) queue_stats.max_depth = queue_len;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// Move read-ahead frames into the queue as it makes room
+static void drain_readahead(void) {
+    struct held h;
+    while (readahead_start < readahead_end && !queue_full()) {
+        memcpy(&h, readahead_buf + readahead_start, sizeof(h));
+        enqueue_command(readahead_buf + readahead_start + sizeof(h), h.len, h.client,
+                        h.client_serial, h.id);
+        readahead_start += sizeof(h) + h.len;
+    }
+    if (readahead_start == readahead_end) readahead_start = readahead_end = 0;
+}
+
+// No room for another frame, even after moving what's left to the front
+static int readahead_full(void) {
+    if (READAHEAD_MAX - readahead_end >= sizeof(struct held) + MAX_MSG) return 0;
+    memmove(readahead_buf, readahead_buf + readahead_start, readahead_end - readahead_start);
+    readahead_end -= readahead_start;
+    readahead_start = 0;
+    return READAHEAD_MAX - readahead_end < sizeof(struct held) + MAX_MSG;
+}
+
+// Read every pending datagram; returns 1 once the queue is full and the
+// remaining datagrams should stay in the socket buffer (backpressure)
+static int receive_commands(int fd) {
+    char buf[MAX_MSG];
+
+    while (1) {
+        if (fd == fd_socket && queue_full()) return 1;
+
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("failed to receive command");
+            return 0;
+        }
+        if (n < 1) continue;
+
+        if (buf[0] == 'X') {
+            abort_commands();
+            continue;
+        }
+        if (fd != fd_socket) {
+            fprintf(stderr, "xhispertoold: ignoring '%c' on control socket\n", buf[0]);
+            continue;
+        }
+
+        enqueue_command(buf, n, -1, 0, 0);
+    }
+}
+
+static void close_client(int fd_epoll, int slot) {
+    pthread_mutex_lock(&queue_lock);
+    if (!clients[slot].hung_up) epoll_ctl(fd_epoll, EPOLL_CTL_DEL, clients[slot].fd, NULL);
+    close(clients[slot].fd);
+    free(clients[slot].unsent);
+    clients[slot] = (struct client){.fd = -1};
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static void accept_clients(int fd_epoll, int paused) {
+    while (1) {
+        int fd = accept4(fd_seq, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("failed to accept client");
+            return;
+        }
+
+        int slot = 0;
+        while (slot < MAX_CLIENTS && clients[slot].fd >= 0) slot++;
+        if (slot == MAX_CLIENTS) {
+            fprintf(stderr, "xhispertoold: too many clients, closing connection\n");
+            close(fd);
+            continue;
+        }
+
+        struct epoll_event ev = {.events = paused ? 0 : EPOLLIN, .data.fd = fd};
+        if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("failed to watch client");
+            close(fd);
+            continue;
+        }
+
+        pthread_mutex_lock(&queue_lock);
+        clients[slot] = (struct client){.fd = fd, .serial = ++client_serial, .events = ev.events};
+        pthread_mutex_unlock(&queue_lock);
+    }
+}
+
+static size_t format_window(char *out, size_t size, const char *name, const struct window *w,
+                            int json) {
+    double p[3];
+    window_percentiles(w, p);
+    return snprintf(out, size, json ? ", \"%s\": {\"p50\": %.1f, \"p95\": %.1f, \"p99\": %.1f}"
+                                    : "  %-12s p50 %10.1f  p95 %10.1f  p99 %10.1f\n",
+                    name, p[0], p[1], p[2]);
+}
+
+// `stats`: totals and rolling percentiles per kind of command, as text or
+// JSON (payload "json")
+static void format_stats(char *out, size_t size, int json) {
+    size_t len = snprintf(out, size, json ? "{\"uptime_s\": %.0f, \"output\": \"%s\", \"commands\": {"
+                                          : "uptime %.0fs, output %s\n",
+                          ms_since(&daemon_started) / 1000, output->name);
+
+    pthread_mutex_lock(&stats_lock);
+    int first = 1;
+    for (size_t i = 0; i < NUM_CMD_STATS && len < size; i++) {
+        const struct cmd_stats *st = &cmd_stats[i];
+        if (!st->count) continue;
+        len += snprintf(out + len, size - len,
+                        json ? "%s\"%s\": {\"count\": %lu, \"aborted\": %lu, \"failed\": %lu, "
+                               "\"bytes\": %llu, \"events\": %llu, \"writes\": %llu, "
+                               "\"sleeps\": %llu, \"eagain\": %llu"
+                             : "%s%s: %lu (%lu aborted, %lu failed), %llu bytes, %llu events, "
+                               "%llu writes, %llu sleeps, %llu EAGAIN\n",
+                        json ? (first ? "" : ", ") : "", st->name, st->count, st->aborted, st->failed,
+                        st->bytes, st->events, st->writes, st->sleeps, st->eagain);
+        if (len < size) len += format_window(out + len, size - len, "queue_us", &st->queue_us, json);
+        if (len < size) len += format_window(out + len, size - len, "exec_us", &st->exec_us, json);
+        if (st->chars_per_s.n && len < size) {
+            len += format_window(out + len, size - len, "chars_per_s", &st->chars_per_s, json);
+        }
+        if (json && len < size) len += snprintf(out + len, size - len, "}");
+        first = 0;
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    if (json && len < size) snprintf(out + len, size - len, "}}");
+}
+
+// Read framed requests from one client. While the queue is full, frames go
+// to the read-ahead, so abort and stats are still answered at once; once
+// that is full too, the client is left in the kernel like datagrams.
+static int receive_frames(int fd_epoll, int slot) {
+    char buf[sizeof(struct frame_header) + MAX_MSG];
+    struct frame_header hdr;
+
+    while (1) {
+        if (readahead_full()) return 1;
+
+        ssize_t n = recv(clients[slot].fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("failed to receive request");
+                close_client(fd_epoll, slot);
+            }
+            return 0;
+        }
+        if (n == 0) {
+            close_client(fd_epoll, slot);
+            return 0;
+        }
+        if (n < (ssize_t)sizeof(hdr)) {
+            fprintf(stderr, "xhispertoold: short request (%zd bytes)\n", n);
+            continue;
+        }
+
+        memcpy(&hdr, buf, sizeof(hdr));
+        if (hdr.version != PROTO_VERSION) {
+            send_ack(slot, clients[slot].serial, hdr.id, XH_EVERSION);
+            continue;
+        }
+        if (hdr.cmd == 'X') {
+            abort_commands();
+            send_ack(slot, clients[slot].serial, hdr.id, XH_OK);
+            continue;
+        }
+        if (hdr.cmd == 'Q') {
+            char stats[MAX_MSG];
+            format_stats(stats, sizeof(stats), n - sizeof(hdr) == 4 && memcmp(buf + sizeof(hdr), "json", 4) == 0);
+            pthread_mutex_lock(&queue_lock);
+            send_reply_locked(slot, clients[slot].serial, hdr.id, XH_OK, stats);
+            pthread_mutex_unlock(&queue_lock);
+            continue;
+        }
+
+        // Reuse the header's last byte for the command so the payload
+        // follows it exactly as in a datagram
+        char *msg = buf + sizeof(hdr) - 1;
+        msg[0] = hdr.cmd;
+        n -= sizeof(hdr) - 1;
+        if (readahead_start == readahead_end && !queue_full()) {
+            enqueue_command(msg, n, slot, clients[slot].serial, hdr.id);
+            continue;
+        }
+        struct held h = {.client = slot, .client_serial = clients[slot].serial, .id = hdr.id, .len = n};
+        memcpy(readahead_buf + readahead_end, &h, sizeof(h));
+        memcpy(readahead_buf + readahead_end + sizeof(h), msg, n);
+        readahead_end += sizeof(h) + n;
+    }
+}
+
+// Arm clients for reading unless the read-ahead is full, and for writing
+// while they have acks waiting
+static void update_clients(int fd_epoll, int reading) {
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        struct client *cl = &clients[i];
+        if (cl->fd < 0 || (cl->hung_up && !reading)) continue;
+
+        pthread_mutex_lock(&queue_lock);
+        struct epoll_event ev = {.events = (reading ? EPOLLIN : 0) | (cl->unsent_len ? EPOLLOUT : 0),
+                                 .data.fd = cl->fd};
+        pthread_mutex_unlock(&queue_lock);
+        if (cl->hung_up) {
+            // Read what it sent before hanging up, then its EOF
+            epoll_ctl(fd_epoll, EPOLL_CTL_ADD, cl->fd, &ev);
+            cl->hung_up = 0;
+        } else if (ev.events != cl->events) {
+            epoll_ctl(fd_epoll, EPOLL_CTL_MOD, cl->fd, &ev);
+        }
+        cl->events = ev.events;
+    }
+}
+
+// A hang-up is reported even while a client isn't armed for reading: set it
+// aside until reads resume rather than spin on it
+static void client_hung_up(int fd_epoll, int slot) {
+    pthread_mutex_lock(&queue_lock);
+    struct client *cl = &clients[slot];
+    epoll_ctl(fd_epoll, EPOLL_CTL_DEL, cl->fd, NULL);
+    cl->hung_up = 1;
+    cl->events = 0;
+    free(cl->unsent);
+    cl->unsent = NULL;
+    cl->unsent_len = 0;
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// Sockets are bound and the device is usable: tell whoever is waiting
+static void notify_ready(void) {
+    char msg[160];
+    int len = snprintf(msg, sizeof(msg), "READY=1\nMAINPID=%d\nSTATUS=%s %.1f ms, ready %.1f ms\n",
+                       (int)getpid(), output->name, output_ms, ms_since(&daemon_started));
+    fprintf(stderr, "xhispertoold: ready in %.1f ms (%s %.1f ms)\n",
+            ms_since(&daemon_started), output->name, output_ms);
+
+    if (fd_notify >= 0) {
+        if (write(fd_notify, msg, len) != len) perror("failed to notify readiness");
+        close(fd_notify);
+        fd_notify = -1;
+    }
+
+    // "@name" is abstract, anything else a path
+    const char *path = getenv("NOTIFY_SOCKET");
+    size_t n = path ? strlen(path) : 0;
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (n > 1 && n < sizeof(addr.sun_path) && (path[0] == '/' || path[0] == '@')) {
+        memcpy(addr.sun_path, path, n);
+        if (path[0] == '@') addr.sun_path[0] = '\0';
+        int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || sendto(fd, msg, len, MSG_NOSIGNAL, (struct sockaddr *)&addr,
+                             offsetof(struct sockaddr_un, sun_path) + n) < 0) {
+            perror("failed to notify $NOTIFY_SOCKET");
+        }
+        if (fd >= 0) close(fd);
+    }
+    // Not for the xhisper processes a hotkey starts
+    unsetenv("NOTIFY_SOCKET");
+}
+
+// Daemon mode
+int run_daemon(int argc, char *argv[]) {
+    const char *output_spec = "uinput";
+
+    clock_gettime(CLOCK_MONOTONIC, &daemon_started);
+    atexit(cleanup);
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--profile=", 10) == 0) {
+            timing = find_profile(argv[i] + 10, strlen(argv[i] + 10));
+            if (!timing) {
+                fprintf(stderr, "Error: Unknown timing profile '%s'\n", argv[i] + 10);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--unicode=", 10) == 0) {
+            int method = find_unicode_method(argv[i] + 10, strlen(argv[i] + 10));
+            if (method < 0) {
+                fprintf(stderr, "Error: Unknown unicode method '%s'\n", argv[i] + 10);
+                return 1;
+            }
+            unicode_method = method;
+        } else if (strncmp(argv[i], "--layout=", 9) == 0) {
+            layout = find_layout(argv[i] + 9, strlen(argv[i] + 9));
+            if (!layout) {
+                fprintf(stderr, "Error: Unknown keyboard layout '%s'\n", argv[i] + 9);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            pace_realtime = 1;
+        } else if (strncmp(argv[i], "--hotkey=", 9) == 0) {
+            if (parse_hotkey(argv[i] + 9) < 0) return 1;
+        } else if (strncmp(argv[i], "--hotkey-device=", 16) == 0) {
+            if (num_hotkey_paths < HOTKEY_DEVICES_MAX) hotkey_paths[num_hotkey_paths++] = argv[i] + 16;
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            output_spec = argv[i] + 9;
+        } else if (strncmp(argv[i], "--notify-fd=", 12) == 0) {
+            fd_notify = atoi(argv[i] + 12);
+            if (fd_notify <= STDERR_FILENO || fcntl(fd_notify, F_SETFD, FD_CLOEXEC) < 0) {
+                fprintf(stderr, "Error: bad notify fd '%s'\n", argv[i] + 12);
+                return 1;
+            }
+        }
+    }
+
+    // Default 50us timer slack is a sizeable fraction of the burst delays
+    prctl(PR_SET_TIMERSLACK, 1UL);
+
+    struct timespec output_start;
+    clock_gettime(CLOCK_MONOTONIC, &output_start);
+    if (open_output(output_spec) < 0) {
+        return 1;
+    }
+    output_ms = ms_since(&output_start);
+
+    if (setup_socket() < 0) {
+        return 1;
+    }
+
+    int fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (fd_epoll < 0) {
+        perror("failed to create epoll instance");
+        return 1;
+    }
+
+    int fds[] = {fd_socket, fd_ctl, fd_seq, fd_wake};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = fds[i]};
+        if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fds[i], &ev) < 0) {
+            perror("failed to watch socket");
+            return 1;
+        }
+    }
+
+    setup_hotkeys(fd_epoll);
+
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, typing_worker, NULL) != 0) {
+        fprintf(stderr, "failed to start typing worker\n");
+        return 1;
+    }
+
+    printf("xhispertoold: listening on @%s (profile: %s, output: %s)\n", SOCKET_NAME,
+           timing->name, output->name);
+    fflush(stdout);
+    notify_ready();
+
+    int paused = 0;
+    while (1) {
+        struct epoll_event events[8];
+        int n = epoll_wait(fd_epoll, events, 8, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            return 1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == fd_wake) {
+                uint64_t count;
+                read(fd_wake, &count, sizeof(count));
+            } else if (fd == fd_ctl) {
+                receive_commands(fd_ctl);
+            } else if (fd == fd_seq) {
+                accept_clients(fd_epoll, readahead_full());
+            } else if (fd == fd_socket) {
+                receive_commands(fd_socket);
+            } else if (fd == fd_inotify) {
+                hotkey_devices_changed(fd_epoll);
+            } else {
+                for (int slot = 0; slot < HOTKEY_DEVICES_MAX; slot++) {
+                    if (hotkey_devs[slot].fd == fd) {
+                        hotkey_read(fd_epoll, slot);
+                        fd = -1;
+                        break;
+                    }
+                }
+                for (int slot = 0; fd >= 0 && slot < MAX_CLIENTS; slot++) {
+                    if (clients[slot].fd != fd) continue;
+                    if (events[i].events & EPOLLOUT) flush_acks(slot);
+                    if (!(clients[slot].events & EPOLLIN) && (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                        client_hung_up(fd_epoll, slot);
+                    } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                        receive_frames(fd_epoll, slot);
+                    }
+                    break;
+                }
+            }
+        }
+
+        // Stop reading datagrams while the queue is full, and frames once
+        // the read-ahead behind it is full too, so senders block in the
+        // kernel instead of commands being dropped
+        drain_readahead();
+        int full = queue_full();
+        if (full != paused) {
+            struct epoll_event ev = {.events = full ? 0 : EPOLLIN, .data.fd = fd_socket};
+            epoll_ctl(fd_epoll, EPOLL_CTL_MOD, fd_socket, &ev);
+            paused = full;
+            if (full) {
+                queue_stats.paused++;
+                fprintf(stderr, "xhispertoold: queue full (%d), pausing sockets (%lu times, max depth %zu)\n",
+                        QUEUE_MAX, queue_stats.paused, queue_stats.max_depth);
+            }
+        }
+        update_clients(fd_epoll, !readahead_full());
+    }
+
+    return 0;
+}
+
+// Audio analysis: 16-bit PCM WAV files, mmapped
+
+struct pcm {
+    void *map;              // whole file
+    size_t map_len;
+    const int16_t *samples; // interleaved
+    size_t count;           // samples, all channels
+    unsigned rate;
+    unsigned channels;
+};
+
+static uint32_t le32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint16_t le16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+}
+
+// Map a WAV file and locate its 16-bit PCM data; returns -1 with a message
+static int pcm_open(const char *path, struct pcm *pcm) {
+    memset(pcm, 0, sizeof(*pcm));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 12) {
+        fprintf(stderr, "Error: %s: not a WAV file\n", path);
+        close(fd);
+        return -1;
+    }
+    pcm->map_len = st.st_size;
+    pcm->map = mmap(NULL, pcm->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pcm->map == MAP_FAILED) {
+        perror("failed to map audio file");
+        return -1;
+    }
+    madvise(pcm->map, pcm->map_len, MADV_SEQUENTIAL);
+
+    const unsigned char *p = pcm->map;
+    const unsigned char *end = p + pcm->map_len;
+    if (memcmp(p, "RIFF", 4) != 0 || memcmp(p + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "Error: %s: not a WAV file\n", path);
+        goto fail;
+    }
+
+    unsigned bits = 0, format = 0;
+    for (p += 12; end - p >= 8; ) {
+        uint32_t size = le32(p + 4);
+        const unsigned char *body = p + 8;
+
+        if (memcmp(p, "fmt ", 4) == 0 && size >= 16 && end - body >= 16) {
+            format = le16(body);
+            pcm->channels = le16(body + 2);
+            pcm->rate = le32(body + 4);
+            bits = le16(body + 14);
+        } else if (memcmp(p, "data", 4) == 0) {
+            // A recorder killed before finalizing leaves 0 or a bogus size
+            size_t avail = end - body;
+            size_t len = (size == 0 || size > avail) ? avail : size;
+            pcm->samples = (const int16_t *)body;
+            pcm->count = len / 2;
+            break;
+        }
+        if (size > (size_t)(end - body)) break;
+        p = body + size + (size & 1);
+    }
+
+    // 1 = PCM, 0xfffe = WAVE_FORMAT_EXTENSIBLE (PCM subformat assumed)
+    if (!pcm->samples || (format != 1 && format != 0xfffe) || bits != 16 ||
+        pcm->channels == 0 || pcm->rate == 0) {
+        fprintf(stderr, "Error: %s: need 16-bit PCM WAV\n", path);
+        goto fail;
+    }
+    // A 30 ms frame must hold samples, and no real recorder goes this high
+    if (pcm->rate < 1000 || pcm->rate > 768000 || pcm->channels > 64) {
+        fprintf(stderr, "Error: %s: implausible format (%u Hz, %u channels)\n", path,
+                pcm->rate, pcm->channels);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    munmap(pcm->map, pcm->map_len);
+    pcm->map = NULL;
+    return -1;
+}
+
+static void pcm_close(struct pcm *pcm) {
+    if (pcm->map) munmap(pcm->map, pcm->map_len);
+    pcm->map = NULL;
+}
+
+// Eight samples per step with GCC vector extensions (SSE2/AVX/NEON as
+// available); widened to float so squares cannot overflow
+typedef int16_t v8s16 __attribute__((vector_size(16)));
+typedef int32_t v8s32 __attribute__((vector_size(32)));
+typedef float v8f32 __attribute__((vector_size(32)));
+
+// Peak and energy (sum of squares) of n samples, both in sample units squared
+static void frame_levels(const int16_t *s, size_t n, float *peak_sq, double *energy) {
+    v8f32 vpeak = {0}, vsum = {0};
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        v8s16 x;
+        memcpy(&x, s + i, sizeof(x));
+        v8f32 f = __builtin_convertvector(x, v8f32);
+        v8f32 sq = f * f;
+        v8s32 more = sq > vpeak;
+        vpeak = (v8f32)(((v8s32)sq & more) | ((v8s32)vpeak & ~more));
+        vsum += sq;
+    }
+
+    float peak = 0;
+    double sum = 0;
+    for (int k = 0; k < 8; k++) {
+        if (vpeak[k] > peak) peak = vpeak[k];
+        sum += vsum[k];
+    }
+    for (; i < n; i++) {
+        float sq = (float)s[i] * s[i];
+        if (sq > peak) peak = sq;
+        sum += sq;
+    }
+    *peak_sq = peak;
+    *energy = sum;
+}
+
+// Level in dBFS of a squared amplitude
+static double sq_db(double sq) {
+    return sq > 0 ? 10 * log10(sq / (32768.0 * 32768.0)) : -120;
+}
+
+struct levels {
+    double peak_db;
+    double rms_db;
+    double silent_pct;  // frames whose peak is below the threshold
+    size_t frames;
+};
+
+static void analyze_pcm(const struct pcm *pcm, double threshold_db, struct levels *lv) {
+    size_t frame = (size_t)pcm->rate * FRAME_MS / 1000 * pcm->channels;
+    double threshold_sq = 32768.0 * 32768.0 * pow(10, threshold_db / 10);
+    float peak = 0;
+    double energy = 0;
+    size_t silent = 0;
+
+    memset(lv, 0, sizeof(*lv));
+    for (size_t i = 0; i < pcm->count; i += frame) {
+        size_t n = pcm->count - i < frame ? pcm->count - i : frame;
+        float fpeak;
+        double fenergy;
+        frame_levels(pcm->samples + i, n, &fpeak, &fenergy);
+
+        if (fpeak > peak) peak = fpeak;
+        energy += fenergy;
+        if (fpeak < threshold_sq) silent++;
+        lv->frames++;
+    }
+
+    lv->peak_db = sq_db(peak);
+    lv->rms_db = pcm->count ? sq_db(energy / pcm->count) : -120;
+    lv->silent_pct = lv->frames ? 100.0 * silent / lv->frames : 100;
+}
+
+// Silent if nothing reaches the threshold, or too little of it does
+static int levels_silent(const struct levels *lv, double threshold, double percentage) {
+    return lv->peak_db < threshold || lv->silent_pct >= percentage;
+}
+
+// xhispertool analyze: exit 0 if the recording counts as silent, 1 if not
+static int run_analyze(int argc, char *argv[]) {
+    double threshold = -50, percentage = 95;
+    const char *path = NULL;
+    int bad = 0;
+
+    for (int i = 2; i < argc; i++) {
+        const char *val = NULL;
+        double *dst = NULL;
+        char *end;
+
+        if (strncmp(argv[i], "--threshold=", 12) == 0) {
+            val = argv[i] + 12;
+            dst = &threshold;
+        } else if (strncmp(argv[i], "--percentage=", 13) == 0) {
+            val = argv[i] + 13;
+            dst = &percentage;
+        } else if (!path) {
+            path = argv[i];
+            continue;
+        } else {
+            bad = 1;
+            continue;
+        }
+        *dst = strtod(val, &end);
+        if (end == val || *end) bad = 1;
+    }
+    if (!path || bad) {
+        fprintf(stderr, "Error: 'analyze' takes [--threshold=<dB>] [--percentage=<pct>] <file.wav>\n");
+        return 2;
+    }
+
+    struct timespec start, done;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct pcm pcm;
+    if (pcm_open(path, &pcm) < 0) return 2;
+
+    struct levels lv;
+    analyze_pcm(&pcm, threshold, &lv);
+    pcm_close(&pcm);
+
+    int silent = levels_silent(&lv, threshold, percentage);
+
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    printf("peak=%.1f rms=%.1f silent_frames=%.1f%% frames=%zu verdict=%s time_us=%lld\n",
+           lv.peak_db, lv.rms_db, lv.silent_pct, lv.frames,
+           silent ? "silent" : "sound",
+           (long long)(ts_ns(&done) - ts_ns(&start)) / 1000);
+    return silent ? 0 : 1;
+}
+
+// Mark the 30 ms frames to keep: speech (peak at or above the threshold,
+// as for analyze's verdict, so a recording that isn't silent keeps some),
+// pad_ms before the first and after the last speech frame, and pauses up
+// to pause_ms (longer ones keep only their two ends). keep[] has one entry
+// per frame; kept frames are in [*first, *last). Returns pauses shortened.
+static size_t trim_mark(const int16_t *samples, size_t count, unsigned rate,
+                        double threshold, long pad_ms, long pause_ms,
+                        unsigned char *keep, size_t *first_out, size_t *last_out) {
+    size_t frame = rate * FRAME_MS / 1000;
+    size_t nframes = (count + frame - 1) / frame;
+    size_t pad = pad_ms / FRAME_MS;
+    size_t max_pause = pause_ms / FRAME_MS;
+    double threshold_sq = 32768.0 * 32768.0 * pow(10, threshold / 10);
+
+    for (size_t f = 0; f < nframes; f++) {
+        size_t n = f == nframes - 1 ? count - f * frame : frame;
+        float fpeak;
+        double energy;
+        frame_levels(samples + f * frame, n, &fpeak, &energy);
+        keep[f] = fpeak >= threshold_sq;
+    }
+
+    // Keep the padding before the first and after the last speech frame
+    size_t first = 0, last = nframes;
+    while (first < nframes && !keep[first]) first++;
+    while (last > first && !keep[last - 1]) last--;
+    if (first < last) {
+        first = first > pad ? first - pad : 0;
+        last = last + pad < nframes ? last + pad : nframes;
+    }
+
+    // Pauses between speech longer than max_pause keep only their two ends
+    size_t shortened = 0;
+    for (size_t f = first; f < last; ) {
+        if (keep[f]) {
+            f++;
+            continue;
+        }
+        size_t gap = f;
+        while (gap < last && !keep[gap]) gap++;
+        if (gap == last || f == first) {
+            // Leading/trailing padding
+            memset(keep + f, 1, gap - f);
+        } else if (gap - f > max_pause) {
+            memset(keep + f, 1, max_pause / 2);
+            memset(keep + gap - (max_pause - max_pause / 2), 1, max_pause - max_pause / 2);
+            shortened++;
+        } else {
+            memset(keep + f, 1, gap - f);
+        }
+        f = gap;
+    }
+
+    *first_out = first;
+    *last_out = last;
+    return shortened;
+}
+
+// xhispertool trim: cut leading/trailing silence and shorten long pauses,
+// writing raw PCM the decoder can take as is (no WAV parsing, no resampling)
+static int run_trim(int argc, char *argv[]) {
+    double threshold = -50;
+    long pad_ms = 200, pause_ms = 600;
+    int f32 = 1;
+    const char *in = NULL, *out = NULL;
+    int bad = 0;
+
+    for (int i = 2; i < argc; i++) {
+        char *end = NULL;
+        if (strncmp(argv[i], "--threshold=", 12) == 0) {
+            threshold = strtod(argv[i] + 12, &end);
+        } else if (strncmp(argv[i], "--pad=", 6) == 0) {
+            pad_ms = strtol(argv[i] + 6, &end, 10);
+        } else if (strncmp(argv[i], "--max-pause=", 12) == 0) {
+            pause_ms = strtol(argv[i] + 12, &end, 10);
+        } else if (strcmp(argv[i], "--format=f32") == 0) {
+            f32 = 1;
+        } else if (strcmp(argv[i], "--format=s16") == 0) {
+            f32 = 0;
+        } else if (!in) {
+            in = argv[i];
+        } else if (!out) {
+            out = argv[i];
+        } else {
+            bad = 1;
+        }
+        if (end && (*end || end == strchr(argv[i], '=') + 1)) bad = 1;
+    }
+    if (!in || bad || pad_ms < 0 || pause_ms < 0) {
+        fprintf(stderr, "Error: 'trim' takes [--threshold=<dB>] [--pad=<ms>] [--max-pause=<ms>]\n"
+                        "       [--format=f32|s16] <in.wav> [<out.pcm>]\n");
+        return 1;
+    }
+
+    struct timespec start, done;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct pcm pcm;
+    if (pcm_open(in, &pcm) < 0) return 1;
+    if (pcm.channels != 1 || pcm.rate != 16000) {
+        fprintf(stderr, "Error: %s: need 16 kHz mono, got %u Hz, %u channels\n",
+                in, pcm.rate, pcm.channels);
+        pcm_close(&pcm);
+        return 1;
+    }
+
+    size_t frame = pcm.rate * FRAME_MS / 1000;
+    size_t nframes = (pcm.count + frame - 1) / frame;
+    unsigned char *keep = calloc(nframes ? nframes : 1, 1);
+    if (!keep) {
+        perror("failed to allocate");
+        pcm_close(&pcm);
+        return 1;
+    }
+    size_t first, last;
+    size_t shortened = trim_mark(pcm.samples, pcm.count, pcm.rate, threshold,
+                                 pad_ms, pause_ms, keep, &first, &last);
+
+    FILE *fp = out && strcmp(out, "-") != 0 ? fopen(out, "wb") : stdout;
+    if (!fp) {
+        fprintf(stderr, "Error: %s: %s\n", out, strerror(errno));
+        free(keep);
+        pcm_close(&pcm);
+        return 1;
+    }
+
+    size_t kept = 0;
+    int err = 0;
+    for (size_t f = first; f < last && !err; f++) {
+        if (!keep[f]) continue;
+        const int16_t *s = pcm.samples + f * frame;
+        size_t n = f == nframes - 1 ? pcm.count - f * frame : frame;
+        kept += n;
+
+        if (!f32) {
+            err = fwrite(s, sizeof(*s), n, fp) != n;
+            continue;
+        }
+        float buf[16000 * FRAME_MS / 1000];
+        for (size_t i = 0; i < n; i++) buf[i] = s[i] / 32768.0f;
+        err = fwrite(buf, sizeof(*buf), n, fp) != n;
+    }
+    if (fp != stdout ? fclose(fp) != 0 : fflush(fp) != 0) err = 1;
+    if (err) perror("failed to write trimmed audio");
+
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    fprintf(stderr, "trim: kept %.2fs of %.2fs, %zu pauses shortened, time_us=%lld\n",
+            (double)kept / pcm.rate, (double)pcm.count / pcm.rate, shortened,
+            (long long)(ts_ns(&done) - ts_ns(&start)) / 1000);
+
+    free(keep);
+    pcm_close(&pcm);
+    return err;
+}
+
+// Recorder: captures 16 kHz mono s16 into a memfd until a client sends
+// "stop", then analyzes and optionally trims it in place, seals it and
+// hands the fd over with SCM_RIGHTS. No temp file, and the source is
+// drained to EOF instead of sleeping for a flush.
+struct recorder {
+    int memfd;
+    unsigned char *buf;     // shared mapping of memfd, cap bytes
+    size_t cap;
+    size_t len;
+    int src;                // audio source, -1 after EOF
+    pid_t child;            // pw-record, 0 for file/stdin sources
+    int realtime;           // pace a file source like a microphone
+    struct timespec started;
+    int header;             // 0: undecided, 1: skipping WAV header, 2: PCM
+    unsigned char head[4096];
+    size_t head_len;
+};
+
+static volatile sig_atomic_t record_quit = 0;
+
+static void record_signal(int sig) {
+    (void)sig;
+    record_quit = 1;
+}
+
+static void record_store(struct recorder *r, const unsigned char *p, size_t n) {
+    if (n > r->cap - r->len) {
+        if (r->len < r->cap) {
+            fprintf(stderr, "xhispertool: recording reached %d s, dropping the rest\n",
+                    RECORD_MAX_SECONDS);
+        }
+        n = r->cap - r->len;
+    }
+    memcpy(r->buf + r->len, p, n);
+    r->len += n;
+}
+
+// Append source bytes; the source may start with a WAV header to skip,
+// which must describe what pw-record captures. -1 with a message if not.
+static int record_append(struct recorder *r, const unsigned char *p, size_t n) {
+    if (r->header == 2) {
+        record_store(r, p, n);
+        return 0;
+    }
+
+    size_t room = sizeof(r->head) - r->head_len;
+    size_t take = n < room ? n : room;
+    memcpy(r->head + r->head_len, p, take);
+    r->head_len += take;
+    if (r->head_len < 12) return 0;
+
+    size_t data = 0;
+    if (memcmp(r->head, "RIFF", 4) != 0) {
+        r->header = 2;  // raw PCM
+    } else {
+        // Walk chunks up to "data"; need the whole header first
+        size_t pos = 12;
+        int have_fmt = 0;
+        while (pos + 8 <= r->head_len && memcmp(r->head + pos, "data", 4) != 0) {
+            if (memcmp(r->head + pos, "fmt ", 4) == 0 && pos + 24 <= r->head_len) {
+                const unsigned char *body = r->head + pos + 8;
+                unsigned format = le16(body), channels = le16(body + 2), bits = le16(body + 14);
+                uint32_t rate = le32(body + 4);
+                // 1 = PCM, 0xfffe = WAVE_FORMAT_EXTENSIBLE (PCM subformat assumed)
+                if ((format != 1 && format != 0xfffe) || bits != 16 || channels != 1 ||
+                    rate != RECORD_RATE) {
+                    fprintf(stderr, "xhispertool: audio source is %u Hz, %u channels, %u-bit; "
+                                    "need 16 kHz mono 16-bit PCM\n", rate, channels, bits);
+                    return -1;
+                }
+                have_fmt = 1;
+            }
+            pos += 8 + le32(r->head + pos + 4);
+        }
+        if (pos + 8 > r->head_len) {
+            if (r->head_len == sizeof(r->head)) {
+                fprintf(stderr, "xhispertool: audio source has no WAV data chunk\n");
+                return -1;
+            }
+            return 0;
+        }
+        if (!have_fmt) {
+            fprintf(stderr, "xhispertool: audio source has no WAV fmt chunk\n");
+            return -1;
+        }
+        r->header = 2;
+        data = pos + 8;
+    }
+
+    record_store(r, r->head + data, r->head_len - data);
+    record_store(r, p + take, n - take);
+    return 0;
+}
+
+// Read what the source has; returns 0 at EOF, -1 if it is not usable audio
+static int record_read(struct recorder *r) {
+    unsigned char chunk[8192];
+    size_t want = sizeof(chunk);
+
+    if (r->realtime) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t due = (ts_ns(&now) - ts_ns(&r->started)) / 1000 * 2 * RECORD_RATE / 1000000;
+        // Bytes held for the header count until record_append stores them
+        int64_t have = r->len + (r->header != 2 ? r->head_len : 0);
+        if (due <= have) return 1;
+        if ((int64_t)want > due - have) want = due - have;
+    }
+
+    ssize_t n = read(r->src, chunk, want);
+    if (n < 0) return errno == EINTR || errno == EAGAIN ? 1 : 0;
+    if (n == 0) return 0;
+    if (record_append(r, chunk, n) < 0) return -1;
+    return 1;
+}
+
+static pid_t spawn_capture(int *fd) {
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) < 0) {
+        perror("failed to create pipe");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("failed to fork");
+        close(p[0]);
+        close(p[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        dup2(p[1], STDOUT_FILENO);
+        execlp("pw-record", "pw-record", "--channels=1", "--rate=16000",
+               "--format=s16", "-", (char *)NULL);
+        perror("failed to run pw-record");
+        _exit(127);
+    }
+    close(p[1]);
+    *fd = p[0];
+    return pid;
+}
+
+// Stop capturing: end pw-record and keep everything it had buffered
+static void record_finish(struct recorder *r) {
+    if (r->child > 0) {
+        kill(r->child, SIGTERM);
+        int flags = fcntl(r->src, F_GETFL);
+        fcntl(r->src, F_SETFL, flags & ~O_NONBLOCK);
+        r->realtime = 0;
+        while (r->src >= 0 && record_read(r) > 0);
+        waitpid(r->child, NULL, 0);
+        r->child = 0;
+    }
+    if (r->src >= 0) {
+        close(r->src);
+        r->src = -1;
+    }
+    // Odd trailing byte from a cut-off source
+    r->len &= ~(size_t)1;
+}
+
+// Handle "stop [threshold=<dB>] [percentage=<pct>] [trim=0|1] [pad=<ms>]
+// [pause=<ms>]": reply with the levels and the sealed memfd
+static int record_stop(struct recorder *r, int client, char *opts) {
+    double threshold = -50, percentage = 95;
+    long pad_ms = 200, pause_ms = 600;
+    int trim = 0;
+
+    for (char *tok = strtok(opts, " "); tok; tok = strtok(NULL, " ")) {
+        if (strncmp(tok, "threshold=", 10) == 0) threshold = strtod(tok + 10, NULL);
+        else if (strncmp(tok, "percentage=", 11) == 0) percentage = strtod(tok + 11, NULL);
+        else if (strncmp(tok, "trim=", 5) == 0) trim = atoi(tok + 5);
+        else if (strncmp(tok, "pad=", 4) == 0) pad_ms = atol(tok + 4);
+        else if (strncmp(tok, "pause=", 6) == 0) pause_ms = atol(tok + 6);
+    }
+
+    record_finish(r);
+
+    struct timespec analysis;
+    clock_gettime(CLOCK_MONOTONIC, &analysis);
+    struct pcm pcm = {
+        .samples = (const int16_t *)r->buf,
+        .count = r->len / 2,
+        .rate = RECORD_RATE,
+        .channels = 1,
+    };
+    struct levels lv;
+    analyze_pcm(&pcm, threshold, &lv);
+    int silent = levels_silent(&lv, threshold, percentage);
+    size_t recorded = r->len;
+
+    // Compact the kept frames to the front of the buffer
+    if (trim && !silent && pcm.count > 0) {
+        size_t frame = RECORD_RATE * FRAME_MS / 1000;
+        size_t nframes = (pcm.count + frame - 1) / frame;
+        unsigned char *keep = calloc(nframes, 1);
+        size_t first, last, out = 0;
+        if (keep) {
+            trim_mark(pcm.samples, pcm.count, RECORD_RATE, threshold,
+                      pad_ms, pause_ms, keep, &first, &last);
+            for (size_t f = first; f < last; f++) {
+                if (!keep[f]) continue;
+                size_t n = f == nframes - 1 ? pcm.count - f * frame : frame;
+                memmove(r->buf + out, r->buf + f * frame * 2, n * 2);
+                out += n * 2;
+            }
+            // Nothing kept (percentage over 100): send it untrimmed
+            if (out) r->len = out;
+            free(keep);
+        }
+    }
+
+    // Seal: size and contents are fixed once the receiver sees the fd
+    munmap(r->buf, r->cap);
+    r->buf = NULL;
+    if (ftruncate(r->memfd, r->len) < 0 ||
+        fcntl(r->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        perror("failed to seal recording");
+    }
+
+    char reply[256];
+    int len = snprintf(reply, sizeof(reply),
+                       "peak=%.1f rms=%.1f silent_frames=%.1f%% seconds=%.2f kept=%.2f verdict=%s "
+                       "analysis_ms=%.2f",
+                       lv.peak_db, lv.rms_db, lv.silent_pct,
+                       recorded / (2.0 * RECORD_RATE), r->len / (2.0 * RECORD_RATE),
+                       silent ? "silent" : "sound", ms_since(&analysis));
+    fprintf(stderr, "xhispertool: %s\n", reply);
+
+    struct iovec iov = {.iov_base = reply, .iov_len = len};
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &r->memfd, sizeof(int));
+
+    if (sendmsg(client, &msg, MSG_NOSIGNAL) < 0) {
+        perror("failed to send recording");
+        return 1;
+    }
+    return 0;
+}
+
+// xhispertool record: capture until stopped (see record_stop)
+static int run_record(int argc, char *argv[]) {
+    struct recorder r = {.memfd = -1, .src = -1};
+    const char *input = NULL;
+
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--input=", 8) == 0) {
+            input = argv[i] + 8;
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            r.realtime = 1;
+        } else {
+            fprintf(stderr, "Error: 'record' takes [--input=<file>|-] [--realtime]\n");
+            return 1;
+        }
+    }
+
+    int fd_listen = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path + 1, RECORD_SOCKET_NAME, sizeof(addr.sun_path) - 2);
+    if (fd_listen < 0 || bind(fd_listen, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd_listen, 4) < 0) {
+        if (errno == EADDRINUSE) {
+            fprintf(stderr, "xhispertool: a recording is already running\n");
+        } else {
+            perror("failed to bind recorder socket");
+        }
+        return 1;
+    }
+
+    // Pages are only allocated as audio arrives
+    r.cap = (size_t)RECORD_MAX_SECONDS * RECORD_RATE * 2;
+    r.memfd = memfd_create("xhisper-recording", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (r.memfd < 0 || ftruncate(r.memfd, r.cap) < 0) {
+        perror("failed to create recording buffer");
+        return 1;
+    }
+    r.buf = mmap(NULL, r.cap, PROT_READ | PROT_WRITE, MAP_SHARED, r.memfd, 0);
+    if (r.buf == MAP_FAILED) {
+        perror("failed to map recording buffer");
+        return 1;
+    }
+
+    if (!input) {
+        r.child = spawn_capture(&r.src);
+        if (r.child < 0) return 1;
+    } else if (strcmp(input, "-") == 0) {
+        r.src = STDIN_FILENO;
+    } else if ((r.src = open(input, O_RDONLY | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "Error: %s: %s\n", input, strerror(errno));
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &r.started);
+
+    struct sigaction sa = {.sa_handler = record_signal};
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int ret = 1, stopped = 0;
+    int waiting[RECORD_CLIENTS];
+    int nwaiting = 0;
+    while (!record_quit && !stopped) {
+        // Listener, clients, then the source; a paced file is always
+        // readable: tick instead of polling it
+        struct pollfd pfd[2 + RECORD_CLIENTS] = {{.fd = fd_listen, .events = POLLIN}};
+        int npfd = 1;
+        for (int i = 0; i < nwaiting; i++) {
+            pfd[npfd++] = (struct pollfd){.fd = waiting[i], .events = POLLIN};
+        }
+        int polled = r.src >= 0 && !r.realtime;
+        if (polled) pfd[npfd++] = (struct pollfd){.fd = r.src, .events = POLLIN};
+        int timeout = r.realtime && r.src >= 0 ? 10 : -1;
+        if (poll(pfd, npfd, timeout) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        if (r.src >= 0 && (r.realtime || pfd[npfd - 1].revents)) {
+            int got = record_read(&r);
+            if (got < 0) break;
+            if (!got) {
+                // Source ended (file done or pw-record gone): wait for stop
+                if (r.child > 0) {
+                    fprintf(stderr, "xhispertool: audio capture ended early\n");
+                    waitpid(r.child, NULL, 0);
+                    r.child = 0;
+                }
+                if (r.src != STDIN_FILENO) close(r.src);
+                r.src = -1;
+            }
+        }
+
+        // Requests are read as they arrive, so a client that has yet to
+        // send one doesn't hold up capture
+        int kept = 0;
+        for (int i = 0; i < nwaiting; i++) {
+            int client = waiting[i];
+            if (stopped || !pfd[1 + i].revents) {
+                waiting[kept++] = client;
+                continue;
+            }
+
+            char msg[256];
+            ssize_t n = recv(client, msg, sizeof(msg) - 1, MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+                waiting[kept++] = client;
+                continue;
+            }
+            if (n >= 4 && strncmp(msg, "stop", 4) == 0) {
+                msg[n] = '\0';
+                ret = record_stop(&r, client, msg + 4);
+                stopped = 1;
+            }
+            // Anything else (a "recording" probe) just closes
+            close(client);
+        }
+        nwaiting = kept;
+
+        if (!stopped && (pfd[0].revents & POLLIN)) {
+            int client = accept4(fd_listen, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (client >= 0 && nwaiting == RECORD_CLIENTS) {
+                fprintf(stderr, "xhispertool: too many recorder clients, closing connection\n");
+                close(client);
+            } else if (client >= 0) {
+                waiting[nwaiting++] = client;
+            }
+        }
+    }
+
+    for (int i = 0; i < nwaiting; i++) close(waiting[i]);
+    if (r.child > 0) {
+        kill(r.child, SIGTERM);
+        waitpid(r.child, NULL, 0);
+    }
+    close(fd_listen);
+    return ret;
+}
+
+// Connect to the recorder; -1 if none is running
+static int connect_recorder(void) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path + 1, RECORD_SOCKET_NAME, sizeof(addr.sun_path) - 2);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static int daemon_running(void) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path + 1, SEQ_SOCKET_NAME, sizeof(addr.sun_path) - 2);
+    int running = fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if (fd >= 0) close(fd);
+    return running;
+}
+
+// xhispertool start: on-demand activation. Start xhispertoold (next to us,
+// else from $PATH) with the given options and return once it reports ready,
+// or at once if it already runs.
+static int run_start(int argc, char *argv[]) {
+    if (daemon_running()) return 0;
+
+    int notify[2];
+    if (pipe2(notify, O_CLOEXEC) < 0) {
+        perror("failed to create pipe");
+        return 1;
+    }
+
+    char exe[PATH_MAX - 32], daemon[PATH_MAX], notify_arg[32];
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    exe[n > 0 ? n : 0] = '\0';
+    snprintf(daemon, sizeof(daemon), "%s/xhispertoold", dirname(exe));
+    snprintf(notify_arg, sizeof(notify_arg), "--notify-fd=%d", notify[1]);
+
+    const char *args[argc + 1];
+    int nargs = 0;
+    args[nargs++] = access(daemon, X_OK) == 0 ? daemon : "xhispertoold";
+    for (int i = 2; i < argc; i++) args[nargs++] = argv[i];
+    args[nargs++] = notify_arg;
+    args[nargs] = NULL;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("failed to fork");
+        return 1;
+    }
+    if (pid == 0) {
+        setsid();
+        fcntl(notify[1], F_SETFD, 0);
+        execvp(args[0], (char *const *)args);
+        fprintf(stderr, "failed to run %s: %s\n", args[0], strerror(errno));
+        _exit(127);
+    }
+    close(notify[1]);
+
+    // READY=1 arrives once the daemon is usable; EOF first means it died
+    char msg[256];
+    size_t len = 0;
+    int ready = 0, exited = 0;
+    while (!ready && !exited && len < sizeof(msg) - 1) {
+        int remaining = START_WAIT_MS - (int)ms_since(&start);
+        struct pollfd pfd = {.fd = notify[0], .events = POLLIN};
+        if (remaining <= 0 || poll(&pfd, 1, remaining) <= 0) break;
+        ssize_t got = read(notify[0], msg + len, sizeof(msg) - 1 - len);
+        exited = got <= 0;
+        if (exited) break;
+        len += got;
+        msg[len] = '\0';
+        ready = strstr(msg, "READY=1\n") != NULL;
+    }
+    close(notify[0]);
+
+    // A concurrent start won the socket: ours exited, theirs is up
+    if (!ready && daemon_running()) return 0;
+    if (exited) {
+        fprintf(stderr, "xhispertoold exited before it was ready\n");
+        return 1;
+    }
+    if (!ready) {
+        fprintf(stderr, "xhispertoold did not become ready within %d ms\n", START_WAIT_MS);
+        return 1;
+    }
+    const char *status = strstr(msg, "STATUS=");
+    fprintf(stderr, "xhispertoold: started in %.1f ms (%.*s)\n", ms_since(&start),
+            status ? (int)strcspn(status + 7, "\n") : 0, status ? status + 7 : "");
+    return 0;
+}
+
+// Send the recorder its stop request; returns the recording's memfd with
+// the levels line in reply, or -2 if none is running and -1 if it failed
+static int stop_recorder(const char *msg, char *reply, size_t size) {
+    int fd = connect_recorder();
+    if (fd < 0) {
+        fprintf(stderr, "Error: no recording is running\n");
+        return -2;
+    }
+    if (send(fd, msg, strlen(msg), 0) < 0) {
+        perror("failed to send stop");
+        close(fd);
+        return -1;
+    }
+
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = {.iov_base = reply, .iov_len = size - 1};
+    struct msghdr mh = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    ssize_t n = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+    close(fd);
+    struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&mh) : NULL;
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS) {
+        fprintf(stderr, "Error: recorder sent no audio\n");
+        return -1;
+    }
+    int memfd;
+    memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+    reply[n] = '\0';
+    return memfd;
+}
+
+// xhispertool record-stop: stop the recorder, print its verdict and
+// optionally save the (trimmed) PCM
+static int run_record_stop(int argc, char *argv[]) {
+    char msg[256] = "stop";
+    const char *out = NULL;
+
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0 && strchr(argv[i], '=') &&
+            strlen(msg) + strlen(argv[i]) < sizeof(msg) - 1) {
+            strcat(msg, " ");
+            strcat(msg, argv[i] + 2);
+        } else if (!out) {
+            out = argv[i];
+        } else {
+            fprintf(stderr, "Error: 'record-stop' takes [--threshold=<dB>] [--percentage=<pct>]\n"
+                            "       [--trim=0|1] [--pad=<ms>] [--pause=<ms>] [<out.pcm>]\n");
+            return 1;
+        }
+    }
+
+    char reply[256];
+    int memfd = stop_recorder(msg, reply, sizeof(reply));
+    if (memfd < 0) return -memfd;
+    printf("%s\n", reply);
+
+    int ret = 0;
+    if (out) {
+        struct stat st;
+        int fd_out = open(out, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_out < 0 || fstat(memfd, &st) < 0) {
+            fprintf(stderr, "Error: %s: %s\n", out, strerror(errno));
+            ret = 1;
+        } else {
+            off_t off = 0;
+            while (off < st.st_size) {
+                ssize_t w = sendfile(fd_out, memfd, &off, st.st_size - off);
+                if (w <= 0) {
+                    perror("failed to write recording");
+                    ret = 1;
+                    break;
+                }
+            }
+        }
+        if (fd_out >= 0) close(fd_out);
+    }
+    close(memfd);
+    return ret;
+}
+
+// xhispertool transcribe: a client of the resident transcription server
+// (xhisper_transcribe --server), so a dictation starts no Python. Prints
+// the text, or each segment as it is decoded with --stream; exits 2 if no
+// server answers within 5 seconds, 4 if the recording was silent.
+static int run_transcribe(int argc, char *argv[]) {
+    const char *model = "base", *device = "auto", *language = "", *prompt = "";
+    const char *raw = NULL, *audio = NULL;
+    int stream = 0, collect = 0, preload = 0, recorder = 0;
+    char stop[256] = "stop";
+    int bad = 0;
+
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--model=", 8) == 0) {
+            model = argv[i] + 8;
+        } else if (strncmp(argv[i], "--device=", 9) == 0) {
+            device = argv[i] + 9;
+        } else if (strncmp(argv[i], "--language=", 11) == 0) {
+            language = argv[i] + 11;
+        } else if (strncmp(argv[i], "--prompt=", 9) == 0) {
+            prompt = argv[i] + 9;
+        } else if (strncmp(argv[i], "--raw=", 6) == 0) {
+            raw = argv[i] + 6;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            stream = 1;
+        } else if (strcmp(argv[i], "--collect") == 0) {
+            collect = 1;
+        } else if (strcmp(argv[i], "--preload") == 0) {
+            preload = 1;
+        } else if (strcmp(argv[i], "--from-recorder") == 0) {
+            recorder = 1;
+        } else if ((strncmp(argv[i], "--threshold=", 12) == 0 ||
+                    strncmp(argv[i], "--percentage=", 13) == 0 ||
+                    strncmp(argv[i], "--trim=", 7) == 0) &&
+                   strlen(stop) + strlen(argv[i]) < sizeof(stop) - 1) {
+            strcat(stop, " ");
+            strcat(stop, argv[i] + 2);
+        } else if (argv[i][0] != '-' && !audio) {
+            audio = argv[i];
+        } else {
+            bad = 1;
+        }
+    }
+    if (bad || collect + preload + recorder + (audio != NULL) != 1) {
+        fprintf(stderr, "Error: 'transcribe' takes [--model=<m>] [--device=<d>] [--language=<l>]\n"
+                        "       [--prompt=<p>] [--stream] and one of <file> [--raw=f32|s16],\n"
+                        "       --collect, --preload or --from-recorder [--threshold=<dB>]\n"
+                        "       [--percentage=<pct>] [--trim=0|1]\n");
+        return 1;
+    }
+
+    struct buf req = {0};
+    char path[PATH_MAX];
+    if (audio && !realpath(audio, path)) {
+        fprintf(stderr, "Error: %s: %s\n", audio, strerror(errno));
+        return 1;
+    }
+    if (collect) {
+        buf_str(&req, "{\"collect\": true");
+    } else {
+        buf_str(&req, "{\"model\": ");
+        json_string(&req, model);
+        buf_str(&req, ", \"device\": ");
+        json_string(&req, device);
+    }
+    if (audio || recorder) {
+        buf_str(&req, ", \"language\": ");
+        json_string(&req, language);
+        buf_str(&req, ", \"prompt\": ");
+        json_string(&req, prompt);
+    }
+    if (audio) {
+        buf_str(&req, ", \"audio\": ");
+        json_string(&req, path);
+        if (raw) {
+            buf_str(&req, ", \"raw\": ");
+            json_string(&req, raw);
+        }
+    }
+    if (recorder) buf_str(&req, ", \"memfd\": \"s16\"");
+    if (!preload) buf_str(&req, stream ? ", \"stream\": true" : ", \"stream\": false");
+    buf_str(&req, "}\n");
+
+    // The recorder's verdict decides whether there is anything to decode
+    int memfd = -1;
+    if (recorder) {
+        char levels[256];
+        memfd = stop_recorder(stop, levels, sizeof(levels));
+        if (memfd < 0) {
+            buf_free(&req);
+            return -memfd;
+        }
+        if (strstr(levels, "verdict=silent")) {
+            close(memfd);
+            buf_free(&req);
+            return 4;
+        }
+    }
+
+    // Python binds the bare name (see TRANSCRIBE_SOCKET_NAME)
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path + 1, TRANSCRIBE_SOCKET_NAME, sizeof(addr.sun_path) - 2);
+    socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(TRANSCRIBE_SOCKET_NAME);
+    int fd = -1;
+    for (int waited = 0; fd < 0 && waited <= 5000; waited += 10) {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, addr_len) < 0) {
+            close(fd);
+            fd = -1;
+            usleep(10000);
+        }
+    }
+    if (fd < 0) {
+        fprintf(stderr, "Error: transcription server is not running\n");
+        if (memfd >= 0) close(memfd);
+        buf_free(&req);
+        return 2;
+    }
+
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = {.iov_base = req.data, .iov_len = req.len};
+    struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1};
+    if (memfd >= 0) {
+        mh.msg_control = control.buf;
+        mh.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    }
+    ssize_t sent = sendmsg(fd, &mh, MSG_NOSIGNAL);
+    if (memfd >= 0) close(memfd);
+    buf_free(&req);
+    if (sent < 0) {
+        perror("failed to send transcription request");
+        close(fd);
+        return 1;
+    }
+
+    // "segment" lines, then the response: "text", "silent" or "error"
+    struct buf in = {0}, value = {0};
+    char chunk[4096];
+    ssize_t n;
+    int ret = -1;
+    while (ret < 0 && (n = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+        buf_append(&in, chunk, n);
+        char *line = in.data, *nl;
+        while (ret < 0 && (nl = memchr(line, '\n', in.len - (line - in.data)))) {
+            *nl = '\0';
+            int silent = 0;
+            buf_free(&value);
+            if (json_get(line, "segment", &value, NULL) == 0) {
+                printf("%s\n", buf_cstr(&value));
+                fflush(stdout);
+            } else if (json_get(line, "error", &value, NULL) == 0) {
+                fprintf(stderr, "Error during transcription: %s\n", buf_cstr(&value));
+                ret = 1;
+            } else if (json_get(line, "silent", NULL, &silent) == 0 && silent) {
+                ret = 4;
+            } else {
+                if (!stream && json_get(line, "text", &value, NULL) == 0) {
+                    printf("%s\n", buf_cstr(&value));
+                }
+                ret = 0;
+            }
+            line = nl + 1;
+        }
+        size_t rest = in.len - (line - in.data);
+        memmove(in.data, line, rest);
+        in.len = rest;
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Error: transcription server closed the connection\n");
+        ret = 1;
+    }
+    buf_free(&in);
+    buf_free(&value);
+    close(fd);
+    return ret;
+}
+
+// Trace replay
+
+// xhispertool replay: play a trace back through an output, keeping the
+// recorded spacing of its frames divided by --speed (0: no waits)
+static int run_replay(int argc, char *argv[]) {
+    const char *spec = "uinput";
+    const char *path = NULL;
+    double speed = 1;
+
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--speed=", 8) == 0) {
+            char *end;
+            speed = strtod(argv[i] + 8, &end);
+            if (end == argv[i] + 8 || *end || speed < 0) {
+                fprintf(stderr, "Error: --speed must be a factor like 2 or 0.5 (0: no waits)\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            spec = argv[i] + 9;
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            fprintf(stderr, "Error: 'replay' takes one trace file\n");
+            return 1;
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "Error: 'replay' requires a trace file\n");
+        return 1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    size_t size = st.st_size;
+    const struct trace_header *hdr = MAP_FAILED;
+    if (size >= sizeof(*hdr)) hdr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED || memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) != 0) {
+        fprintf(stderr, "Error: %s is not an xhisper trace\n", path);
+        return 1;
+    }
+    const struct trace_event *ev = (const struct trace_event *)(hdr + 1);
+    size_t n = (size - sizeof(*hdr)) / sizeof(*ev);
+
+    atexit(cleanup);
+    if (open_output(spec) < 0) {
+        return 1;
+    }
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int64_t late_total = 0, late_max = 0;
+    size_t frames = 0;
+    for (size_t i = 0; i < n; frames++) {
+        int64_t t = ev[i].t_ns;
+        if (speed > 0) {
+            int64_t deadline = ts_ns(&start) + (int64_t)((t - ev[0].t_ns) / speed);
+            struct timespec ts = ns_ts(deadline);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            int64_t late = ts_ns(&now) - deadline;
+            late_total += late;
+            if (late > late_max) late_max = late;
+        }
+        for (; i < n && ev[i].t_ns == t; i++) emit(ev[i].type, ev[i].code, ev[i].value);
+        if (flush_events() < 0) {
+            return 1;
+        }
+    }
+
+    printf("replayed %zu events in %zu frames to %s: %.1f ms (trace %.1f ms), late avg %ldus max %ldus\n",
+           n, frames, output->name, ms_since(&start), n ? (ev[n - 1].t_ns - ev[0].t_ns) / 1e6 : 0.0,
+           frames ? (long)(late_total / (int64_t)frames / 1000) : 0L, (long)(late_max / 1000));
+
+    // Destroying the device drops whatever the compositor has not read yet
+    if (output == &outputs[0]) usleep(100000);
+    munmap((void *)hdr, size);
+    return 0;
 }
 
 // Client mode
@@ -335,7 +3188,44 @@ void show_usage() {
         "Usage:\n"
         "  xhispertool paste            - Paste from clipboard (Ctrl+V)\n"
         "  xhispertool type <char>      - Type a single ASCII character\n"
-        "  xhispertool backspace        - Press backspace\n"
+        "  xhispertool string [--] <text>\n"
+        "                               - Type a whole string (reads stdin if no text)\n"
+        "  xhispertool backspace [n]    - Press backspace (n times)\n"
+        "  xhispertool profile <name>   - Select timing profile (safe, fast, burst)\n"
+        "  xhispertool unicode <method> - Non-ASCII typing (clipboard, ctrl-shift-u)\n"
+        "  xhispertool layout <name>    - Select keyboard layout (us, fr, de, dvorak)\n"
+        "  xhispertool layout-chars <name>\n"
+        "                               - List the non-ASCII characters a layout types\n"
+        "  xhispertool analyze [--threshold=<dB>] [--percentage=<pct>] <file.wav>\n"
+        "                               - Peak/RMS levels of a 16-bit WAV; exits 0 if it is\n"
+        "                                 silent (peak below threshold, default -50 dB, or at\n"
+        "                                 least pct%% of 30 ms frames below it, default 95)\n"
+        "  xhispertool trim [--threshold=<dB>] [--pad=<ms>] [--max-pause=<ms>]\n"
+        "                   [--format=f32|s16] <in.wav> [<out.pcm>]\n"
+        "                               - Drop leading/trailing silence and shorten pauses\n"
+        "                                 of a 16 kHz mono WAV; writes raw PCM (default f32)\n"
+        "  xhispertool record [--input=<file>|-] [--realtime]\n"
+        "                               - Capture 16 kHz mono audio (pw-record, or a WAV/raw\n"
+        "                                 file or stdin) into memory until stopped\n"
+        "  xhispertool record-stop [--threshold=<dB>] [--percentage=<pct>] [--trim=1]\n"
+        "                          [<out.pcm>]\n"
+        "                               - Stop it, print its levels, optionally save the s16 PCM\n"
+        "  xhispertool transcribe [--model=<m>] [--device=<d>] [--language=<l>] [--prompt=<p>]\n"
+        "                         [--stream] <file> [--raw=f32|s16] | --collect | --preload\n"
+        "                         | --from-recorder [--threshold=<dB>] [--percentage=<pct>]\n"
+        "                         [--trim=0|1]\n"
+        "                               - Ask the transcription server for a file's text, the\n"
+        "                                 live recording's, the recorder's (exit 4: silent),\n"
+        "                                 or just to load the model; --stream prints segments\n"
+        "  xhispertool recording        - Exit 0 if a recording is running\n"
+        "  xhispertool abort            - Stop typing and drop all queued commands\n"
+        "  xhispertool sync             - Wait until everything queued has been typed\n"
+        "  xhispertool stats [--json]   - Per-command counters and rolling p50/p95/p99 of\n"
+        "                                 queue wait, typing time and chars/s\n"
+        "  xhispertool replay [--speed=<x>] [--output=<backend>] <trace>\n"
+        "                               - Play a trace from --output=trace:<file> back (to\n"
+        "                                 uinput by default) at its recorded pace times x\n"
+        "                                 (0: as fast as the output takes it)\n"
         "\n"
         "Input switching keys:\n"
         "  xhispertool leftalt          - Press left alt\n"
@@ -346,18 +3236,219 @@ void show_usage() {
         "  xhispertool rightshift       - Press right shift\n"
         "  xhispertool super            - Press super (Windows key)\n"
         "\n"
+        "Options:\n"
+        "  xhispertool --wait <command> - Wait until the daemon has executed the command;\n"
+        "                                 exits with 3 if it failed or was aborted\n"
+        "\n"
         "Daemon:\n"
-        "  xhispertoold                 - Run daemon (or xhispertool --daemon)\n"
+        "  xhispertoold [--profile=<name>] [--unicode=<method>] [--layout=<name>]\n"
+        "               [--realtime] [--hotkey=<key>+<key>...[:<mode>]]\n"
+        "               [--hotkey-device=/dev/input/eventN] [--notify-fd=<fd>]\n"
+        "               [--output=uinput|trace:<file>|null]\n"
+        "                               - Run daemon (or xhispertool --daemon); a hotkey\n"
+        "                                 chord on a real keyboard toggles dictation.\n"
+        "                                 Writes READY=1 to the fd (and $NOTIFY_SOCKET)\n"
+        "                                 once it can type. Keys go to a virtual keyboard,\n"
+        "                                 a trace file with timestamps, or nowhere\n"
+        "  xhispertool start [<daemon options>]\n"
+        "                               - Start the daemon unless running, wait until ready\n"
     );
 }
 
+// --wait: requests go out as frames on the seqpacket socket and are acked
+static int client_wait = 0;
+static uint32_t next_id = 1;
+static int pending_acks = 0;
+static int print_replies = 0;  // stats: the ack's message is the output
+
+// Send one command (command byte + payload) as a datagram or a frame
+static int send_message(int fd, const char *buf, size_t len) {
+    if (!client_wait) {
+        if (write(fd, buf, len) != (ssize_t)len) {
+            perror("failed to send command");
+            return 1;
+        }
+        return 0;
+    }
+
+    struct frame_header hdr = {
+        .version = PROTO_VERSION,
+        .cmd = buf[0],
+        .id = next_id++,
+    };
+    struct iovec iov[2] = {
+        {.iov_base = &hdr, .iov_len = sizeof(hdr)},
+        {.iov_base = (void *)(buf + 1), .iov_len = len - 1},
+    };
+    struct msghdr mh = {.msg_iov = iov, .msg_iovlen = 2};
+
+    if (sendmsg(fd, &mh, MSG_NOSIGNAL) != (ssize_t)(sizeof(hdr) + len - 1)) {
+        perror("failed to send command");
+        return 1;
+    }
+    pending_acks++;
+    return 0;
+}
+
+// Collect the ack of every request sent; returns 3 if any failed
+static int wait_acks(int fd) {
+    char buf[sizeof(struct frame_header) + MAX_MSG];
+    struct frame_header hdr;
+    int ret = 0;
+
+    while (pending_acks > 0) {
+        ssize_t n = recv(fd, buf, sizeof(buf) - 1, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < (ssize_t)sizeof(hdr)) {
+            fprintf(stderr, "xhispertool: connection to xhispertoold lost\n");
+            return 2;
+        }
+
+        memcpy(&hdr, buf, sizeof(hdr));
+        buf[n] = '\0';
+        pending_acks--;
+        if (hdr.status != XH_OK) {
+            fprintf(stderr, "xhispertool: request %u failed: %s\n",
+                    (unsigned)hdr.id, buf + sizeof(hdr));
+            ret = 3;
+        } else if (print_replies) {
+            const char *msg = buf + sizeof(hdr);
+            size_t len = strlen(msg);
+            printf("%s%s", msg, len && msg[len - 1] == '\n' ? "" : "\n");
+        }
+    }
+    return ret;
+}
+
+// Send text as one or more 's' commands, never splitting a UTF-8 sequence
+static int send_string(int fd, const char *s, size_t len) {
+    char buf[MAX_MSG];
+    buf[0] = 's';
+
+    while (len > 0) {
+        size_t chunk = len;
+        if (chunk > MAX_MSG - 1) {
+            chunk = MAX_MSG - 1;
+            // Back up to the start of a UTF-8 sequence
+            while (chunk > 0 && ((unsigned char)s[chunk] & 0xc0) == 0x80) chunk--;
+            if (chunk == 0) chunk = MAX_MSG - 1;
+        }
+
+        memcpy(buf + 1, s, chunk);
+        if (send_message(fd, buf, chunk + 1) != 0) {
+            return 1;
+        }
+        s += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+static int send_string_stream(int fd, FILE *in) {
+    size_t cap = MAX_MSG, len = 0;
+    char *text = malloc(cap);
+    if (!text) {
+        perror("failed to allocate buffer");
+        return 1;
+    }
+
+    size_t n;
+    while ((n = fread(text + len, 1, cap - len, in)) > 0) {
+        len += n;
+        if (len == cap) {
+            char *grown = realloc(text, cap * 2);
+            if (!grown) {
+                perror("failed to allocate buffer");
+                free(text);
+                return 1;
+            }
+            text = grown;
+            cap *= 2;
+        }
+    }
+
+    int ret = send_string(fd, text, len);
+    free(text);
+    return ret;
+}
+
 int run_client(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--wait") == 0) {
+        client_wait = 1;
+        argv++;
+        argc--;
+    }
+
     if (argc < 2) {
         show_usage();
         return 1;
     }
 
-    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (strcmp(argv[1], "analyze") == 0) {
+        return run_analyze(argc, argv);
+    }
+    if (strcmp(argv[1], "trim") == 0) {
+        return run_trim(argc, argv);
+    }
+    if (strcmp(argv[1], "record") == 0) {
+        return run_record(argc, argv);
+    }
+    if (strcmp(argv[1], "record-stop") == 0) {
+        return run_record_stop(argc, argv);
+    }
+    if (strcmp(argv[1], "transcribe") == 0) {
+        return run_transcribe(argc, argv);
+    }
+    if (strcmp(argv[1], "start") == 0) {
+        return run_start(argc, argv);
+    }
+    if (strcmp(argv[1], "replay") == 0) {
+        return run_replay(argc, argv);
+    }
+    if (strcmp(argv[1], "recording") == 0) {
+        int fd = connect_recorder();
+        if (fd >= 0) close(fd);
+        return fd >= 0 ? 0 : 1;
+    }
+
+    // Answered from the built-in tables, no daemon needed
+    if (strcmp(argv[1], "layout-chars") == 0) {
+        const struct keymap *k = argc == 3 ? find_layout(argv[2], strlen(argv[2])) : NULL;
+        if (!k) {
+            fprintf(stderr, "Error: 'layout-chars' requires a keyboard layout name\n");
+            return 1;
+        }
+        for (size_t i = 0; i < k->n_extra; i++) {
+            uint32_t cp = k->extra[i].cp;
+            char out[5];
+            int n;
+            if (cp < 0x800) {
+                out[0] = 0xc0 | (cp >> 6);
+                out[1] = 0x80 | (cp & 0x3f);
+                n = 2;
+            } else if (cp < 0x10000) {
+                out[0] = 0xe0 | (cp >> 12);
+                out[1] = 0x80 | ((cp >> 6) & 0x3f);
+                out[2] = 0x80 | (cp & 0x3f);
+                n = 3;
+            } else {
+                out[0] = 0xf0 | (cp >> 18);
+                out[1] = 0x80 | ((cp >> 12) & 0x3f);
+                out[2] = 0x80 | ((cp >> 6) & 0x3f);
+                out[3] = 0x80 | (cp & 0x3f);
+                n = 4;
+            }
+            out[n++] = '\n';
+            fwrite(out, 1, n, stdout);
+        }
+        return 0;
+    }
+
+    // Abort skips the command queue via the control socket
+    int is_abort = strcmp(argv[1], "abort") == 0;
+    if (strcmp(argv[1], "sync") == 0 || strcmp(argv[1], "stats") == 0) client_wait = 1;
+
+    int fd = socket(AF_UNIX, client_wait ? SOCK_SEQPACKET : SOCK_DGRAM, 0);
     if (fd < 0) {
         perror("failed to create socket");
         return 1;
@@ -366,7 +3457,9 @@ int run_client(int argc, char *argv[]) {
     // Use abstract namespace socket (same as daemon)
     struct sockaddr_un addr = {.sun_family = AF_UNIX};
     addr.sun_path[0] = '\0';
-    strncpy(addr.sun_path + 1, "xhisper_socket", sizeof(addr.sun_path) - 2);
+    strncpy(addr.sun_path + 1,
+            client_wait ? SEQ_SOCKET_NAME : is_abort ? CTL_SOCKET_NAME : SOCKET_NAME,
+            sizeof(addr.sun_path) - 2);
 
     if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         int err = errno;
@@ -387,15 +3480,90 @@ int run_client(int argc, char *argv[]) {
         return 2;
     }
 
-    char buf[2];
+    char buf[MAX_MSG];
     ssize_t len = 0;
 
     if (strcmp(argv[1], "paste") == 0) {
         buf[0] = 'p';
         len = 1;
+    } else if (is_abort) {
+        buf[0] = 'X';
+        len = 1;
+    } else if (strcmp(argv[1], "sync") == 0) {
+        buf[0] = 'W';
+        len = 1;
+    } else if (strcmp(argv[1], "stats") == 0) {
+        int json = argc == 3 && strcmp(argv[2], "--json") == 0;
+        if (argc > 3 || (argc == 3 && !json)) {
+            fprintf(stderr, "Error: 'stats' takes only --json\n");
+            close(fd);
+            return 1;
+        }
+        buf[0] = 'Q';
+        len = 1;
+        if (json) {
+            memcpy(buf + 1, "json", 4);
+            len += 4;
+        }
+        print_replies = 1;
     } else if (strcmp(argv[1], "backspace") == 0) {
         buf[0] = 'b';
         len = 1;
+        if (argc == 3) {
+            size_t digits = strlen(argv[2]);
+            if (digits == 0 || digits > 6 || parse_count(argv[2], digits) <= 0) {
+                fprintf(stderr, "Error: 'backspace' count must be a positive number\n");
+                close(fd);
+                return 1;
+            }
+            memcpy(buf + 1, argv[2], digits);
+            len += digits;
+        }
+    } else if (strcmp(argv[1], "profile") == 0) {
+        if (argc != 3 || strlen(argv[2]) > PROFILE_NAME_MAX ||
+            !find_profile(argv[2], strlen(argv[2]))) {
+            fprintf(stderr, "Error: 'profile' requires one of: safe, fast, burst\n");
+            close(fd);
+            return 1;
+        }
+        buf[0] = 'P';
+        memcpy(buf + 1, argv[2], strlen(argv[2]));
+        len = 1 + strlen(argv[2]);
+    } else if (strcmp(argv[1], "unicode") == 0) {
+        if (argc != 3 || find_unicode_method(argv[2], strlen(argv[2])) < 0) {
+            fprintf(stderr, "Error: 'unicode' requires one of: clipboard, ctrl-shift-u\n");
+            close(fd);
+            return 1;
+        }
+        buf[0] = 'U';
+        memcpy(buf + 1, argv[2], strlen(argv[2]));
+        len = 1 + strlen(argv[2]);
+    } else if (strcmp(argv[1], "layout") == 0) {
+        if (argc != 3 || !find_layout(argv[2], strlen(argv[2]))) {
+            fprintf(stderr, "Error: 'layout' requires one of: us, fr, de, dvorak\n");
+            close(fd);
+            return 1;
+        }
+        buf[0] = 'K';
+        memcpy(buf + 1, argv[2], strlen(argv[2]));
+        len = 1 + strlen(argv[2]);
+    } else if (strcmp(argv[1], "string") == 0) {
+        int ret;
+        int arg = (argc > 2 && strcmp(argv[2], "--") == 0) ? 3 : 2;
+        if (argc == arg) {
+            ret = send_string_stream(fd, stdin);
+        } else {
+            if (argc != arg + 1) {
+                fprintf(stderr, "Error: 'string' takes a single text argument (quote it)\n");
+                show_usage();
+                close(fd);
+                return 1;
+            }
+            ret = send_string(fd, argv[arg], strlen(argv[arg]));
+        }
+        if (ret == 0 && client_wait) ret = wait_acks(fd);
+        close(fd);
+        return ret;
     } else if (strcmp(argv[1], "rightalt") == 0) {
         buf[0] = 'r';
         len = 1;
@@ -434,14 +3602,11 @@ int run_client(int argc, char *argv[]) {
         return 1;
     }
 
-    if (write(fd, buf, len) != len) {
-        perror("failed to send command");
-        close(fd);
-        return 1;
-    }
+    int ret = send_message(fd, buf, len);
+    if (ret == 0 && client_wait) ret = wait_acks(fd);
 
     close(fd);
-    return 0;
+    return ret;
 }
 
 int main(int argc, char *argv[]) {
@@ -450,7 +3615,7 @@ int main(int argc, char *argv[]) {
 
     if (strcmp(prog, "xhispertoold") == 0 ||
         (argc > 1 && strcmp(argv[1], "--daemon") == 0)) {
-        return run_daemon();
+        return run_daemon(argc, argv);
     } else {
         return run_client(argc, argv);
     }